@@ -20,13 +20,18 @@
 #ifndef __CGIPLUS_BUILDER_H__
 #define __CGIPLUS_BUILDER_H__
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "Cgiplus.hpp"
 #include "Cookie.hpp"
 #include "HttpHeader.hpp"
+#include "Precondition.hpp"
+#include "Template.hpp"
 
 using std::string;
 
@@ -38,10 +43,20 @@ CGIPLUS_NS_BEGIN
  * Use this class to create your html output using templates and to
  * set your cookies. This class automatically creates the html
  * headers.
+ *
+ * The template is parsed only when it changes (check Template class),
+ * so building many times the same template costs one pass over the
+ * content.
  */
 class Builder
 {
 public:
+	/*! Function that renders the content with the fields and lists,
+	 * like the templates compiled into C++ (check CompiledTemplate)
+	 */
+	typedef std::function<void(const Template::Fields&, const Template::Lists&,
+	                           string&)> Renderer;
+
 	/*! Nothing special here, just initializing everything.
 	 */
 	Builder();
@@ -53,6 +68,13 @@ public:
 	 */
 	string& operator[](const string &key);
 
+	/*! Adds a row to a list used in template loops ("for row in key").
+	 *
+	 * @param key Key that represents the list in the template
+	 * @return New row by reference, to set the values of the columns
+	 */
+	Template::Row& addRow(const string &key);
+
 	/*! Sets a cookie to be defined in client's browser.
 	 *
 	 * @param key Key that will represent the cookie
@@ -80,11 +102,16 @@ public:
 	string build() const;
 
 	/*! Same as build method, but it already print the content into
-	 * standart output.
+	 * standart output. The header, the literal parts of the template
+	 * and the field values are written directly to the standard output
+	 * descriptor with writev, without joining them in a single string.
+	 * Afterwards the uploaded files waiting for the end of the response
+	 * are removed (check Cleanup::flush).
 	 */
 	void show() const;
 
-	/*! Sets template content. By default is empty.
+	/*! Sets template content. By default is empty. Only templates
+	 * from files can have includes (check Template).
 	 *
 	 * @param content Template content or real content
 	 * @return Reference to the current object, allowing easy usability
@@ -92,26 +119,101 @@ public:
 	Builder& setContent(const string &content);
 
 	/*! Sets template file path. If there's any error opening the file,
-	 * the template content is going to be empty.
+	 * the template content is going to be empty. The compiled template
+	 * is shared by the process until the file changes (check
+	 * TemplateCache), and each build uses the current version.
 	 *
 	 * @param templateFile Template file path
 	 * @return Reference to the current object, allowing easy usability
 	 */
 	Builder& setTemplateFile(const string &templateFile);
 
+	/*! Sets a function that renders the content instead of a
+	 * template, usually the renderFields method of a template compiled
+	 * into C++. The content or template file defined later replaces it.
+	 *
+	 * @param renderer Function that renders the content
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Builder& setRenderer(const Renderer &renderer);
+
 	/*! Set template's tag delimeter. By default is used <!-- and -->.
+	 * When the beginning or the end is empty, the fields are replaced
+	 * directly in the content without parsing it.
 	 * @param tags Defines the beggining and the end of the tag delimeter
 	 * @return Reference to the current object, allowing easy usability
 	 */
 	Builder& setTags(const std::pair<string, string> &tags);
 
-	/*! Remove all fields and cookies from builder.
+	/*! Defines if the field values are escaped when the template is
+	 * built, according to where they are in the page (text, attribute
+	 * or URL, check Escape). By default the values are written as they
+	 * are. Templates with empty tag delimiters and renderers are not
+	 * escaped.
+	 *
+	 * @param escaping True to escape the values
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Builder& setEscaping(const bool escaping);
+
+	/*! Compress the content with gzip or deflate when the client
+	 * accepts it (Accept-Encoding header). The content is compressed
+	 * part by part while it is written, and the Content-Encoding and
+	 * Vary headers are defined. By default the content is not
+	 * compressed.
+	 *
+	 * @param level Compression level, from 1 (fastest) to 9
+	 *              (smallest), or 0 to disable it
+	 * @param threshold Minimum content size in bytes that is compressed
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Builder& setCompression(const int level, const size_t threshold = 1024);
+
+	/*! Defines the entity tag of the response (ETag header) with a
+	 * hash (xxHash64) of the content, unless the application already
+	 * defined one. When the tag is in the If-None-Match header of a GET
+	 * or HEAD request, the response is NOT_MODIFIED without body. By
+	 * default the tag is not created.
+	 *
+	 * @param entityTagging True to create the entity tag
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Builder& setEntityTagging(const bool entityTagging);
+
+	/*! Compare the conditional headers of the request with cheap
+	 * validators of the content (a version or the modification time),
+	 * before the application does the expensive work of the
+	 * response. The validators are sent in the ETag and Last-Modified
+	 * headers. When the request fails the preconditions, the status is
+	 * NOT_MODIFIED or PRECONDITION_FAILED and the content is never
+	 * built, so the application can call show and stop. Defining the
+	 * content again (or calling clear) discards the result, so the
+	 * content must be defined before:
+	 *
+	 *   if (builder.checkPreconditions(cgi.getPrecondition(),
+	 *                                  EntityTag::create(version)) == false) {
+	 *     builder.show();
+	 *     return;
+	 *   }
+	 *
+	 * @param precondition Conditional headers (check Cgi::getPrecondition)
+	 * @param entityTag Entity tag of the content (check
+	 *                  EntityTag::create), or an empty string
+	 * @param lastModified Modification time of the content in UTC
+	 * @return True when the response must be built
+	 */
+	bool checkPreconditions(const Precondition &precondition, const string &entityTag,
+	                        const boost::posix_time::ptime &lastModified =
+	                        boost::posix_time::not_a_date_time);
+
+	/*! Remove all fields and cookies from builder, and the result of
+	 * checkPreconditions.
 	 *
 	 * @return Reference to the current object, allowing easy usability
 	 */
 	Builder& clear();
 
-	/*! Remove all fields from builder.
+	/*! Remove all fields and lists from builder.
 	 *
 	 * @return Reference to the current object, allowing easy usability
 	 */
@@ -124,10 +226,35 @@ public:
 	Builder& clearCookies();
 
 private:
+	class Response;
+
+	std::unique_ptr<Response> respond() const;
+	void prepare(Response &response) const;
+	Encoding::Value negotiate(Response &response) const;
+	bool isNotModified(const HttpHeader &header) const;
+	void resetPrecondition();
+	bool compress(Response &response, const Encoding::Value encoding) const;
+	string replaceFields(const string &content) const;
+	std::shared_ptr<const Template> compile() const;
+
 	HttpHeader _httpHeader;
+
+	// Content not parsed yet (when the content is appended with <<)
 	string _content;
+	std::shared_ptr<const Template> _template;
+	string _templateFile;
+	Renderer _renderer;
+
 	std::pair<string, string> _tags;
+	bool _escaping;
+	int _compressionLevel;
+	size_t _compressionThreshold;
+	bool _entityTagging;
+
+	// NOT_MODIFIED or PRECONDITION_FAILED when the content isn't built
+	HttpHeader::Status::Value _precondition;
 	std::map<string, string> _fields;
+	Template::Lists _lists;
 };
 
 CGIPLUS_NS_END
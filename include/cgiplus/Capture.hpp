@@ -0,0 +1,212 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_CAPTURE_HPP__
+#define __CGIPLUS_CAPTURE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Capture
+ *  \brief Records sampled requests in a binary log
+ *
+ * When enabled, Cgi records the CGI environment variables and the body
+ * of a sample of the requests before parsing them. The HTTP headers are
+ * stored, except credentials and cookies, and the body is stored as it
+ * was received (form fields included), so the log must be kept
+ * private. The log can be fed back to the application with the Replay
+ * class, reproducing real traffic without the HTTP server.
+ *
+ * Each record is appended with a single write, so many processes can
+ * share the same log. The sizes are stored as variable length integers
+ * (LEB128) to keep the log compact.
+ *
+ * The default values can be defined with the environment variables
+ * CGIPLUS_CAPTURE_FILE, CGIPLUS_CAPTURE_RATE and
+ * CGIPLUS_CAPTURE_MAX_BODY_SIZE.
+ */
+class Capture
+{
+public:
+	/*! \class Request
+	 *  \brief Request stored in the log
+	 */
+	class Request
+	{
+	public:
+		typedef std::vector<std::pair<string, string>> Environment;
+
+		/*! Initialize an empty request.
+		 */
+		Request();
+
+		/*! Sets when the request was received.
+		 *
+		 * @param timestamp Microseconds since epoch
+		 * @return Reference to the current object, allowing easy usability
+		 */
+		Request& setTimestamp(const uint64_t timestamp);
+
+		/*! Returns when the request was received.
+		 *
+		 * @return Microseconds since epoch
+		 */
+		uint64_t getTimestamp() const;
+
+		/*! Adds a CGI environment variable.
+		 *
+		 * @param name Variable name
+		 * @param value Variable value
+		 * @return Reference to the current object, allowing easy usability
+		 */
+		Request& addEnvironment(const string &name, const string &value);
+
+		/*! Returns the CGI environment variables.
+		 *
+		 * @return List of variable names and values
+		 */
+		Environment const& getEnvironment() const;
+
+		/*! Sets the request body.
+		 *
+		 * @param body Body as received from the standard input
+		 * @return Reference to the current object, allowing easy usability
+		 */
+		Request& setBody(const string &body);
+
+		/*! Returns the request body.
+		 *
+		 * @return Body as received from the standard input
+		 */
+		string const& getBody() const;
+
+	private:
+		uint64_t _timestamp;
+		Environment _environment;
+		string _body;
+	};
+
+	/*! Initialize the capture with the values of the environment
+	 * variables. By default the capture is disabled.
+	 */
+	Capture();
+
+	/*! Sets the log file. When empty the capture is disabled.
+	 *
+	 * @param file Log file path
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Capture& setFile(const string &file);
+
+	/*! Returns the log file.
+	 *
+	 * @return Log file path
+	 */
+	string getFile() const;
+
+	/*! Sets the fraction of the requests that are recorded. By default
+	 * is 1 (all requests).
+	 *
+	 * @param rate Number between 0 and 1
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Capture& setRate(const double rate);
+
+	/*! Returns the fraction of the requests that are recorded.
+	 *
+	 * @return Number between 0 and 1
+	 */
+	double getRate() const;
+
+	/*! Sets the maximum body size of a recorded request. Requests with
+	 * bigger bodies are never recorded. By default is 1 MB.
+	 *
+	 * @param maxBodySize Maximum body size in bytes
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Capture& setMaxBodySize(const size_t maxBodySize);
+
+	/*! Returns the maximum body size of a recorded request.
+	 *
+	 * @return Maximum body size in bytes
+	 */
+	size_t getMaxBodySize() const;
+
+	/*! Returns if the capture is enabled.
+	 *
+	 * @return True when there's a log file and a rate above zero
+	 */
+	bool isEnabled() const;
+
+	/*! Decide if the current request is recorded and, when it is, read
+	 * the body from the standard input (CONTENT_LENGTH bytes) and
+	 * append the request to the log.
+	 *
+	 * @param body Body read from the standard input, that must be used
+	 *             instead of the standard input by the parser
+	 * @return True if the body was read (even when the log couldn't be
+	 *         written)
+	 */
+	bool record(string &body) const;
+
+	/*! Append a request to a log file.
+	 *
+	 * @param file Log file path
+	 * @param request Request to store
+	 * @return True on success
+	 */
+	static bool write(const string &file, const Request &request);
+
+	/*! Read all requests of a log file.
+	 *
+	 * @param file Log file path
+	 * @param requests Requests found in the log
+	 * @return False if the file couldn't be read or is corrupted (the
+	 *         requests before the error are kept)
+	 */
+	static bool load(const string &file, std::vector<Request> &requests);
+
+	/*! Returns if the environment variable is part of the CGI request
+	 * (RFC 3875 meta-variables and HTTP headers). Credentials
+	 * (HTTP_AUTHORIZATION, HTTP_PROXY_AUTHORIZATION) and cookies
+	 * (HTTP_COOKIE) are never recorded.
+	 *
+	 * @param name Variable name
+	 * @return True for request variables
+	 */
+	static bool isRequestVariable(const string &name);
+
+private:
+	string _file;
+	double _rate;
+	size_t _maxBodySize;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_CAPTURE_HPP__
@@ -20,14 +20,28 @@
 #ifndef __CGIPLUS_CGI_H__
 #define __CGIPLUS_CGI_H__
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <typeindex>
+#include <typeinfo>
+#include <type_traits>
+#include <vector>
 
+#include <boost/any.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
 
 #include "Cgiplus.hpp"
 #include "HttpHeader.hpp"
+#include "Precondition.hpp"
+#include "Progress.hpp"
+#include "ResumableUpload.hpp"
+#include "Settings.hpp"
+#include "UploadedFile.hpp"
+#include "WorkerPool.hpp"
 
 using std::string;
 
@@ -36,7 +50,9 @@ CGIPLUS_NS_BEGIN
 /*! \class Cgi
  *  \brief Parse HTTP server requests.
  *
- * Use this class to get all data sent by the client browser.
+ * Use this class to get all data sent by the client browser. A Cgi
+ * object is not thread-safe (even the const methods remember the
+ * converted values), so threads must not share it without a lock.
  */
 class Cgi
 {
@@ -63,6 +79,14 @@ public:
 	 */
 	Cgi();
 
+	/*! Same as the default constructor, but parsing the request with
+	 * the given options.
+	 *
+	 * @param settings Options used while parsing the request
+	 * @see Settings
+	 */
+	explicit Cgi(const Settings &settings);
+
 	/*! All uploaded files are removed in destructor
 	 */
 	~Cgi();
@@ -90,7 +114,10 @@ public:
 	HttpHeader const* operator->() const;
 
 	/*! Access all data types retrieved by the CGI. You can also convert
-	 * the data using boost::lexical_cast.
+	 * the data using boost::lexical_cast. For files the path where the
+	 * file was stored is converted, unless UploadedFile is the desired
+	 * type, that gives access to all file information (like the
+	 * digest).
 	 *
 	 * @tparam T Type of the data that is going to be returned.
 	 * @param key Data key
@@ -98,34 +125,21 @@ public:
 	 *               possible values).
 	 * @return Data value (in the desired format, by default is string),
 	 *         when the data is not found an empty type is going to be
-	 *         returned.
+	 *         returned. When many files were uploaded with the same
+	 *         key, the first one is returned (check getFiles).
 	 */
 	template<class T = string>
 	T get(const string &key,
 	      const Source::Value source = Source::FIELD) const
 	{
-		T value;
-
-		if (source == Source::FIELD) {
-			auto input = _inputs.find(key);
-			if (input != _inputs.end()) {
-				value = boost::lexical_cast<T>(input->second);
-			}
-
-		} else if (source == Source::COOKIE) {
-			auto cookie = _httpHeader.getCookie(key);
-			if (cookie) {
-				value = boost::lexical_cast<T>(cookie->getValue());
-			}
-
-		} else if (source == Source::FILE) {
-			auto file = _files.find(key);
-			if (file != _files.end()) {
-				value = boost::lexical_cast<T>(file->second);
-			}
+		// Text doesn't need conversion, so there's nothing to remember
+		if (std::is_same<T, string>::value) {
+			return lookup<T>(key, source);
 		}
 
-		return value;
+		return memoize<T>(key, source, typeid(void), [&]() {
+				return lookup<T>(key, source);
+			});
 	}
 
 	/*! Access all data types retrieved by the CGI. You can also convert
@@ -146,28 +160,15 @@ public:
 	T get(const string &key, F converter,
 	      const Source::Value source = Source::FIELD) const
 	{
-		T value;
-
-		if (source == Source::FIELD) {
-			auto input = _inputs.find(key);
-			if (input != _inputs.end()) {
-				value = converter(input->second);
-			}
-
-		} else if (source == Source::COOKIE) {
-			auto cookie = _httpHeader.getCookie(key);
-			if (cookie) {
-				value = converter(cookie->getValue());
-			}
-
-		} else if (source == Source::FILE) {
-			auto file = _files.find(key);
-			if (file != _files.end()) {
-				value = converter(file->second);
-			}
+		// Only stateless converters (like lambdas without captures)
+		// always give the same result for the same key
+		if (std::is_empty<F>::value == false) {
+			return lookup<T>(key, converter, source);
 		}
 
-		return value;
+		return memoize<T>(key, source, typeid(F), [&]() {
+				return lookup<T>(key, converter, source);
+			});
 	}
 
 	/*! Allow converting all source data into a desired object using a
@@ -190,13 +191,19 @@ public:
 		case Source::COOKIE:
 			{
 				std::map<string, string> cookies;
-				for (const std::pair<string, Cookie> &cookie : _httpHeader.getCookies()) {
+				for (const std::pair<const string, Cookie> &cookie : _httpHeader.getCookies()) {
 					cookies[cookie.first] = cookie.second.getValue();
 				}
 				return converter(cookies);
 			}
 		case Source::FILE:
-			return converter(_files);
+			{
+				std::map<string, string> files;
+				for (const std::pair<const string, UploadedFile> &file : _files) {
+					files.insert(std::make_pair(file.first, file.second.getFilename()));
+				}
+				return converter(files);
+			}
 		};
 
 		return T();
@@ -207,10 +214,10 @@ public:
 	 * some special case.
 	 *
 	 * The enviroment variables current parsed are REQUEST_METHOD,
-	 * CONTENT_LENGTH, CONTENT_TYPE, QUERY_STRING, HTTP_COOKIE,
-	 * REMOTE_ADDR.
+	 * CONTENT_LENGTH, CONTENT_TYPE, HTTP_CONTENT_ENCODING,
+	 * QUERY_STRING, HTTP_COOKIE, REMOTE_ADDR, HTTP_IF_MATCH,
+	 * HTTP_IF_NONE_MATCH, HTTP_IF_MODIFIED_SINCE.
 	 *
-	 * @todo Upload binary files. For now is only allowed text/plain.
 	 */
 	void readInputs();
 
@@ -220,12 +227,45 @@ public:
 	 */
 	unsigned int getNumberOfInputs() const;
 
+	/*! Returns all files uploaded with the same control name (HTML
+	 * input with "multiple" attribute), in the order that they were
+	 * sent.
+	 *
+	 * @param key Control name
+	 * @return List of uploaded files
+	 */
+	std::vector<UploadedFile> getFiles(const string &key) const;
+
+	/*! Returns the number of files uploaded. Usefull for testing.
+	 *
+	 * @return Number of files uploaded
+	 */
+	unsigned int getNumberOfFiles() const;
+
 	/*! Returns the number of cookies parsed. Usefull for testing.
 	 *
 	 * @return Number of cookies parsed
 	 */
 	unsigned int getNumberOfCookies() const;
 
+	/*! Returns the request body when it is not a form
+	 * (application/x-www-form-urlencoded or multipart/form-data), like
+	 * a JSON or XML document. Compressed bodies are already decoded.
+	 *
+	 * @return Request body
+	 */
+	string getContent() const;
+
+	/*! Returns the resumable upload of the request (PATCH or PUT with
+	 * Content-Range and X-Upload-ID headers), after the chunk was
+	 * received. Use the committed offset to answer the client and
+	 * finalize the upload when it is complete. Check
+	 * Settings::setResumableDirectory.
+	 *
+	 * @return Resumable upload (invalid when the request isn't one)
+	 */
+	ResumableUpload const& getResumableUpload() const;
+
 	/*! Returns URI with parameters that can be used for restful applications.
 	 * @return URI
 	 */
@@ -238,13 +278,118 @@ public:
 	 */
 	string getRemoteAddress() const;
 
+	/*! Returns the conditional headers of the request
+	 * (HTTP_IF_MATCH, HTTP_IF_NONE_MATCH and HTTP_IF_MODIFIED_SINCE
+	 * enviroment variables). Compare them with the version or the
+	 * modification time of the content before building it (check
+	 * Builder::checkPreconditions).
+	 *
+	 * @return Conditional headers
+	 */
+	Precondition const& getPrecondition() const;
+
 private:
+	template<class T>
+	T lookup(const string &key, const Source::Value source) const
+	{
+		T value = T();
+
+		if (source == Source::FIELD) {
+			auto input = _inputs.find(key);
+			if (input != _inputs.end()) {
+				value = convert<T>(input->second);
+			}
+
+		} else if (source == Source::COOKIE) {
+			auto cookie = _httpHeader.getCookie(key);
+			if (cookie) {
+				value = convert<T>(cookie->getValue());
+			}
+
+		} else if (source == Source::FILE) {
+			auto file = _files.find(key);
+			if (file != _files.end()) {
+				value = convertFile<T>(file->second);
+			}
+		}
+
+		return value;
+	}
+
+	template<class T, class F>
+	T lookup(const string &key, F converter, const Source::Value source) const
+	{
+		T value = T();
+
+		if (source == Source::FIELD) {
+			auto input = _inputs.find(key);
+			if (input != _inputs.end()) {
+				value = converter(input->second);
+			}
+
+		} else if (source == Source::COOKIE) {
+			auto cookie = _httpHeader.getCookie(key);
+			if (cookie) {
+				value = converter(cookie->getValue());
+			}
+
+		} else if (source == Source::FILE) {
+			auto file = _files.find(key);
+			if (file != _files.end()) {
+				value = converter(file->second.getFilename());
+			}
+		}
+
+		return value;
+	}
+
+	typedef std::tuple<Source::Value, string, std::type_index, std::type_index> ConversionKey;
+
+	template<class T, class F>
+	T memoize(const string &key, const Source::Value source,
+	          const std::type_info &converter, F compute) const
+	{
+		ConversionKey conversionKey(source, key, std::type_index(typeid(T)),
+		                            std::type_index(converter));
+
+		auto conversion = _conversions.find(conversionKey);
+		if (conversion != _conversions.end()) {
+			return boost::any_cast<T>(conversion->second);
+		}
+
+		// Conversion errors are not stored, the exception goes to the
+		// caller every time
+		T value = compute();
+		_conversions[conversionKey] = value;
+		return value;
+	}
+
+	template<class T>
+	static T convert(const string &value)
+	{
+		return boost::lexical_cast<T>(value);
+	}
+
+	template<class T>
+	static T convertFile(const UploadedFile &file)
+	{
+		return convert<T>(file.getFilename());
+	}
+
 	void clearInputs();
 	void readMethod();
 	void readContentType();
+	void readContentEncoding();
 	void readQueryStringInputs();
 	void readContentInputs();
+	bool readResumableContent();
 	unsigned int readContentSize() const;
+	string readProgressToken() const;
+	bool readContent(const unsigned int size,
+	                 const std::function<void(const char*, const size_t)> &consumer);
+	bool readContent(const unsigned int size,
+	                 const std::function<void(const char*, const size_t)> &consumer,
+	                 Progress &progress);
 	void readContentLanguages();
 	void readAccepts();
 	void readAcceptLanguages();
@@ -252,9 +397,10 @@ private:
 	void readCookies();
 	void readURI();
 	void readRemoteAddress();
+	void readPreconditions();
 
 	void parse(string inputs);
-	void parseMultipart(const string &inputs);
+	bool parseMultipart(const unsigned int size);
 
 	void decode(string &inputs);
 	void decodeSpecialSymbols(string &inputs);
@@ -262,13 +408,34 @@ private:
 	string hexadecimalToText(const string &hexadecimal);
 	void removeDangerousHtmlCharacters(string &inputs);
 
+	Settings _settings;
 	HttpHeader _httpHeader;
 	std::map<string, string> _inputs;
-	std::map<string, string> _files;
+	std::multimap<string, UploadedFile> _files;
+	std::shared_ptr<WorkerPool> _workerPool;
+	string _content;
+	ResumableUpload _resumableUpload;
 	string _uri;
 	string _remoteAddress;
+	Precondition _precondition;
+
+	// Values already converted by get<T>, until the next readInputs
+	mutable std::map<ConversionKey, boost::any> _conversions;
 };
 
+template<>
+inline UploadedFile Cgi::convert<UploadedFile>(const string &)
+{
+	// Only files can be converted into UploadedFile
+	return UploadedFile();
+}
+
+template<>
+inline UploadedFile Cgi::convertFile<UploadedFile>(const UploadedFile &file)
+{
+	return file;
+}
+
 CGIPLUS_NS_END
 
 #endif // __CGIPLUS_CGI_H__
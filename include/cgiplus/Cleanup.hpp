@@ -0,0 +1,90 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_CLEANUP_HPP__
+#define __CGIPLUS_CLEANUP_HPP__
+
+#include <cstddef>
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Cleanup
+ *  \brief Removes uploaded files outside the response path
+ *
+ * Removing many files can be slow on loaded disks. Depending on the
+ * policy, the files are removed only after the response was sent or
+ * by a background thread that removes them in batches. Files that are
+ * still waiting are removed when the process exits.
+ */
+class Cleanup
+{
+public:
+	/*! \class Policy
+	 *  \brief Represents when the uploaded files are removed.
+	 */
+	class Policy
+	{
+	public:
+		/*! List all cleanup policies.
+		 */
+		enum Value {
+			IMMEDIATE,      // Removed when the Cgi object is destroyed
+			AFTER_RESPONSE, // Removed by Cleanup::flush or at exit
+			BACKGROUND,     // Removed in batches by a background thread
+			ANONYMOUS       // Files without name (O_TMPFILE), they vanish
+			                // when the last descriptor is closed
+		};
+	};
+
+	/*! Remove the file according to the policy. For IMMEDIATE (or
+	 * ANONYMOUS files that ended up with a name) the file is removed
+	 * now.
+	 *
+	 * @param filename Path of the file
+	 * @param policy Check Cleanup::Policy for possible values
+	 */
+	static void schedule(const string &filename, const Policy::Value policy);
+
+	/*! Remove all files waiting for the end of the response
+	 * (AFTER_RESPONSE). Builder::show calls it after the response was
+	 * written, call it when the response is written in another way.
+	 */
+	static void flush();
+
+	/*! Returns the number of files waiting to be removed, including the
+	 * ones in the background thread queue.
+	 *
+	 * @return Number of files
+	 */
+	static size_t getPending();
+
+	/*! Wait until the background thread removes all the files in its
+	 * queue.
+	 */
+	static void wait();
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_CLEANUP_HPP__
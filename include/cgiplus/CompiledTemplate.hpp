@@ -0,0 +1,90 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_COMPILED_TEMPLATE_HPP__
+#define __CGIPLUS_COMPILED_TEMPLATE_HPP__
+
+#include <string>
+
+#include "Cgiplus.hpp"
+#include "Template.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class CompiledTemplate
+ *  \brief Functions used by the templates compiled into C++
+ *
+ * Templates can be compiled ahead of time into C++ headers with the
+ * CompiledTemplate builder of SCons (install/templatecompiler.py):
+ *
+ *   env.CompiledTemplate("Page.hpp", "page.html")
+ *
+ * Each template becomes a class with a std::string member for each
+ * field and a Template::List member for each list, so a missing field
+ * is a compile error. The literal parts are string constants of the
+ * program and nothing is parsed at runtime:
+ *
+ *   templates::Page page;
+ *   page.title = "Hello";
+ *   page.render(output);
+ *
+ * The static renderFields method of the class uses the fields and lists
+ * of the Builder, to be used with Builder::setRenderer.
+ */
+class CompiledTemplate
+{
+public:
+	/*! Looks up a field.
+	 *
+	 * @param fields Field values for each tag name
+	 * @param name Field name
+	 * @return Field value or NULL when it isn't defined
+	 */
+	static const string* find(const Template::Fields &fields, const char *name);
+
+	/*! Looks up a list.
+	 *
+	 * @param lists Lists for each name
+	 * @param name List name
+	 * @return List or NULL when it isn't defined
+	 */
+	static const Template::List* find(const Template::Lists &lists, const char *name);
+
+	/*! Appends the column of the row in the output.
+	 *
+	 * @param row Row of a list
+	 * @param column Column name
+	 * @param output Buffer where the value is appended
+	 */
+	static void append(const Template::Row &row, const char *column, string &output);
+
+	/*! Checks if the column of the row is empty or isn't defined.
+	 *
+	 * @param row Row of a list
+	 * @param column Column name
+	 * @return True when the column is empty
+	 */
+	static bool isEmpty(const Template::Row &row, const char *column);
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_COMPILED_TEMPLATE_HPP__
@@ -0,0 +1,116 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_CONTENT_STORE_HPP__
+#define __CGIPLUS_CONTENT_STORE_HPP__
+
+#include <cstddef>
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class ContentStore
+ *  \brief Content-addressed storage of uploaded files
+ *
+ * Each blob is stored only once, named by the SHA-256 digest of its
+ * content (<directory>/sha256/<2 first digits>/<digest>). Uploaded
+ * files with the same content share the same blob through hard links,
+ * so repeated uploads don't use more disk space. Blobs are never
+ * removed by the library.
+ *
+ * Blobs are read-only (mode 0444), because writing one of them would
+ * change every upload linked to it. An application that needs to
+ * change an uploaded file must copy it first (the superuser ignores
+ * the mode, so it must never write the files in place).
+ */
+class ContentStore
+{
+public:
+	/*! Initialize a disabled store (without directory).
+	 */
+	ContentStore();
+
+	/*! Sets the store directory. When empty the store is disabled.
+	 *
+	 * @param directory Store directory
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	ContentStore& setDirectory(const string &directory);
+
+	/*! Returns the store directory.
+	 *
+	 * @return Store directory
+	 */
+	string getDirectory() const;
+
+	/*! Returns if a directory was defined.
+	 *
+	 * @return True when the store can be used
+	 */
+	bool isEnabled() const;
+
+	/*! Returns the path of the blob with the given digest. The blob
+	 * may not exist.
+	 *
+	 * @param digest SHA-256 digest in hexadecimal format
+	 * @return Blob path or an empty string for invalid digests
+	 */
+	string getPath(const string &digest) const;
+
+	/*! Returns if there's already a blob with the given digest.
+	 *
+	 * @param digest SHA-256 digest in hexadecimal format
+	 * @return True when the blob exists
+	 */
+	bool contains(const string &digest) const;
+
+	/*! Store the content of a file. When the blob already exists the
+	 * file is replaced by a link to the blob, releasing the duplicated
+	 * data. Otherwise the file is linked into the store (or copied when
+	 * they are in different file systems).
+	 *
+	 * @param digest SHA-256 digest of the file content
+	 * @param filename Path of the file
+	 * @return True if the blob exists after the call
+	 */
+	bool add(const string &digest, const string &filename) const;
+
+	/*! Store the content kept in memory, when the blob doesn't exist
+	 * yet.
+	 *
+	 * @param digest SHA-256 digest of the data
+	 * @param data Content
+	 * @param size Number of bytes
+	 * @return True if the blob exists after the call
+	 */
+	bool add(const string &digest, const char *data, const size_t size) const;
+
+private:
+	string prepare(const string &digest) const;
+
+	string _directory;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_CONTENT_STORE_HPP__
@@ -0,0 +1,129 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_DEFLATER_HPP__
+#define __CGIPLUS_DEFLATER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <zlib.h>
+
+#include "Cgiplus.hpp"
+#include "Encoding.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Deflater
+ *  \brief Streaming compression of responses
+ *
+ * Encodes content in gzip or deflate (zlib) format chunk by chunk, so
+ * the response doesn't need to be joined before it is compressed.
+ *
+ * Parts that were compressed before (check compressPart) can be joined
+ * to the stream without compressing them again: the data compressed
+ * until then is flushed to a byte boundary, without references to the
+ * previous data, and the checksum is combined with the part's checksum.
+ * So only the dynamic parts of a response cost compression time.
+ */
+class Deflater
+{
+public:
+	/*! Prepare the zlib stream for the given content coding.
+	 *
+	 * @param encoding Content coding of the result (Encoding::GZIP or
+	 *                 Encoding::DEFLATE)
+	 * @param level Compression level, from 1 (fastest) to 9 (smallest)
+	 */
+	Deflater(const Encoding::Value encoding, const int level);
+
+	/*! Release zlib resources
+	 */
+	~Deflater();
+
+	/*! Compress a chunk of data, appending the result to output. On
+	 * errors false is returned and all the next calls are ignored.
+	 *
+	 * @param data Chunk
+	 * @param size Number of bytes in the chunk
+	 * @param output Where the compressed data is appended
+	 * @return True if the chunk was compressed successfully
+	 */
+	bool deflate(const char *data, const size_t size, string &output);
+
+	/*! Join a part compressed with compressPart to the stream.
+	 *
+	 * @param compressed Compressed part
+	 * @param size Number of bytes of the part before compression
+	 * @param crc CRC-32 of the part before compression
+	 * @param adler Adler-32 of the part before compression
+	 * @param output Where the compressed data is appended
+	 * @return True if the part was joined successfully
+	 */
+	bool join(const string &compressed, const size_t size, const uint32_t crc,
+	          const uint32_t adler, string &output);
+
+	/*! Finish the compressed stream, appending the remaining data (and
+	 * the gzip trailer) to output.
+	 *
+	 * @param output Where the compressed data is appended
+	 * @return True if the stream was finished successfully
+	 */
+	bool finish(string &output);
+
+	/*! Compress a part so it can be joined to any stream (raw deflate
+	 * blocks, without references outside the part and ending in a byte
+	 * boundary).
+	 *
+	 * @param data Part
+	 * @param size Number of bytes of the part
+	 * @param level Compression level, from 1 (fastest) to 9 (smallest)
+	 * @param compressed Where the compressed part is stored
+	 * @param crc CRC-32 of the part
+	 * @param adler Adler-32 of the part
+	 * @return True if the part was compressed successfully
+	 */
+	static bool compressPart(const char *data, const size_t size, const int level,
+	                         string &compressed, uint32_t &crc, uint32_t &adler);
+
+private:
+	Deflater(const Deflater &);
+	Deflater& operator=(const Deflater &);
+
+	bool run(const int flush, string &output);
+	void writeHeader(string &output);
+
+	z_stream _stream;
+	Encoding::Value _encoding;
+	int _level;
+	uLong _crc;
+	uLong _adler;
+	size_t _size;
+	bool _initialized;
+	bool _headerWritten;
+	bool _pending;
+	bool _failed;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_DEFLATER_HPP__
@@ -0,0 +1,121 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_DIGEST_HPP__
+#define __CGIPLUS_DIGEST_HPP__
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Digest
+ *  \brief Incremental content hashing
+ *
+ * Computes a digest of data that arrives in chunks, so that uploaded
+ * files can be hashed while they are written, without reading them
+ * again.
+ */
+class Digest
+{
+public:
+	/*! \class Algorithm
+	 *  \brief Represents the supported hash algorithms.
+	 */
+	class Algorithm
+	{
+	public:
+		/*! List all supported hash algorithms.
+		 */
+		enum Value {
+			NONE,
+			CRC32C,
+			SHA256,
+			XXHASH64
+		};
+	};
+
+	/*! Initialize the hash state.
+	 *
+	 * @param algorithm Hash algorithm (check Digest::Algorithm for
+	 *                  possible values)
+	 */
+	explicit Digest(const Algorithm::Value algorithm = Algorithm::NONE);
+
+	/*! Add more data to the digest.
+	 *
+	 * @param data Pointer to the data
+	 * @param size Number of bytes
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Digest& update(const char *data, const size_t size);
+
+	/*! Returns the digest of all data added until now in hexadecimal
+	 * format. The object can still be updated after this call. When
+	 * the algorithm is NONE an empty string is returned.
+	 *
+	 * @return Hexadecimal digest
+	 */
+	string toString() const;
+
+	/*! Returns the hash algorithm.
+	 *
+	 * @return Hash algorithm
+	 */
+	Algorithm::Value getAlgorithm() const;
+
+	/*! Compute the digest of a buffer at once.
+	 *
+	 * @param algorithm Hash algorithm
+	 * @param data Data to hash
+	 * @return Hexadecimal digest
+	 */
+	static string calculate(const Algorithm::Value algorithm, const string &data);
+
+private:
+	void updateCrc32c(const unsigned char *data, size_t size);
+	void updateSha256(const unsigned char *data, size_t size);
+	void transformSha256(const unsigned char *block);
+	void updateXxhash64(const unsigned char *data, size_t size);
+
+	Algorithm::Value _algorithm;
+	uint64_t _length;
+
+	// CRC32C state
+	uint32_t _crc;
+
+	// SHA-256 state
+	uint32_t _sha[8];
+
+	// XXH64 state
+	uint64_t _xxh[4];
+
+	// Incomplete block of SHA-256 (64 bytes) or XXH64 (32 bytes)
+	unsigned char _block[64];
+	size_t _blockSize;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_DIGEST_HPP__
@@ -0,0 +1,76 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_ENCODING_HPP__
+#define __CGIPLUS_ENCODING_HPP__
+
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Encoding
+ *  \brief Represents all supported content codings (RFC 2616 - Section
+ *  3.5).
+ */
+class Encoding
+{
+public:
+	/*! List all content codings supported by Cgi.
+	 */
+	enum Value {
+		UNDEFINED,
+		ANY,
+		IDENTITY,
+		GZIP,
+		DEFLATE,
+		UNKNOWN
+	};
+
+	/*! Convert a content coding in string format into one of the value
+	 * of Encoding::Value
+	 *
+	 * @param value Content coding in text format
+	 * @return Enum item of the content coding
+	 */
+	static Value detect(const string &value);
+
+	/*! Convert content coding value into a string
+	 *
+	 * @param value Encoding::Value
+	 * @return Content coding in http header string representation
+	 */
+	static string toString(const Value value);
+
+	/*! Choose the content coding of a response from the codings
+	 * accepted by the client (Accept-Encoding header). Gzip is
+	 * preferred when the quality values are the same.
+	 *
+	 * @param acceptEncoding Accept-Encoding header value
+	 * @return Encoding::GZIP, Encoding::DEFLATE or Encoding::IDENTITY
+	 */
+	static Value negotiate(const string &acceptEncoding);
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_ENCODING_HPP__
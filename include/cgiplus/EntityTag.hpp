@@ -0,0 +1,77 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __CGIPLUS_ENTITY_TAG_HPP__
+#define __CGIPLUS_ENTITY_TAG_HPP__
+
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class EntityTag
+ *  \brief Entity tags of the responses (ETag header) and the
+ *  conditional request headers (RFC 7232 - Sections 2.3 and 3).
+ */
+class EntityTag
+{
+public:
+	/*! \class Comparison
+	 *  \brief Represents how two entity tags are compared.
+	 */
+	class Comparison
+	{
+	public:
+		/*! List all comparison functions. Strong comparison needs both
+		 * tags strong and equal, weak comparison ignores the W/ prefix.
+		 */
+		enum Value {
+			STRONG,
+			WEAK
+		};
+	};
+
+	/*! Create an entity tag in the header format, with quotes.
+	 *
+	 * @param opaque Tag value, without quotes
+	 * @param weak True for a weak validator (W/ prefix)
+	 * @return Entity tag in http header representation
+	 */
+	static string create(const string &opaque, const bool weak = false);
+
+	/*! Check if an entity tag is in a list of entity tags, like the
+	 * If-None-Match and If-Match headers. The "*" list matches any
+	 * entity tag.
+	 *
+	 * @param list Header value with entity tags separated by commas
+	 * @param entityTag Entity tag in http header representation
+	 * @param comparison Comparison function (check EntityTag::Comparison)
+	 * @return True when the list has the entity tag
+	 */
+	static bool match(const string &list, const string &entityTag,
+	                  const Comparison::Value comparison);
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_ENTITY_TAG_HPP__
@@ -0,0 +1,194 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_ESCAPE_HPP__
+#define __CGIPLUS_ESCAPE_HPP__
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Escape
+ *  \brief Escapes values written in HTML pages
+ *
+ * The characters that are special in each context are replaced:
+ *
+ *   TEXT      - & < > " ' are replaced by entities
+ *   ATTRIBUTE - Same as TEXT, plus ` = and white spaces, so unquoted
+ *               attributes are also safe
+ *   URL       - Characters that can't be part of an URL are percent
+ *               encoded and & is replaced by an entity. URLs with a
+ *               scheme other than http, https, ftp, mailto and tel
+ *               (like javascript:) are replaced by "#"
+ *
+ * The value is searched 16 bytes at a time (SSE2) and the runs without
+ * special characters are written as they are, so clean values cost
+ * almost the same of a copy.
+ */
+class Escape
+{
+public:
+	/*! \class Context
+	 *  \brief Represents where the value is written in the page.
+	 */
+	class Context
+	{
+	public:
+		/*! List all contexts.
+		 */
+		enum Value {
+			NONE,
+			TEXT,
+			ATTRIBUTE,
+			URL,
+			URL_COMPONENT
+		};
+	};
+
+	/*! Data and size of a piece of the escaped value
+	 */
+	typedef std::pair<const char*, size_t> Piece;
+
+	/*! Escapes the value, calling emit(data, size) for each piece of
+	 * the result. The pieces point to the value or to constants, so
+	 * nothing is copied.
+	 *
+	 * @param data Value
+	 * @param size Value size in bytes
+	 * @param context Where the value is written
+	 * @param emit Function called for each piece
+	 */
+	template<class Emit>
+	static void apply(const char *data, const size_t size, const Context::Value context,
+	                  Emit &emit);
+
+	/*! Escapes the value, appending the result in the output.
+	 *
+	 * @param value Value
+	 * @param context Where the value is written
+	 * @param output Buffer where the result is appended
+	 */
+	static void append(const string &value, const Context::Value context, string &output);
+
+	/*! Returns the escaped value.
+	 *
+	 * @param value Value
+	 * @param context Where the value is written
+	 * @return Escaped value
+	 */
+	static string toString(const string &value, const Context::Value context);
+
+	/*! Finds the first character that must be escaped.
+	 *
+	 * @param data Value
+	 * @param size Value size in bytes
+	 * @param context Where the value is written
+	 * @return Position of the character, or size when there's none
+	 */
+	static size_t find(const char *data, const size_t size, const Context::Value context);
+
+	/*! Returns what replaces a special character.
+	 *
+	 * @param character Character found with find
+	 * @param context Where the value is written
+	 * @return Replacement
+	 */
+	static Piece getReplacement(const char character, const Context::Value context);
+
+	/*! Checks if the URL has no scheme or a safe one.
+	 *
+	 * @param data URL
+	 * @param size URL size in bytes
+	 * @return True when the URL can be written
+	 */
+	static bool isSafeUrl(const char *data, const size_t size);
+
+	/*! Detects the context of each position of a page, while the page
+	 *  is read in order. Only the HTML tags and attributes are
+	 *  considered, the content of scripts and styles is TEXT.
+	 */
+	class Scanner
+	{
+	public:
+		/*! Starts in the TEXT context.
+		 */
+		Scanner();
+
+		/*! Reads more content of the page.
+		 *
+		 * @param data Content
+		 * @param size Content size in bytes
+		 */
+		void feed(const char *data, const size_t size);
+
+		/*! Returns the context in the current position.
+		 *
+		 * @return Context
+		 */
+		Context::Value getContext() const;
+
+	private:
+		bool _inTag;
+		bool _inValue;
+		bool _valueStarted;
+		bool _nameEnded;
+		char _quote;
+		string _attribute;
+	};
+};
+
+template<class Emit>
+void Escape::apply(const char *data, const size_t size, const Context::Value context,
+                   Emit &emit)
+{
+	if (context == Context::NONE) {
+		emit(data, size);
+		return;
+	}
+
+	if (context == Context::URL && isSafeUrl(data, size) == false) {
+		emit("#", 1);
+		return;
+	}
+
+	size_t position = 0;
+	while (position < size) {
+		size_t clean = find(data + position, size - position, context);
+		if (clean > 0) {
+			emit(data + position, clean);
+			position += clean;
+		}
+
+		if (position < size) {
+			Piece replacement = getReplacement(data[position], context);
+			emit(replacement.first, replacement.second);
+			position++;
+		}
+	}
+}
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_ESCAPE_HPP__
@@ -0,0 +1,110 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_FRAGMENT_CACHE_HPP__
+#define __CGIPLUS_FRAGMENT_CACHE_HPP__
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class FragmentCache
+ *  \brief Rendered template fragments shared by the whole process
+ *
+ * Parts of a template inside a cache statement are rendered once and
+ * reused while the fields they depend on don't change:
+ *
+ *   <!-- cache navigation 60 section user --> ... <!-- end -->
+ *
+ * The fragment "navigation" is kept for 60 seconds (0 keeps it until it
+ * is evicted) for each value of the fields "section" and "user". The
+ * key is a xxHash64 of the template content (and of the templates it
+ * includes), the fragment name and the field values, so a template
+ * changed on disk or another template with the same fragment name
+ * doesn't reuse the result. Inside a loop the columns of the current
+ * row are listed as "row.column". The fragment must not depend on
+ * anything else (like other fields or unlisted columns).
+ *
+ * When the cache is full, the least recently used fragments are
+ * removed. The maximum size is 16 MB by default, or the value (in
+ * bytes) of the CGIPLUS_FRAGMENT_CACHE_SIZE environment variable.
+ */
+class FragmentCache
+{
+public:
+	/*! Returns the fragment when it is in the cache and not expired.
+	 *
+	 * @param key Fragment key
+	 * @return Rendered fragment or an empty pointer
+	 */
+	static std::shared_ptr<const string> get(const string &key);
+
+	/*! Stores a fragment, replacing the old one with the same key.
+	 * Fragments bigger than the cache are not stored.
+	 *
+	 * @param key Fragment key
+	 * @param content Rendered fragment
+	 * @param ttl Seconds that the fragment is valid (0 for no limit)
+	 */
+	static void set(const string &key, const std::shared_ptr<const string> &content,
+	                const unsigned int ttl);
+
+	/*! Sets the maximum size of all fragments, removing the least
+	 * recently used ones when necessary.
+	 *
+	 * @param maxSize Size in bytes
+	 */
+	static void setMaxSize(const size_t maxSize);
+
+	/*! Returns the maximum size of all fragments.
+	 *
+	 * @return Size in bytes
+	 */
+	static size_t getMaxSize();
+
+	/*! Remove all fragments from the cache.
+	 */
+	static void clear();
+
+	/*! Returns the size of all fragments in the cache.
+	 *
+	 * @return Size in bytes
+	 */
+	static size_t getSize();
+
+	/*! Returns the number of fragments in the cache.
+	 *
+	 * @return Number of fragments (including the expired ones that were
+	 *         not accessed again)
+	 */
+	static size_t getNumberOfFragments();
+
+private:
+	FragmentCache();
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_FRAGMENT_CACHE_HPP__
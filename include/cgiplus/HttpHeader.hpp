@@ -26,11 +26,13 @@
 #include <utility>
 #include <vector>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/optional.hpp>
 
 #include "Cgiplus.hpp"
 #include "Cookie.hpp"
 #include "Charset.hpp"
+#include "Encoding.hpp"
 #include "Language.hpp"
 #include "MediaType.hpp"
 
@@ -224,6 +226,20 @@ public:
 	 */
 	string getContentBoundary() const;
 
+	/*! Set the content coding of the message body. Possible values are
+	 * defined in Encoding::Value. By default is UNDEFINED.
+	 *
+	 * @param encoding Content coding
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	HttpHeader& setContentEncoding(const Encoding::Value encoding);
+
+	/*! Returns the content coding of the message body.
+	 *
+	 * @return Content coding
+	 */
+	Encoding::Value getContentEncoding() const;
+
 	/*! Add an output language. Possible values are defined in
 	 * Language::Value.
 	 *
@@ -238,6 +254,48 @@ public:
 	 */
 	std::set<Language::Value> getContentLanguages() const;
 
+	/*! Add a request header that selected the response (like
+	 * Accept-Encoding), so caches store a response for each value.
+	 *
+	 * @param field Request header name
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	HttpHeader& addVary(const string &field);
+
+	/*! Returns the request headers that selected the response.
+	 *
+	 * @return List of header names
+	 */
+	std::vector<string> getVary() const;
+
+	/*! Set the entity tag of the response (ETag header), in the header
+	 * format with quotes (check EntityTag::create).
+	 *
+	 * @param entityTag Entity tag of the content
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	HttpHeader& setEntityTag(const string &entityTag);
+
+	/*! Returns the entity tag of the response.
+	 *
+	 * @return Entity tag or an empty string when it isn't defined
+	 */
+	string getEntityTag() const;
+
+	/*! Set the modification time of the content (Last-Modified
+	 * header).
+	 *
+	 * @param lastModified Modification time in UTC
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	HttpHeader& setLastModified(const boost::posix_time::ptime &lastModified);
+
+	/*! Returns the modification time of the content.
+	 *
+	 * @return Modification time or not_a_date_time when it isn't defined
+	 */
+	boost::posix_time::ptime getLastModified() const;
+
 	/*! Add response desired format.
 	 *
 	 * @param accept Desired format
@@ -326,6 +384,30 @@ public:
 	 */
 	string toString(const unsigned int contentSize) const;
 
+	/*! Convert a time into a HTTP date (RFC 7231 - Section 7.1.1.1),
+	 * like "Sun, 06 Nov 1994 08:49:37 GMT".
+	 *
+	 * @param time Time in UTC
+	 * @return HTTP date
+	 */
+	static string formatDate(const boost::posix_time::ptime &time);
+
+	/*! Convert a HTTP date into a time. The obsolete formats (RFC 850
+	 * and asctime) are also accepted.
+	 *
+	 * @param date HTTP date
+	 * @return Time in UTC, or not_a_date_time when the date is invalid
+	 */
+	static boost::posix_time::ptime parseDate(const string &date);
+
+	/*! Convert a request method name (like REQUEST_METHOD) into its
+	 * value, ignoring the case.
+	 *
+	 * @param method Method name
+	 * @return Method, or Method::UNDEFINED when it's not known
+	 */
+	static Method::Value parseMethod(const string &method);
+
 	/*! Http header delimeter. It's public for tests purpouses.
 	 */
 	static string EOL;
@@ -339,7 +421,11 @@ private:
 	MediaType::Value _contentType;
 	Charset::Value _contentCharset;
 	string _contentBoundary;
+	Encoding::Value _contentEncoding;
 	std::set<Language::Value> _contentLanguages;
+	std::vector<string> _vary;
+	string _entityTag;
+	boost::posix_time::ptime _lastModified;
 	
 	// Supported fields
 	std::set<MediaType::Value> _accepts;
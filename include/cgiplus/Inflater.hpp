@@ -0,0 +1,90 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_INFLATER_HPP__
+#define __CGIPLUS_INFLATER_HPP__
+
+#include <string>
+
+#include <zlib.h>
+
+#include "Cgiplus.hpp"
+#include "Encoding.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Inflater
+ *  \brief Streaming decompression of request bodies
+ *
+ * Decodes gzip or deflate content chunk by chunk, so the body never
+ * needs to be stored compressed and decompressed at the same time. The
+ * decompressed size is limited to protect the application against
+ * compression bombs.
+ */
+class Inflater
+{
+public:
+	/*! Prepare the zlib stream for the given content coding.
+	 *
+	 * @param encoding Content coding of the data (Encoding::GZIP or
+	 *                 Encoding::DEFLATE)
+	 * @param limit Maximum number of decompressed bytes allowed
+	 */
+	Inflater(const Encoding::Value encoding, const size_t limit);
+
+	/*! Release zlib resources
+	 */
+	~Inflater();
+
+	/*! Decompress a chunk of data, appending the result to output. On
+	 * corrupted data or when the decompressed size exceeds the limit,
+	 * false is returned and all the next calls are ignored.
+	 *
+	 * @param data Compressed chunk
+	 * @param size Number of bytes in the chunk
+	 * @param output Where the decompressed data is appended
+	 * @return True if the chunk was decompressed successfully
+	 */
+	bool inflate(const char *data, const size_t size, string &output);
+
+	/*! Returns if the end of the compressed stream was reached.
+	 *
+	 * @return True when the whole compressed stream was decoded
+	 */
+	bool isFinished() const;
+
+private:
+	Inflater(const Inflater &);
+	Inflater& operator=(const Inflater &);
+
+	bool initialize(const int windowBits);
+
+	z_stream _stream;
+	Encoding::Value _encoding;
+	size_t _limit;
+	bool _initialized;
+	bool _finished;
+	bool _failed;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_INFLATER_HPP__
@@ -0,0 +1,143 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_MULTIPART_PARSER_HPP__
+#define __CGIPLUS_MULTIPART_PARSER_HPP__
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Cgiplus.hpp"
+#include "Settings.hpp"
+#include "UploadedFile.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class MultipartParser
+ *  \brief Streaming parser of multipart/form-data bodies
+ *
+ * The body is given in chunks and each byte is scanned only once. Parts
+ * with a filename are written directly into their own UploadedFile,
+ * while the other parts are stored as fields. A field bigger than
+ * Settings::getMaxFieldSize is stored as a file, so no data is lost.
+ */
+class MultipartParser
+{
+public:
+	/*! Prepare the parser for a body.
+	 *
+	 * @param boundary Boundary of the multipart body (without "--")
+	 * @param settings Options for the uploaded files and fields
+	 * @param directory Where the uploaded files are created (check
+	 *                  Spool::resolve). When empty, the spool of the
+	 *                  settings is resolved only if a file is written
+	 *                  to disk
+	 * @param expectedSize Size of the body, used to resolve the spool
+	 */
+	MultipartParser(const string &boundary, const Settings &settings,
+	                const string &directory = "", const size_t expectedSize = 0);
+
+	/*! Parse the next chunk of the body.
+	 *
+	 * @param data Chunk of the body
+	 * @param size Number of bytes in the chunk
+	 */
+	void feed(const char *data, const size_t size);
+
+	/*! Define a function called as soon as each file is received,
+	 * before the rest of the body is parsed.
+	 *
+	 * @param callback Function that receives the complete file
+	 */
+	void setFileCallback(const std::function<void(UploadedFile&)> &callback);
+
+	/*! Must be called after the last chunk. An incomplete part at the
+	 * end of the body is discarded.
+	 */
+	void finish();
+
+	/*! Remove all files created until now. Used when the body could
+	 * not be read completely.
+	 */
+	void discard();
+
+	/*! Returns the fields (parts without filename) in the order that
+	 * they were found.
+	 *
+	 * @return List of control names and values
+	 */
+	std::vector<std::pair<string, string>> const& getFields() const;
+
+	/*! Returns the files in the order that they were found.
+	 *
+	 * @return List of uploaded files
+	 */
+	std::vector<UploadedFile> const& getFiles() const;
+
+private:
+	class State
+	{
+	public:
+		enum Value {
+			PREAMBLE,
+			DELIMITER,
+			HEADERS,
+			BODY,
+			EPILOGUE
+		};
+	};
+
+	bool parsePreamble();
+	bool parseDelimiter();
+	bool parseHeaders();
+	bool parseBody();
+
+	void beginPart();
+	void appendPart(const char *data, const size_t size);
+	void endPart();
+
+	string _delimiter;
+	Settings _settings;
+	string _directory;
+	std::shared_ptr<const Spool> _spool;
+	size_t _expectedSize;
+	State::Value _state;
+
+	string _buffer;
+	size_t _position;
+	size_t _headersSize;
+
+	UploadedFile _part;
+	bool _partIsFile;
+	string _partValue;
+
+	std::vector<std::pair<string, string>> _fields;
+	std::vector<UploadedFile> _files;
+	std::function<void(UploadedFile&)> _fileCallback;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_MULTIPART_PARSER_HPP__
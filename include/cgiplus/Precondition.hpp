@@ -0,0 +1,151 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __CGIPLUS_PRECONDITION_HPP__
+#define __CGIPLUS_PRECONDITION_HPP__
+
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "Cgiplus.hpp"
+#include "HttpHeader.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Precondition
+ *  \brief Conditional request headers (RFC 7232).
+ *
+ * Stores the If-Match, If-None-Match and If-Modified-Since headers of
+ * the request, so the application can compare them with a cheap
+ * validator (version or modification time) before doing the expensive
+ * work of the response.
+ */
+class Precondition
+{
+public:
+	/*! Nothing special here, a request without conditional headers.
+	 */
+	Precondition();
+
+	/*! Set the request method, that defines the result of a failed
+	 * If-None-Match.
+	 *
+	 * @param method Request method
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Precondition& setMethod(const HttpHeader::Method::Value method);
+
+	/*! Returns the request method.
+	 *
+	 * @return Request method
+	 */
+	HttpHeader::Method::Value getMethod() const;
+
+	/*! Set the entity tags of the If-Match header.
+	 *
+	 * @param ifMatch Header value
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Precondition& setIfMatch(const string &ifMatch);
+
+	/*! Returns the entity tags of the If-Match header.
+	 *
+	 * @return Header value or an empty string when it wasn't sent
+	 */
+	string getIfMatch() const;
+
+	/*! Set the entity tags of the If-None-Match header.
+	 *
+	 * @param ifNoneMatch Header value
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Precondition& setIfNoneMatch(const string &ifNoneMatch);
+
+	/*! Returns the entity tags of the If-None-Match header.
+	 *
+	 * @return Header value or an empty string when it wasn't sent
+	 */
+	string getIfNoneMatch() const;
+
+	/*! Set the date of the If-Modified-Since header.
+	 *
+	 * @param ifModifiedSince Date of the client copy
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Precondition& setIfModifiedSince(const boost::posix_time::ptime &ifModifiedSince);
+
+	/*! Returns the date of the If-Modified-Since header.
+	 *
+	 * @return Date (not_a_date_time when it wasn't sent or is invalid)
+	 */
+	boost::posix_time::ptime getIfModifiedSince() const;
+
+	/*! Read the request method and the conditional headers from the
+	 * CGI environment (REQUEST_METHOD, HTTP_IF_MATCH,
+	 * HTTP_IF_NONE_MATCH and HTTP_IF_MODIFIED_SINCE). Headers that
+	 * weren't sent are cleared.
+	 *
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Precondition& readEnvironment();
+
+	/*! Check if the request has any conditional header.
+	 *
+	 * @return True when there's no conditional header
+	 */
+	bool isEmpty() const;
+
+	/*! Compare the conditional headers with the validators of the
+	 * current content, in the order of RFC 7232 - Section 6. Without
+	 * any validator the resource has no current representation, so
+	 * "If-Match: *" fails and "If-None-Match: *" passes (a PUT that
+	 * only creates).
+	 *
+	 * @param entityTag Entity tag of the content in http header
+	 *                  representation (check EntityTag::create), or an
+	 *                  empty string
+	 * @param lastModified Modification time of the content, or
+	 *                     not_a_date_time
+	 * @return HttpHeader::Status::NOT_MODIFIED or
+	 *         HttpHeader::Status::PRECONDITION_FAILED when the response
+	 *         must not be built, or HttpHeader::Status::UNDEFINED
+	 */
+	HttpHeader::Status::Value evaluate(const string &entityTag,
+	                                   const boost::posix_time::ptime &lastModified) const;
+
+	/*! Remove all conditional headers.
+	 *
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Precondition& clear();
+
+private:
+	HttpHeader::Method::Value _method;
+	string _ifMatch;
+	string _ifNoneMatch;
+	boost::posix_time::ptime _ifModifiedSince;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_PRECONDITION_HPP__
@@ -0,0 +1,136 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_PROGRESS_HPP__
+#define __CGIPLUS_PROGRESS_HPP__
+
+#include <cstdint>
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Progress
+ *  \brief Upload progress shared between processes
+ *
+ * While a request body is received, the number of bytes received and
+ * expected is published in a shared memory segment, identified by the
+ * upload token (X-Progress-ID header or query string field). Another
+ * CGI can read the progress with Progress::query without touching the
+ * upload process or the disk. Each token uses a slot of the segment
+ * that is updated with atomic operations, without locks.
+ */
+class Progress
+{
+public:
+	/*! \class State
+	 *  \brief Represents the state of an upload.
+	 */
+	class State
+	{
+	public:
+		/*! List all upload states.
+		 */
+		enum Value {
+			UNKNOWN,
+			RECEIVING,
+			FINISHED,
+			FAILED
+		};
+
+		/*! Convert the state to text (useful for the progress
+		 * endpoint response).
+		 *
+		 * @param value State
+		 * @return Text representation ("unknown", "receiving", ...)
+		 */
+		static string toString(const Value value);
+	};
+
+	/*! Initialize an empty progress, not attached to any upload.
+	 */
+	Progress();
+
+	/*! Start publishing the progress of an upload. When the shared
+	 * memory is not available or all slots are in use, nothing is
+	 * published.
+	 *
+	 * @param token Upload token
+	 * @param expected Number of bytes expected
+	 * @return True if the progress is being published
+	 */
+	bool start(const string &token, const uint64_t expected);
+
+	/*! Publish the number of bytes received until now.
+	 *
+	 * @param received Number of bytes received
+	 */
+	void update(const uint64_t received);
+
+	/*! Publish the end of the upload.
+	 *
+	 * @param success True when the whole body was received
+	 */
+	void finish(const bool success);
+
+	/*! Read the progress of an upload.
+	 *
+	 * @param token Upload token
+	 * @return Progress with State::UNKNOWN when the token was not found
+	 */
+	static Progress query(const string &token);
+
+	/*! Returns the upload token.
+	 *
+	 * @return Upload token
+	 */
+	string getToken() const;
+
+	/*! Returns the number of bytes received.
+	 *
+	 * @return Number of bytes
+	 */
+	uint64_t getReceived() const;
+
+	/*! Returns the number of bytes expected.
+	 *
+	 * @return Number of bytes
+	 */
+	uint64_t getExpected() const;
+
+	/*! Returns the state of the upload.
+	 *
+	 * @return Upload state
+	 */
+	State::Value getState() const;
+
+private:
+	string _token;
+	uint64_t _received;
+	uint64_t _expected;
+	State::Value _state;
+	void *_slot;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_PROGRESS_HPP__
@@ -0,0 +1,95 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_READ_PIPELINE_HPP__
+#define __CGIPLUS_READ_PIPELINE_HPP__
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "Cgiplus.hpp"
+
+CGIPLUS_NS_BEGIN
+
+/*! \class ReadPipeline
+ *  \brief Reads and parses a body at the same time
+ *
+ * A thread fills a ring of buffers with the input while the caller
+ * thread consumes the filled buffers. When all buffers are full the
+ * reader waits, and when all are empty the consumer waits
+ * (back-pressure), so the memory usage is limited to the ring size.
+ */
+class ReadPipeline
+{
+public:
+	/*! Function that fills the buffer with exactly the given number of
+	 * bytes. Returns false on error or end of input.
+	 */
+	typedef std::function<bool(char *buffer, const size_t size)> Reader;
+
+	/*! Function that consumes a filled buffer. Returns false to stop
+	 * the pipeline.
+	 */
+	typedef std::function<bool(const char *data, const size_t size)> Consumer;
+
+	/*! Allocate the ring of buffers.
+	 *
+	 * @param buffers Number of buffers in the ring (at least two)
+	 * @param bufferSize Size of each buffer
+	 */
+	ReadPipeline(const unsigned int buffers, const size_t bufferSize);
+
+	/*! Read and consume the given number of bytes.
+	 *
+	 * @param size Number of bytes to read
+	 * @param reader Called in the reader thread
+	 * @param consumer Called in the current thread, in order. When it
+	 *                 throws, the reader thread is stopped before the
+	 *                 exception leaves this method
+	 * @return True if all bytes were read and consumed
+	 */
+	bool run(const size_t size, const Reader &reader, const Consumer &consumer);
+
+private:
+	ReadPipeline(const ReadPipeline &);
+	ReadPipeline& operator=(const ReadPipeline &);
+
+	void read(const size_t size, const Reader &reader);
+
+	std::vector<std::vector<char>> _buffers;
+	std::vector<size_t> _sizes;
+	size_t _bufferSize;
+
+	unsigned int _head;
+	unsigned int _filled;
+	bool _finished;
+	bool _failed;
+	bool _stopping;
+
+	std::mutex _mutex;
+	std::condition_variable _notEmpty;
+	std::condition_variable _notFull;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_READ_PIPELINE_HPP__
@@ -0,0 +1,142 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_REPLAY_HPP__
+#define __CGIPLUS_REPLAY_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Capture.hpp"
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Replay
+ *  \brief Feeds recorded requests back to the application
+ *
+ * Each request of a capture log is prepared as if the HTTP server had
+ * sent it (environment variables and standard input), and the
+ * application handler is called and timed. The handler usually creates
+ * a Cgi object and builds the response, like the CGI main function. The
+ * standard output is discarded while the handler runs.
+ *
+ * The environment variables of the request and the standard streams
+ * are restored when the replay finishes.
+ */
+class Replay
+{
+public:
+	/*! Function called for each request
+	 */
+	typedef std::function<void()> Handler;
+
+	/*! \class Statistics
+	 *  \brief Time spent by the handler in each request
+	 */
+	class Statistics
+	{
+	public:
+		/*! Initialize empty statistics.
+		 */
+		Statistics();
+
+		/*! Adds the time of a request.
+		 *
+		 * @param duration Time in nanoseconds
+		 */
+		void add(const uint64_t duration);
+
+		/*! Returns the number of requests executed.
+		 *
+		 * @return Number of requests
+		 */
+		size_t getRequests() const;
+
+		/*! Returns the time of all requests.
+		 *
+		 * @return Time in nanoseconds
+		 */
+		uint64_t getTotal() const;
+
+		/*! Returns the average time of a request.
+		 *
+		 * @return Time in nanoseconds
+		 */
+		uint64_t getMean() const;
+
+		/*! Returns the time below which the given percentage of the
+		 * requests were executed (50 is the median).
+		 *
+		 * @param percentile Number between 0 and 100
+		 * @return Time in nanoseconds
+		 */
+		uint64_t getPercentile(const double percentile) const;
+
+	private:
+		std::vector<uint64_t> _durations;
+		uint64_t _total;
+	};
+
+	/*! Initialize a replay without requests.
+	 */
+	Replay();
+
+	/*! Load the requests of a capture log.
+	 *
+	 * @param file Log file path
+	 * @return True on success
+	 *
+	 * @see Capture
+	 */
+	bool load(const string &file);
+
+	/*! Adds a request to the replay.
+	 *
+	 * @param request Request
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Replay& add(const Capture::Request &request);
+
+	/*! Returns the number of requests loaded.
+	 *
+	 * @return Number of requests
+	 */
+	size_t getNumberOfRequests() const;
+
+	/*! Execute the handler for all requests, many times.
+	 *
+	 * @param handler Application handler
+	 * @param iterations Number of times that all requests are executed
+	 * @return Time spent by the handler
+	 */
+	Statistics run(const Handler &handler, const unsigned int iterations = 1) const;
+
+private:
+	std::vector<Capture::Request> _requests;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_REPLAY_HPP__
@@ -0,0 +1,161 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_RESUMABLE_UPLOAD_HPP__
+#define __CGIPLUS_RESUMABLE_UPLOAD_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class ResumableUpload
+ *  \brief Upload received in many requests
+ *
+ * Each request (PATCH or PUT with Content-Range) carries a chunk of the
+ * file, identified by the upload id. The chunks are written with pwrite
+ * in a preallocated file (<directory>/<id>.part) and the committed
+ * offset is stored in another file (<directory>/<id>.offset) only after
+ * the data is on disk, so an interrupted upload can continue from the
+ * last committed offset. When all bytes were received the file is
+ * moved to its destination atomically with finalize.
+ */
+class ResumableUpload
+{
+public:
+	/*! Initialize an upload that is not related to any file.
+	 */
+	ResumableUpload();
+
+	/*! Initialize the upload, loading the committed offset when the
+	 * upload already exists.
+	 *
+	 * @param directory Where the partial files are stored
+	 * @param id Upload id (letters, digits, '-' and '_' only)
+	 */
+	ResumableUpload(const string &directory, const string &id);
+
+	/*! Start receiving a chunk. The chunk must start at the committed
+	 * offset, and the first chunk defines the total size (the file is
+	 * preallocated). Only one request can write in the upload at a
+	 * time.
+	 *
+	 * @param offset Position of the first byte of the chunk
+	 * @param totalSize Size of the whole file
+	 * @return True if the chunk can be written
+	 */
+	bool begin(const uint64_t offset, const uint64_t totalSize);
+
+	/*! Write the next bytes of the chunk.
+	 *
+	 * @param data Chunk data
+	 * @param size Number of bytes
+	 * @return True if the data was written
+	 */
+	bool write(const char *data, const size_t size);
+
+	/*! Flush the data written to disk and commit the new offset. Even
+	 * when the chunk was not completely received the bytes written are
+	 * committed, so the client doesn't send them again.
+	 *
+	 * @return True if the offset was committed
+	 */
+	bool end();
+
+	/*! Move the complete file to the destination, atomically, and
+	 * remove the upload state.
+	 *
+	 * @param destination New path of the file (same file system)
+	 * @return True if the file was moved
+	 */
+	bool finalize(const string &destination);
+
+	/*! Remove the partial file and the upload state.
+	 */
+	void abort();
+
+	/*! Returns if the upload has a valid id and directory.
+	 *
+	 * @return True for valid uploads
+	 */
+	bool isValid() const;
+
+	/*! Returns if all bytes were received and committed.
+	 *
+	 * @return True for complete uploads
+	 */
+	bool isComplete() const;
+
+	/*! Returns the upload id.
+	 *
+	 * @return Upload id
+	 */
+	string getId() const;
+
+	/*! Returns the number of bytes committed. The next chunk must start
+	 * here (useful for the Range header of the response).
+	 *
+	 * @return Committed offset
+	 */
+	uint64_t getOffset() const;
+
+	/*! Returns the size of the whole file.
+	 *
+	 * @return Number of bytes or 0 when the upload wasn't started
+	 */
+	uint64_t getTotalSize() const;
+
+	/*! Parse the Content-Range header value ("bytes 0-99/1000").
+	 *
+	 * @param contentRange Header value
+	 * @param first Position of the first byte
+	 * @param last Position of the last byte
+	 * @param totalSize Size of the whole file
+	 * @return True if the header is valid
+	 */
+	static bool parseContentRange(const string &contentRange,
+	                              uint64_t &first,
+	                              uint64_t &last,
+	                              uint64_t &totalSize);
+
+private:
+	class Handle;
+
+	bool load();
+	bool commit();
+
+	string getPartFilename() const;
+	string getOffsetFilename() const;
+
+	string _directory;
+	string _id;
+	uint64_t _offset;
+	uint64_t _totalSize;
+	std::shared_ptr<Handle> _handle;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_RESUMABLE_UPLOAD_HPP__
@@ -0,0 +1,286 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_SETTINGS_HPP__
+#define __CGIPLUS_SETTINGS_HPP__
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Capture.hpp"
+#include "Cgiplus.hpp"
+#include "Cleanup.hpp"
+#include "ContentStore.hpp"
+#include "Digest.hpp"
+#include "Spool.hpp"
+#include "UploadedFile.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Settings
+ *  \brief Options used by Cgi while parsing the request
+ *
+ * Cgi parses the request in the constructor, so everything that
+ * changes the parsing behavior must be defined before. Use this class
+ * to define these options and give it to the Cgi constructor.
+ */
+class Settings
+{
+public:
+	/*! Initialize all options with the default values.
+	 */
+	Settings();
+
+	/*! Sets the maximum size of a decompressed request body (when the
+	 * client sends the body with gzip or deflate content coding). If
+	 * the body grows beyond this size it is ignored. By default is 64
+	 * MB.
+	 *
+	 * @param maxContentSize Maximum decompressed size in bytes
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& setMaxContentSize(const size_t maxContentSize);
+
+	/*! Returns the maximum size of a decompressed request body.
+	 *
+	 * @return Maximum decompressed size in bytes
+	 */
+	size_t getMaxContentSize() const;
+
+	/*! Sets the hash algorithm used to compute the digest of each
+	 * uploaded file while it is written. By default is
+	 * Digest::Algorithm::NONE (no digest).
+	 *
+	 * @param algorithm Hash algorithm
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& setUploadDigest(const Digest::Algorithm::Value algorithm);
+
+	/*! Returns the hash algorithm used for uploaded files.
+	 *
+	 * @return Hash algorithm
+	 */
+	Digest::Algorithm::Value getUploadDigest() const;
+
+	/*! Sets the maximum size of a multipart/form-data part without
+	 * filename to be stored as a field. Bigger parts are stored as
+	 * uploaded files. By default is 64 KB.
+	 *
+	 * @param maxFieldSize Maximum field size in bytes
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& setMaxFieldSize(const size_t maxFieldSize);
+
+	/*! Returns the maximum size of a multipart/form-data field.
+	 *
+	 * @return Maximum field size in bytes
+	 */
+	size_t getMaxFieldSize() const;
+
+	/*! Sets the maximum size of an uploaded file that is kept in
+	 * memory. Bigger files are written to disk while they are
+	 * received. Files in memory are only written to disk when the
+	 * application asks for their path. By default is 64 KB.
+	 *
+	 * @param memoryLimit Maximum size in bytes kept in memory
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& setUploadMemoryLimit(const size_t memoryLimit);
+
+	/*! Returns the maximum size of an uploaded file kept in memory.
+	 *
+	 * @return Maximum size in bytes kept in memory
+	 */
+	size_t getUploadMemoryLimit() const;
+
+	/*! Sets where uploaded files are written. By default the spool is
+	 * configured by environment variables or detected automatically.
+	 *
+	 * @param spool Spool configuration
+	 * @return Reference to the current object, allowing easy usability
+	 *
+	 * @see Spool
+	 */
+	Settings& setSpool(const Spool &spool);
+
+	/*! Returns where uploaded files are written.
+	 *
+	 * @return Spool configuration
+	 */
+	Spool const& getSpool() const;
+
+	/*! Sets when the uploaded files are removed. By default is
+	 * Cleanup::Policy::IMMEDIATE, when the Cgi object is destroyed.
+	 *
+	 * @param cleanup Check Cleanup::Policy for possible values
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& setUploadCleanup(const Cleanup::Policy::Value cleanup);
+
+	/*! Returns when the uploaded files are removed.
+	 *
+	 * @return Cleanup policy
+	 */
+	Cleanup::Policy::Value getUploadCleanup() const;
+
+	/*! Sets a content-addressed store for the uploaded files, so
+	 * repeated uploads are stored only once. When the upload digest is
+	 * NONE, SHA-256 is used. Files hashed with other algorithms are not
+	 * stored. By default there's no store.
+	 *
+	 * @param contentStore Store configuration
+	 * @return Reference to the current object, allowing easy usability
+	 *
+	 * @see ContentStore
+	 */
+	Settings& setContentStore(const ContentStore &contentStore);
+
+	/*! Returns the content-addressed store for the uploaded files.
+	 *
+	 * @return Store configuration
+	 */
+	ContentStore const& getContentStore() const;
+
+	/*! Sets the directory of resumable uploads. When defined, PATCH
+	 * and PUT requests with Content-Range and X-Upload-ID headers are
+	 * written in the upload instead of being parsed. By default is empty
+	 * (disabled).
+	 *
+	 * @param directory Directory of the partial files
+	 * @return Reference to the current object, allowing easy usability
+	 *
+	 * @see ResumableUpload
+	 */
+	Settings& setResumableDirectory(const string &directory);
+
+	/*! Returns the directory of resumable uploads.
+	 *
+	 * @return Directory of the partial files
+	 */
+	string getResumableDirectory() const;
+
+	/*! Register a processor that is executed in background for each
+	 * uploaded file, as soon as the file part is received (while the
+	 * rest of the body is still being parsed). The result is given by
+	 * UploadedFile::getResult with the processor name.
+	 *
+	 * @param name Processor name
+	 * @param processor Function executed for each file
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& addUploadProcessor(const string &name,
+	                             const UploadedFile::Processor &processor);
+
+	/*! Returns the registered upload processors.
+	 *
+	 * @return List of processor names and functions
+	 */
+	std::vector<std::pair<string, UploadedFile::Processor>> const&
+	getUploadProcessors() const;
+
+	/*! Sets the number of threads that execute the upload processors.
+	 * By default is the number of CPUs.
+	 *
+	 * @param workers Number of threads
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& setUploadWorkers(const unsigned int workers);
+
+	/*! Returns the number of threads that execute the upload
+	 * processors.
+	 *
+	 * @return Number of threads
+	 */
+	unsigned int getUploadWorkers() const;
+
+	/*! Sets the minimum body size that is read by a separate thread
+	 * while it is parsed, hiding the parse time behind the input time.
+	 * By default is 0 (disabled).
+	 *
+	 * @param threshold Minimum body size in bytes
+	 * @return Reference to the current object, allowing easy usability
+	 *
+	 * @see ReadPipeline
+	 */
+	Settings& setPipelineThreshold(const size_t threshold);
+
+	/*! Returns the minimum body size read by a separate thread.
+	 *
+	 * @return Minimum body size in bytes (0 when disabled)
+	 */
+	size_t getPipelineThreshold() const;
+
+	/*! Sets how requests are recorded for replay. By default the
+	 * capture is configured by environment variables (disabled when
+	 * they are not defined).
+	 *
+	 * @param capture Capture configuration
+	 * @return Reference to the current object, allowing easy usability
+	 *
+	 * @see Capture
+	 * @see Replay
+	 */
+	Settings& setCapture(const Capture &capture);
+
+	/*! Returns how requests are recorded for replay.
+	 *
+	 * @return Capture configuration
+	 */
+	Capture const& getCapture() const;
+
+	/*! Defines if the characters ' " < > are removed from the input
+	 * fields. By default they are removed. Turn it off when the page
+	 * escapes the values it writes (check Builder::setEscaping), so
+	 * the application receives the data as sent.
+	 *
+	 * @param inputStripping True to remove the characters
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Settings& setInputStripping(const bool inputStripping);
+
+	/*! Returns if the characters ' " < > are removed from the input
+	 * fields.
+	 *
+	 * @return True when the characters are removed
+	 */
+	bool getInputStripping() const;
+
+private:
+	size_t _maxContentSize;
+	size_t _maxFieldSize;
+	Digest::Algorithm::Value _uploadDigest;
+	size_t _uploadMemoryLimit;
+	Spool _spool;
+	Cleanup::Policy::Value _uploadCleanup;
+	ContentStore _contentStore;
+	string _resumableDirectory;
+	std::vector<std::pair<string, UploadedFile::Processor>> _uploadProcessors;
+	unsigned int _uploadWorkers;
+	size_t _pipelineThreshold;
+	Capture _capture;
+	bool _inputStripping;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_SETTINGS_HPP__
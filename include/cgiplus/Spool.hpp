@@ -0,0 +1,137 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_SPOOL_HPP__
+#define __CGIPLUS_SPOOL_HPP__
+
+#include <cstddef>
+#include <string>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Spool
+ *  \brief Location where uploaded files are written
+ *
+ * When no directory is defined, the spool is detected automatically,
+ * preferring memory file systems (tmpfs) with enough free space. To
+ * avoid contention on the same directory, each worker process or CPU
+ * can use its own subdirectory.
+ *
+ * The default values can be defined with the environment variables
+ * CGIPLUS_SPOOL_DIRECTORY, CGIPLUS_SPOOL_SHARDING ("none", "worker" or
+ * "cpu") and CGIPLUS_SPOOL_SHARDS.
+ */
+class Spool
+{
+public:
+	/*! \class Sharding
+	 *  \brief Represents how the spool directory is divided.
+	 */
+	class Sharding
+	{
+	public:
+		/*! List all ways to divide the spool directory.
+		 */
+		enum Value {
+			NONE,
+			WORKER,
+			CPU
+		};
+	};
+
+	/*! Initialize the spool with the values of the environment
+	 * variables. By default the directory is detected automatically and
+	 * it's divided by worker process in 16 subdirectories.
+	 */
+	Spool();
+
+	/*! Sets the spool directory. When empty the directory is detected
+	 * automatically (TMPDIR, /dev/shm or /tmp).
+	 *
+	 * @param directory Spool directory
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Spool& setDirectory(const string &directory);
+
+	/*! Returns the spool directory defined.
+	 *
+	 * @return Spool directory (empty when detected automatically)
+	 */
+	string getDirectory() const;
+
+	/*! Sets how the spool directory is divided in subdirectories.
+	 *
+	 * @param sharding Check Spool::Sharding for possible values
+	 * @param shards Number of subdirectories
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	Spool& setSharding(const Sharding::Value sharding, const unsigned int shards);
+
+	/*! Returns how the spool directory is divided.
+	 *
+	 * @return Sharding type
+	 */
+	Sharding::Value getSharding() const;
+
+	/*! Returns the number of subdirectories.
+	 *
+	 * @return Number of subdirectories
+	 */
+	unsigned int getShards() const;
+
+	/*! Find the directory where the files of the current request should
+	 * be written, checking if there's space for the expected size. The
+	 * subdirectory of the worker or CPU is created when necessary.
+	 *
+	 * @param expectedSize Number of bytes that are going to be written
+	 * @return Directory path or an empty string when there's no
+	 *         directory with enough space
+	 */
+	string resolve(const size_t expectedSize) const;
+
+	/*! Returns if the directory is in a memory file system (tmpfs).
+	 *
+	 * @param directory Directory path
+	 * @return True for tmpfs directories
+	 */
+	static bool isTmpfs(const string &directory);
+
+	/*! Returns the available space for unprivileged users in the file
+	 * system of the directory.
+	 *
+	 * @param directory Directory path
+	 * @return Available bytes or 0 when the directory doesn't exist
+	 */
+	static size_t getAvailableSpace(const string &directory);
+
+private:
+	string prepare(const string &directory) const;
+
+	string _directory;
+	Sharding::Value _sharding;
+	unsigned int _shards;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_SPOOL_HPP__
@@ -0,0 +1,312 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_TEMPLATE_HPP__
+#define __CGIPLUS_TEMPLATE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Cgiplus.hpp"
+#include "Deflater.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class Template
+ *  \brief Template compiled once into a small bytecode
+ *
+ * The content is compiled into a list of instructions: literal parts
+ * of the content, tags, conditionals, loops and includes. Tags with the
+ * same name share the same slot, so when rendering each field is
+ * looked up only once and the output is written directly into a buffer
+ * with the final size. The cost of rendering doesn't depend on the
+ * number of fields defined.
+ *
+ * Besides the tags, the template language has (using the default
+ * delimiter):
+ *
+ *   <!-- if name --> ... <!-- else --> ... <!-- end -->
+ *   <!-- if not name --> ... <!-- end -->
+ *   <!-- for row in rows --> ... <!-- row.column --> ... <!-- end -->
+ *   <!-- include path/to/file.html -->
+ *   <!-- cache name seconds field ... --> ... <!-- end -->
+ *
+ * A condition is true when the field (or the list) is not empty. Inside
+ * a loop, "row.column" is the column of the current row. Included
+ * files are compiled with the same delimiter, see only the fields and
+ * lists (not the loop rows), and their path is relative to the
+ * directory of the including file. Only templates read from files can
+ * include others, and absolute paths or paths with ".." are rejected
+ * (nothing is rendered), so the content can't read arbitrary files.
+ * When the conditionals and loops are not balanced, all
+ * tags are handled as simple tags. The result of a cache statement is
+ * kept in the FragmentCache for the values of the fields listed (inside
+ * a loop, "row.column" lists a column of the current row).
+ *
+ * Tags without a field are written as they are in the content.
+ *
+ * When rendering with escape, the values are escaped according to
+ * where they are in the page: text, attribute value or URL attribute
+ * value (href, src, ...). The context of each tag is found when the
+ * template is compiled.
+ *
+ * The content can be kept by another object (like a memory mapped
+ * file), so the literal parts are copied directly from it. Templates up
+ * to 4 GB are supported.
+ */
+class Template
+{
+public:
+	/*! Part of the rendered result (data and size)
+	 */
+	typedef std::pair<const char*, size_t> Part;
+
+	/*! Field values for each tag name
+	 */
+	typedef std::map<string, string> Fields;
+
+	/*! Row of a list, with a value for each column
+	 */
+	typedef std::map<string, string> Row;
+
+	/*! List of rows used in loops
+	 */
+	typedef std::vector<Row> List;
+
+	/*! Lists for each name used in loops
+	 */
+	typedef std::map<string, List> Lists;
+
+	/*! Included template and its file path
+	 */
+	typedef std::pair<string, std::shared_ptr<const Template>> Include;
+
+	/*! Cached fragments used by a render, for each fragment key
+	 * (check FragmentCache)
+	 */
+	typedef std::map<string, std::shared_ptr<const string>> Fragments;
+
+	/*! \class Deflated
+	 *  \brief Literal part of the content compressed ahead
+	 */
+	class Deflated
+	{
+	public:
+		size_t offset;
+		size_t size;
+		string data;
+		uint32_t crc;
+		uint32_t adler;
+	};
+
+	/*! Initialize an empty template.
+	 */
+	Template();
+
+	/*! Compile the content.
+	 *
+	 * @param content Template content
+	 * @param tags Beginning and end of the tag delimiter (both can't
+	 *             be empty)
+	 * @param file Path of the file with the content, empty when the
+	 *             content didn't come from a file (no includes)
+	 */
+	Template(const string &content, const std::pair<string, string> &tags,
+	         const string &file = "");
+
+	/*! Compile the content kept by another object, without copying it.
+	 *
+	 * @param data Template content
+	 * @param size Content size in bytes
+	 * @param owner Object that keeps the content while the template
+	 *              exists
+	 * @param tags Beginning and end of the tag delimiter (both can't
+	 *             be empty)
+	 * @param file Path of the file with the content, empty when the
+	 *             content didn't come from a file (no includes)
+	 */
+	Template(const char *data, const size_t size,
+	         const std::shared_ptr<const void> &owner,
+	         const std::pair<string, string> &tags,
+	         const string &file = "");
+
+	/*! Returns a copy of the template content.
+	 *
+	 * @return Template content (with tags)
+	 */
+	string getContent() const;
+
+	/*! Returns the template content size.
+	 *
+	 * @return Size in bytes
+	 */
+	size_t getSize() const;
+
+	/*! Returns the number of different tags in the template.
+	 *
+	 * @return Number of slots
+	 */
+	size_t getNumberOfSlots() const;
+
+	/*! Returns the templates included by this one. A template that
+	 * couldn't be read is an empty pointer.
+	 *
+	 * @return Included templates
+	 */
+	std::vector<Include> const& getIncludes() const;
+
+	/*! Execute the template, appending the result in the output.
+	 *
+	 * @param fields Field values for each tag name
+	 * @param lists Lists used in loops
+	 * @param output Buffer where the result is appended
+	 * @param escape Escape the values according to where they are
+	 *               written (check Escape)
+	 */
+	void render(const Fields &fields, const Lists &lists, string &output,
+	            const bool escape = false) const;
+
+	/*! Lists the parts of the rendered result, without copying them.
+	 * The parts point to the template content and to the field values,
+	 * so they are valid while both exist and are not changed.
+	 *
+	 * @param fields Field values for each tag name
+	 * @param lists Lists used in loops
+	 * @param parts List where the parts are appended
+	 * @param fragments Cached fragments that the parts point to, must
+	 *                  be kept with the parts
+	 * @param escape Escape the values according to where they are
+	 *               written (check Escape)
+	 * @return Size of the rendered result in bytes
+	 */
+	size_t render(const Fields &fields, const Lists &lists, std::vector<Part> &parts,
+	              Fragments &fragments, const bool escape = false) const;
+
+	/*! Compress the parts rendered by this template. The literal parts
+	 * of the content (and of the included templates) are compressed
+	 * only once, with the best compression, and joined to the stream;
+	 * only the other parts (field values) are compressed on each call.
+	 *
+	 * @param parts Parts rendered by this template
+	 * @param deflater Compression stream (finished by the caller)
+	 * @param output Where the compressed data is appended
+	 * @return True if the parts were compressed successfully
+	 */
+	bool deflate(const std::vector<Part> &parts, Deflater &deflater, string &output) const;
+
+private:
+	/*! \class Instruction
+	 *  \brief Operation code and its operands
+	 */
+	class Instruction
+	{
+	public:
+		/*! List all operations.
+		 */
+		enum Opcode {
+			LITERAL,            // Content at offset a with size b
+			FIELD,              // Field of slot a, or content at offset b
+			                    // with size c when it's not defined
+			COLUMN,             // Column b of the row of loop a
+			JUMP,               // Go to instruction c
+			JUMP_IF_EMPTY,      // Go to c when the slot (or column when
+			                    // a is a loop) b is empty
+			JUMP_IF_NOT_EMPTY,  // Go to c when it's not empty
+			LOOP,               // Start loop b over the list of slot a,
+			                    // going to c when it's empty
+			NEXT,               // Go to b while loop a has rows
+			INCLUDE,            // Execute the included template a
+			CACHE               // Write fragment a (rendered until c
+			                    // when it isn't cached) and go to c
+		};
+
+		Instruction(const Opcode opcode, const uint32_t a, const uint32_t b,
+		            const uint32_t c, const uint8_t context = 0);
+
+		uint8_t opcode;
+		uint8_t context;    // Escape::Context of FIELD and COLUMN
+		uint32_t a;
+		uint32_t b;
+		uint32_t c;
+	};
+
+	/*! \class Fragment
+	 *  \brief Cached part of the template and the fields it depends on
+	 */
+	class Fragment
+	{
+	public:
+		string name;
+		unsigned int ttl;
+
+		// Loop (NO_LOOP for fields) and slot or column of each value
+		// that the fragment depends on
+		std::vector<std::pair<uint32_t, uint32_t>> references;
+	};
+
+	class Frame;
+
+	static const uint32_t NO_LOOP;
+
+	template<class Emit>
+	void execute(const Fields &fields, const Lists &lists, const bool escape,
+	             Fragments &fragments, Emit &emit) const;
+
+	template<class Emit>
+	void run(Frame &frame, const size_t begin, const size_t end, Emit &emit) const;
+
+	const string& getFragment(Frame &frame, const size_t begin) const;
+
+	std::shared_ptr<const std::vector<Deflated>> getDeflated() const;
+	const Deflated* findDeflated(const Part &part) const;
+
+	void compile(const std::pair<string, string> &tags, const bool control);
+	void identify();
+
+	std::shared_ptr<const void> _owner;
+	const char *_data;
+	size_t _size;
+	string _file;
+
+	// Hash of the content and of the included templates, so fragments
+	// of different templates (or versions) don't share keys
+	string _identity;
+
+	std::vector<Instruction> _code;
+	std::vector<string> _slots;
+	std::vector<string> _columns;
+	std::vector<Include> _includes;
+	std::vector<Fragment> _fragments;
+	uint32_t _loops;
+
+	// Compressed literal parts, sorted by offset (created on the first
+	// compressed response)
+	mutable std::shared_ptr<const std::vector<Deflated>> _deflated;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_TEMPLATE_HPP__
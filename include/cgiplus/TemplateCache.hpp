@@ -0,0 +1,112 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_TEMPLATE_CACHE_HPP__
+#define __CGIPLUS_TEMPLATE_CACHE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "Cgiplus.hpp"
+#include "Template.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class TemplateCache
+ *  \brief Compiled template files shared by the whole process
+ *
+ * Template files are read and compiled only once per change. The
+ * cache is a map that is never modified: readers take the current map
+ * without waiting for writers, and writers copy it, add the new
+ * template and swap the maps (read-copy-update). The shared_ptr
+ * atomics used for that are not lock-free in libstdc++ (they take a
+ * short spinlock), but they never wait for a file to be read.
+ *
+ * Files are watched with inotify, so a changed file is read again
+ * after the next check. When inotify is not available, the status of
+ * the file is compared instead. The files are checked at most once per
+ * interval (1 second by default, or CGIPLUS_TEMPLATE_CHECK_INTERVAL in
+ * milliseconds), so most accesses don't need a system call.
+ *
+ * Big files are memory mapped, so replace them with rename(2) (write
+ * a new file and move it over the old one). A file truncated or
+ * rewritten in place changes the templates that are still rendered
+ * from it, and reading after its new end raises SIGBUS. When such a
+ * change is seen, the old mapping is replaced by zero pages and the
+ * generation changes, so Builder renders the page again from the new
+ * file. A render running before that can still crash.
+ */
+class TemplateCache
+{
+public:
+	/*! Returns the compiled template of the file, reading it when it's
+	 * not in the cache or it changed.
+	 *
+	 * @param file Template file path
+	 * @param tags Tag delimiter used to compile the template
+	 * @return Compiled template or an empty pointer when the file
+	 *         couldn't be read
+	 */
+	static std::shared_ptr<const Template> get(const string &file,
+	                                           const std::pair<string, string> &tags);
+
+	/*! Remove all templates from the cache.
+	 */
+	static void clear();
+
+	/*! Returns the number of templates in the cache.
+	 *
+	 * @return Number of templates (including the changed ones that were
+	 *         not read again yet)
+	 */
+	static size_t getSize();
+
+	/*! Sets the time between the checks of changed files. With 0 the
+	 * files are checked on every access.
+	 *
+	 * @param checkInterval Interval in milliseconds
+	 */
+	static void setCheckInterval(const unsigned int checkInterval);
+
+	/*! Returns the time between the checks of changed files.
+	 *
+	 * @return Interval in milliseconds
+	 */
+	static unsigned int getCheckInterval();
+
+	/*! Returns the number of mapped templates invalidated because
+	 * their files were rewritten in place. When it changes during a
+	 * render, the render may have read zeros and must be done again.
+	 *
+	 * @return Generation
+	 */
+	static uint64_t getGeneration();
+
+private:
+	TemplateCache();
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_TEMPLATE_CACHE_HPP__
@@ -20,9 +20,17 @@
 #ifndef __CGIPLUS_UPLOADED_FILE_H__
 #define __CGIPLUS_UPLOADED_FILE_H__
 
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 
 #include "Cgiplus.hpp"
+#include "Cleanup.hpp"
+#include "ContentStore.hpp"
+#include "Digest.hpp"
+#include "Spool.hpp"
 
 using std::string;
 
@@ -32,11 +40,19 @@ CGIPLUS_NS_BEGIN
  *  \brief Store uploaded data
  *
  * When sending multipart/form-data, this object is responsable for
- * storing the uploaded file.
+ * storing the uploaded file. Small files are kept in memory and are
+ * only written to disk when the application asks for the file path
+ * (getFilename). Copies of the object share the same storage.
  */
 class UploadedFile
 {
 public:
+	/*! Function executed in background for each uploaded file (like a
+	 * thumbnail generator or a virus scanner). Check
+	 * Settings::addUploadProcessor.
+	 */
+	typedef std::function<string(const UploadedFile &file)> Processor;
+
 	/*! Nothing special here, just initializing everything.
 	 */
 	UploadedFile();
@@ -44,16 +60,190 @@ public:
 	/*! Parse multipart according to [1] and fill all attributes.
 	 * [1] http://www.w3.org/TR/html401/interact/forms.html#h-17.13.4
 	 *
-	 * @param multipart Raw http sent data
+	 * The payload is stored byte by byte, so binary files are kept
+	 * intact.
+	 *
+	 * @param multipart One body part (headers and payload) without the
+	 *                  boundary delimiters and the line break that
+	 *                  precedes the next delimiter
 	 */
 	void setMultipart(const string &multipart);
 
-	/*! Returns desired filename.
+	/*! Parse a header line of the body part (Content-Disposition).
+	 *
+	 * @param contentHeader Header line
+	 */
+	void parseContentHeader(const string &contentHeader);
+
+	/*! Prepare a new storage for the payload. Use write to store the
+	 * payload chunk by chunk and close when finished.
+	 *
+	 * @return True if the storage was created
+	 */
+	bool open();
+
+	/*! Append data to the storage, updating the digest at the same
+	 * time. When the payload grows beyond the memory limit it is moved
+	 * to a file.
+	 *
+	 * @param data Payload chunk
+	 * @param size Number of bytes in the chunk
+	 * @return True if all the data was written
+	 */
+	bool write(const char *data, const size_t size);
+
+	/*! Finish the file and the digest.
+	 */
+	void close();
+
+	/*! Remove the file from disk, if it was created, according to the
+	 * cleanup policy. Data kept in memory is released. Waits for the
+	 * processors of the file, so it must not be called by them. After
+	 * this call all copies of the object have no content and no file.
+	 */
+	void remove();
+
+	/*! Define the maximum payload size that is kept in memory. Bigger
+	 * payloads are written to disk while they are received. By default
+	 * is 64 KB.
+	 *
+	 * @param memoryLimit Maximum size in bytes kept in memory
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	UploadedFile& setMemoryLimit(const size_t memoryLimit);
+
+	/*! Define the directory where the file is created. By default is
+	 * empty, meaning the current directory.
+	 *
+	 * @param directory Directory path
+	 * @return Reference to the current object, allowing easy usability
+	 *
+	 * @see Spool
+	 */
+	UploadedFile& setDirectory(const string &directory);
+
+	/*! Define the spool where the file is created, instead of a fixed
+	 * directory. The spool directory is resolved only when the payload
+	 * is written to disk, so files kept in memory don't check the file
+	 * systems.
+	 *
+	 * @param spool Spool configuration, shared by the files of a request
+	 * @param expectedSize Number of bytes expected in the request
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	UploadedFile& setSpool(const std::shared_ptr<const Spool> &spool,
+	                       const size_t expectedSize);
+
+	/*! Define when the file is removed. With Cleanup::Policy::ANONYMOUS
+	 * the file is created without name (O_TMPFILE) and the path is only
+	 * valid while some copy of this object exists.
+	 *
+	 * @param cleanup Check Cleanup::Policy for possible values
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	UploadedFile& setCleanup(const Cleanup::Policy::Value cleanup);
+
+	/*! Returns when the file is removed.
+	 *
+	 * @return Cleanup policy
+	 */
+	Cleanup::Policy::Value getCleanup() const;
+
+	/*! Define a content-addressed store. When the file is closed with
+	 * a SHA-256 digest, it's added to the store (duplicates share the
+	 * same blob).
+	 *
+	 * @param contentStore Store configuration
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	UploadedFile& setContentStore(const ContentStore &contentStore);
+
+	/*! Returns the path of the file in the content-addressed store.
+	 * This path is never removed by the library, so the application can
+	 * keep it instead of copying the uploaded file.
+	 *
+	 * @return Blob path or an empty string when the file isn't stored
+	 */
+	string getCanonicalPath() const;
+
+	/*! Returns if the payload is only stored in memory (no file was
+	 * created).
+	 *
+	 * @return True if the payload is only in memory
+	 */
+	bool isInMemory() const;
+
+	/*! Returns the payload. For files stored on disk the file is read.
+	 *
+	 * @return Payload
+	 */
+	string getContent() const;
+
+	/*! Define the hash algorithm used to compute the digest of the
+	 * payload while it is written. By default is Digest::Algorithm::NONE
+	 * (no digest).
+	 *
+	 * @param algorithm Hash algorithm
+	 * @return Reference to the current object, allowing easy usability
+	 */
+	UploadedFile& setDigestAlgorithm(const Digest::Algorithm::Value algorithm);
+
+	/*! Returns the hash algorithm used in the digest.
+	 *
+	 * @return Hash algorithm
+	 */
+	Digest::Algorithm::Value getDigestAlgorithm() const;
+
+	/*! Returns the digest of the payload in hexadecimal format, or an
+	 * empty string when no hash algorithm was defined.
+	 *
+	 * @return Payload digest
+	 */
+	string getDigest() const;
+
+	/*! Returns the number of bytes of the payload.
+	 *
+	 * @return Payload size
+	 */
+	size_t getSize() const;
+
+	/*! Returns the path of the file where the payload is stored. If
+	 * the payload is still in memory, the file is created now (but not
+	 * after remove, when the path is empty). Files
+	 * added to the content store are links to a read-only blob (check
+	 * ContentStore), copy them before changing the content.
 	 *
 	 * @return Filename
 	 */
 	string getFilename() const;
 
+	/*! Store the future result of a processor for this file.
+	 *
+	 * @param processor Processor name
+	 * @param result Future result
+	 */
+	void setResult(const string &processor, const std::shared_future<string> &result);
+
+	/*! Returns the future result of a processor. Call get() on it to
+	 * wait for the processor.
+	 *
+	 * @param processor Processor name
+	 * @return Future result (not valid when the processor wasn't
+	 *         executed for this file)
+	 */
+	std::shared_future<string> getResult(const string &processor) const;
+
+	/*! Wait until all processors of this file finish.
+	 */
+	void waitResults() const;
+
+	/*! Returns the filename informed by the client in the
+	 * Content-Disposition header. It can be empty.
+	 *
+	 * @return Client filename
+	 */
+	string getClientFilename() const;
+
 	/*! Returns the name of the field in the HTML form
 	 *
 	 * @return HTML field name
@@ -61,11 +251,22 @@ public:
 	string getControlName() const;
 
 private:
-	void parseContentHeader(const string &contentHeader);
-	void generateRandomFilename();
+	class Storage;
+
+	string getDirectory() const;
 
-	string _filename;
+	string _clientFilename;
 	string _controlName;
+	std::shared_ptr<Storage> _storage;
+	string _directory;
+	std::shared_ptr<const Spool> _spool;
+	size_t _expectedSize;
+	Cleanup::Policy::Value _cleanup;
+	ContentStore _contentStore;
+	size_t _memoryLimit;
+	size_t _size;
+	Digest _digest;
+	string _digestValue;
 };
 
 CGIPLUS_NS_END
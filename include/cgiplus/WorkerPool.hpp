@@ -0,0 +1,94 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CGIPLUS_WORKER_POOL_HPP__
+#define __CGIPLUS_WORKER_POOL_HPP__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cgiplus.hpp"
+
+using std::string;
+
+CGIPLUS_NS_BEGIN
+
+/*! \class WorkerPool
+ *  \brief Bounded pool of threads that run tasks in background
+ *
+ * The queue has a maximum size, so when the workers can't keep up the
+ * submit call waits (back-pressure) instead of growing the memory
+ * usage. The result of each task is returned as a future. When the
+ * pool is destroyed, all tasks in the queue are executed before the
+ * threads finish.
+ */
+class WorkerPool
+{
+public:
+	/*! Start the worker threads.
+	 *
+	 * @param workers Number of threads (at least one)
+	 * @param queueSize Maximum number of tasks waiting for a thread
+	 */
+	WorkerPool(const unsigned int workers, const size_t queueSize);
+
+	/*! Execute the remaining tasks and stop the threads.
+	 */
+	~WorkerPool();
+
+	/*! Add a task to the queue. Waits while the queue is full.
+	 *
+	 * @param task Task that returns a text result
+	 * @return Future of the task result (exceptions thrown by the task
+	 *         are given back by the future)
+	 */
+	std::shared_future<string> submit(const std::function<string()> &task);
+
+	/*! Returns the number of worker threads.
+	 *
+	 * @return Number of threads
+	 */
+	unsigned int getWorkers() const;
+
+private:
+	WorkerPool(const WorkerPool &);
+	WorkerPool& operator=(const WorkerPool &);
+
+	void run();
+
+	size_t _queueSize;
+	bool _stopping;
+
+	std::deque<std::function<void()>> _queue;
+	std::mutex _mutex;
+	std::condition_variable _notEmpty;
+	std::condition_variable _notFull;
+	std::vector<std::thread> _threads;
+};
+
+CGIPLUS_NS_END
+
+#endif // __CGIPLUS_WORKER_POOL_HPP__
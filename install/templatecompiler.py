@@ -0,0 +1,512 @@
+# CGIplus Copyright (C) 2012 Rafael Dantas Justo
+#
+# This file is part of CGIplus.
+#
+# CGIplus is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# CGIplus is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+
+""" templatecompiler
+
+Compiles CGIplus templates into C++ headers ahead of time. Each
+template becomes a class with a member for each field (std::string) and
+list (cgiplus::Template::List), and render methods that write the page
+without parsing anything at runtime. The template language is the same
+of cgiplus::Template (tags, if/else/end, for/end, cache/end and
+include), but cache statements don't cache anything.
+
+In SCons:
+
+    import templatecompiler
+    templatecompiler.AddBuilder(env)
+    env.CompiledTemplate("Page.hpp", "page.html")
+
+Or from the command line:
+
+    python templatecompiler.py page.html Page.hpp
+"""
+
+import os
+import re
+import sys
+
+DEFAULT_TAGS = ("<!-- ", " -->")
+DEFAULT_NAMESPACE = "templates"
+MAX_INCLUDE_DEPTH = 16
+
+
+class Node:
+    """ Part of the parsed template. """
+    def __init__(self, kind, **values):
+        self.kind = kind
+        self.__dict__.update(values)
+
+
+def tokenize(content, tags):
+    """ Divides the content in literals and tags, with the same rules of
+    cgiplus::Template. Returns a list of ("text", data) and
+    ("tag", name, raw) items. """
+    first, second = tags
+    tokens = []
+    literal = 0
+    position = 0
+
+    while True:
+        begin = content.find(first, position)
+        if begin == -1:
+            break
+
+        nameBegin = begin + len(first)
+        end = content.find(second, nameBegin)
+        if end == -1:
+            break
+
+        # For "<!-- <!-- name -->" only the last beginning is part of
+        # the tag
+        lastBegin = content.rfind(first, nameBegin, end)
+        if lastBegin != -1:
+            begin = lastBegin
+            nameBegin = begin + len(first)
+
+        tagEnd = end + len(second)
+        if begin > literal:
+            tokens.append(("text", content[literal:begin]))
+
+        tokens.append(("tag", content[nameBegin:end], content[begin:tagEnd]))
+        literal = tagEnd
+        position = tagEnd
+
+    if literal < len(content):
+        tokens.append(("text", content[literal:]))
+
+    return tokens
+
+
+def reference(name, variables):
+    """ "row.column" is a column when "row" is an open loop variable,
+    otherwise it's a field. """
+    if "." in name:
+        variable, column = name.split(".", 1)
+        if variable in variables:
+            return Node("column", variable=variable, column=column)
+
+    return Node("field", name=name)
+
+
+def parse(filename, tags, stack=()):
+    """ Parses the template file into a tree of nodes. Included files are
+    parsed into the tree, relative to the directory of the file (or to
+    the working directory). """
+    content = readFile(filename)
+    tokens = tokenize(content, tags)
+
+    nodes = parseTokens(filename, tokens, tags, stack, True)
+    if nodes is None:
+        # Statements not balanced, probably comments
+        nodes = parseTokens(filename, tokens, tags, stack, False)
+
+    return nodes
+
+
+def parseTokens(filename, tokens, tags, stack, control):
+    root = []
+    # Open blocks: (node, list where the next nodes are added)
+    blocks = []
+    current = root
+    variables = []
+
+    for token in tokens:
+        if token[0] == "text":
+            current.append(Node("text", data=token[1]))
+            continue
+
+        name, raw = token[1], token[2]
+        words = name.split() if control else []
+
+        if words == ["end"]:
+            if not blocks:
+                return None
+
+            node = blocks.pop()[0]
+            if node.kind == "for":
+                variables.pop()
+
+            current = blocks[-1][1] if blocks else root
+
+        elif words == ["else"]:
+            if not blocks or blocks[-1][0].kind != "if" or blocks[-1][1] is blocks[-1][0].otherwise:
+                return None
+
+            node = blocks[-1][0]
+            blocks[-1] = (node, node.otherwise)
+            current = node.otherwise
+
+        elif (len(words) == 2 and words[0] == "if") or \
+                (len(words) == 3 and words[0] == "if" and words[1] == "not"):
+            node = Node("if", condition=reference(words[-1], variables),
+                        negate=(len(words) == 3), then=[], otherwise=[])
+            current.append(node)
+            blocks.append((node, node.then))
+            current = node.then
+
+        elif len(words) == 4 and words[0] == "for" and words[2] == "in":
+            node = Node("for", variable=words[1], list=words[3], body=[])
+            current.append(node)
+            blocks.append((node, node.body))
+            variables.append(words[1])
+            current = node.body
+
+        elif len(words) >= 3 and words[0] == "cache" and words[2].isdigit():
+            # Compiled templates are fast enough, the body is always
+            # rendered
+            node = Node("cache", body=[])
+            current.append(node)
+            blocks.append((node, node.body))
+            current = node.body
+
+        elif len(words) == 2 and words[0] == "include":
+            path = resolveInclude(filename, words[1])
+            if path is not None and path not in stack and len(stack) < MAX_INCLUDE_DEPTH:
+                current.append(Node("include", nodes=parse(path, tags, stack + (filename,))))
+
+        else:
+            node = reference(name, variables)
+            node.raw = raw
+            current.append(node)
+
+    if blocks:
+        return None
+
+    return root
+
+
+def resolveInclude(filename, path):
+    # Same rules of the library: relative to the including file, without
+    # absolute paths or ".."
+    if path.startswith("/") or ".." in path.split("/"):
+        return None
+
+    candidate = os.path.join(os.path.dirname(filename), path)
+    if os.path.isfile(candidate):
+        return os.path.normpath(candidate)
+
+    return None
+
+
+def includes(filename, tags=DEFAULT_TAGS, stack=()):
+    """ Lists the files included by the template (for the SCons scanner). """
+    found = []
+    for token in tokenize(readFile(filename), tags):
+        if token[0] != "tag":
+            continue
+
+        words = token[1].split()
+        if len(words) == 2 and words[0] == "include":
+            path = resolveInclude(filename, words[1])
+            if path is not None and path not in stack and path not in found:
+                found.append(path)
+                if len(stack) < MAX_INCLUDE_DEPTH:
+                    for child in includes(path, tags, stack + (filename,)):
+                        if child not in found:
+                            found.append(child)
+
+    return found
+
+
+def readFile(filename):
+    stream = open(filename, "rb")
+    try:
+        data = stream.read()
+    finally:
+        stream.close()
+
+    if not isinstance(data, str):
+        data = data.decode("latin-1")
+
+    return data
+
+
+def quote(data):
+    """ Returns the C++ string literal of the data. Bytes are kept as
+    they are (octal escapes), so any encoding works. Literals with many
+    lines are divided like the template. """
+    pieces = [[]]
+    for character in data:
+        code = ord(character)
+        if character == "\\":
+            pieces[-1].append("\\\\")
+        elif character == "\"":
+            pieces[-1].append("\\\"")
+        elif character == "\n":
+            pieces[-1].append("\\n")
+            pieces.append([])
+        elif character == "\t":
+            pieces[-1].append("\\t")
+        elif code < 32 or code >= 127 or character == "?":
+            # "?" avoids trigraphs
+            pieces[-1].append("\\%03o" % code)
+        else:
+            pieces[-1].append(character)
+
+    if len(pieces) > 1 and not pieces[-1]:
+        pieces.pop()
+
+    return "\n\t\t\t".join("\"" + "".join(piece) + "\"" for piece in pieces)
+
+
+def identifier(name):
+    """ Converts a tag name into a C++ identifier. """
+    result = re.sub(r"[^A-Za-z0-9_]", "_", name)
+    if not result or result[0].isdigit():
+        result = "_" + result
+    return result
+
+
+def className(filename):
+    base = os.path.basename(filename).split(".")[0]
+    words = re.split(r"[^A-Za-z0-9]+", base)
+    result = "".join(word[:1].upper() + word[1:] for word in words if word)
+    if not result or result[0].isdigit():
+        result = "Template" + result
+    return result
+
+
+class Generator:
+    """ Writes the C++ code of the parsed template. """
+
+    def __init__(self, nodes):
+        self.nodes = nodes
+        self.fields = []
+        self.lists = []
+        self.literalSize = 0
+        self.collect(nodes, [])
+
+        members = {}
+        for name in self.fields + self.lists:
+            member = identifier(name)
+            if member in members and members[member] != name:
+                raise ValueError("Tags \"%s\" and \"%s\" have the same C++ name" %
+                                 (members[member], name))
+            members[member] = name
+
+    def collect(self, nodes, variables):
+        for node in nodes:
+            if node.kind == "text":
+                self.literalSize += len(node.data)
+            elif node.kind == "field":
+                self.addField(node.name)
+            elif node.kind == "if":
+                if node.condition.kind == "field" and node.condition.name not in self.lists:
+                    self.addField(node.condition.name)
+                self.collect(node.then, variables)
+                self.collect(node.otherwise, variables)
+            elif node.kind == "for":
+                if node.list in self.fields:
+                    self.fields.remove(node.list)
+                if node.list not in self.lists:
+                    self.lists.append(node.list)
+                self.collect(node.body, variables + [node.variable])
+            elif node.kind == "cache":
+                self.collect(node.body, variables)
+            elif node.kind == "include":
+                self.collect(node.nodes, [])
+
+    def addField(self, name):
+        if name not in self.fields and name not in self.lists:
+            self.fields.append(name)
+
+    def generate(self, name, namespace, source):
+        guard = "__CGIPLUS_TEMPLATE_%s_HPP__" % identifier(name).upper()
+
+        lines = []
+        lines.append("// Generated from %s by CGIplus, do not edit" % os.path.basename(source))
+        lines.append("")
+        lines.append("#ifndef %s" % guard)
+        lines.append("#define %s" % guard)
+        lines.append("")
+        lines.append("#include <string>")
+        lines.append("")
+        lines.append("#include <cgiplus/CompiledTemplate.hpp>")
+        lines.append("#include <cgiplus/Template.hpp>")
+        lines.append("")
+        lines.append("namespace %s {" % namespace)
+        lines.append("")
+        lines.append("class %s" % name)
+        lines.append("{")
+        lines.append("public:")
+
+        for field in self.fields:
+            lines.append("\tstd::string %s;" % identifier(field))
+        for lst in self.lists:
+            lines.append("\tcgiplus::Template::List %s;" % identifier(lst))
+        if self.fields or self.lists:
+            lines.append("")
+
+        # Typed render, with the members
+        lines.append("\tvoid render(std::string &output) const")
+        lines.append("\t{")
+        lines.append("\t\toutput.reserve(output.size() + %d);" % self.literalSize)
+        self.emit(lines, self.nodes, 2, True, {})
+        lines.append("\t}")
+        lines.append("")
+
+        # Builder renderer, with the fields and lists of the Builder
+        lines.append("\tstatic void renderFields(const cgiplus::Template::Fields &fields,")
+        lines.append("\t                         const cgiplus::Template::Lists &lists,")
+        lines.append("\t                         std::string &output)")
+        lines.append("\t{")
+        for field in self.fields:
+            lines.append("\t\tconst std::string *%s = cgiplus::CompiledTemplate::find(fields, %s);" %
+                         (identifier(field), quote(field)))
+        for lst in self.lists:
+            lines.append("\t\tconst cgiplus::Template::List *%s = cgiplus::CompiledTemplate::find(lists, %s);" %
+                         (identifier(lst), quote(lst)))
+        if not self.fields and not self.lists:
+            lines.append("\t\t(void) fields;")
+            lines.append("\t\t(void) lists;")
+        lines.append("")
+        lines.append("\t\toutput.reserve(output.size() + %d);" % self.literalSize)
+        self.emit(lines, self.nodes, 2, False, {})
+        lines.append("\t}")
+        lines.append("};")
+        lines.append("")
+        lines.append("}")
+        lines.append("")
+        lines.append("#endif // %s" % guard)
+        lines.append("")
+        return "\n".join(lines)
+
+    def emit(self, lines, nodes, depth, typed, variables):
+        indent = "\t" * depth
+        for node in nodes:
+            if node.kind == "text":
+                lines.append("%soutput.append(%s, %d);" % (indent, quote(node.data), len(node.data)))
+
+            elif node.kind == "field":
+                member = identifier(node.name)
+                if node.name in self.lists:
+                    # Name of a list, the field can only come from the Builder
+                    if not typed:
+                        lines.append("%sif (const std::string *value = cgiplus::CompiledTemplate::find(fields, %s)) {" %
+                                     (indent, quote(node.name)))
+                        lines.append("%s\toutput.append(*value);" % indent)
+                        lines.append("%s} else {" % indent)
+                        lines.append("%s\toutput.append(%s, %d);" % (indent, quote(node.raw), len(node.raw)))
+                        lines.append("%s}" % indent)
+                elif typed:
+                    lines.append("%soutput.append(%s);" % (indent, member))
+                else:
+                    # Tags without a field are written as they are
+                    lines.append("%sif (%s != NULL) {" % (indent, member))
+                    lines.append("%s\toutput.append(*%s);" % (indent, member))
+                    lines.append("%s} else {" % indent)
+                    lines.append("%s\toutput.append(%s, %d);" % (indent, quote(node.raw), len(node.raw)))
+                    lines.append("%s}" % indent)
+
+            elif node.kind == "column":
+                lines.append("%scgiplus::CompiledTemplate::append(%s, %s, output);" %
+                             (indent, variables[node.variable], quote(node.column)))
+
+            elif node.kind == "if":
+                empty = self.isEmpty(node.condition, typed, variables)
+                condition = empty if node.negate else "%s == false" % empty
+                lines.append("%sif (%s) {" % (indent, condition))
+                self.emit(lines, node.then, depth + 1, typed, variables)
+                if node.otherwise:
+                    lines.append("%s} else {" % indent)
+                    self.emit(lines, node.otherwise, depth + 1, typed, variables)
+                lines.append("%s}" % indent)
+
+            elif node.kind == "for":
+                member = identifier(node.list)
+                variable = "row%d_%s" % (len(variables), identifier(node.variable))
+                inner = dict(variables)
+                inner[node.variable] = variable
+
+                if typed:
+                    lines.append("%sfor (auto &%s: %s) {" % (indent, variable, member))
+                    self.emit(lines, node.body, depth + 1, typed, inner)
+                    lines.append("%s}" % indent)
+                else:
+                    lines.append("%sif (%s != NULL) {" % (indent, member))
+                    lines.append("%s\tfor (auto &%s: *%s) {" % (indent, variable, member))
+                    self.emit(lines, node.body, depth + 2, typed, inner)
+                    lines.append("%s\t}" % indent)
+                    lines.append("%s}" % indent)
+
+            elif node.kind == "cache":
+                self.emit(lines, node.body, depth, typed, variables)
+
+            elif node.kind == "include":
+                self.emit(lines, node.nodes, depth, typed, {})
+
+    def isEmpty(self, condition, typed, variables):
+        if condition.kind == "column":
+            return "cgiplus::CompiledTemplate::isEmpty(%s, %s)" % \
+                (variables[condition.variable], quote(condition.column))
+
+        member = identifier(condition.name)
+        if typed:
+            return "%s.empty()" % member
+
+        return "(%s == NULL || %s->empty())" % (member, member)
+
+
+def compile(source, target, tags=DEFAULT_TAGS, namespace=DEFAULT_NAMESPACE, name=None):
+    """ Compiles the template file into a C++ header. """
+    nodes = parse(source, tags)
+    code = Generator(nodes).generate(name or className(target), namespace, source)
+
+    stream = open(target, "w")
+    try:
+        stream.write(code)
+    finally:
+        stream.close()
+
+
+def AddBuilder(env):
+    """ Adds the CompiledTemplate builder to the SCons environment. The
+    tags and the namespace can be changed with the TEMPLATE_TAGS and
+    TEMPLATE_NAMESPACE variables. """
+    import SCons.Action
+    import SCons.Builder
+    import SCons.Scanner
+
+    if "CompiledTemplate" in env["BUILDERS"]:
+        return
+
+    def action(target, source, env):
+        tags = tuple(env.get("TEMPLATE_TAGS", DEFAULT_TAGS))
+        namespace = env.get("TEMPLATE_NAMESPACE", DEFAULT_NAMESPACE)
+        for t, s in zip(target, source):
+            compile(str(s), str(t), tags, namespace)
+        return 0
+
+    def scan(node, env, path):
+        tags = tuple(env.get("TEMPLATE_TAGS", DEFAULT_TAGS))
+        return [env.File(f) for f in includes(str(node), tags)]
+
+    builder = SCons.Builder.Builder(
+        action=SCons.Action.Action(action, "Compiling template $SOURCE"),
+        suffix=".hpp",
+        src_suffix=".html",
+        source_scanner=SCons.Scanner.Base(scan, "TemplateScanner"))
+
+    env.Append(BUILDERS={"CompiledTemplate": builder})
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.stderr.write("Usage: %s template.html Template.hpp\n" % sys.argv[0])
+        sys.exit(1)
+
+    compile(sys.argv[1], sys.argv[2])
@@ -17,21 +17,130 @@
   along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+extern "C" {
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
-#include <fstream>
-#include <sstream>
+#include <vector>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/replace.hpp>
 
 #include <cgiplus/Builder.hpp>
+#include <cgiplus/Cleanup.hpp>
 #include <cgiplus/Cookie.hpp>
+#include <cgiplus/Deflater.hpp>
+#include <cgiplus/Digest.hpp>
+#include <cgiplus/EntityTag.hpp>
+#include <cgiplus/Template.hpp>
+#include <cgiplus/TemplateCache.hpp>
 
 CGIPLUS_NS_BEGIN
 
+// Small responses fit in a single packet anyway
+static const size_t DEFAULT_COMPRESSION_THRESHOLD = 1024;
+
+// Renders done again when a mapped template changes in the middle
+static const unsigned int MAX_RENDER_ATTEMPTS = 3;
+
+#ifdef IOV_MAX
+static const size_t MAX_WRITE_VECTORS = IOV_MAX;
+#else
+static const size_t MAX_WRITE_VECTORS = 1024;
+#endif
+
+/*! \class Response
+ *  \brief Header and parts of the content, with everything that the
+ *         parts point to
+ */
+class Builder::Response
+{
+public:
+	explicit Response(const HttpHeader &header) :
+		header(header),
+		compiled(),
+		fragments(),
+		content(""),
+		parts(),
+		size(0)
+	{
+	}
+
+	HttpHeader header;
+	std::shared_ptr<const Template> compiled;
+	Template::Fragments fragments;
+
+	// Content that is not in the template (rendered or compressed)
+	string content;
+
+	std::vector<Template::Part> parts;
+	size_t size;
+};
+
+namespace {
+
+struct iovec toVector(const char *data, const size_t size)
+{
+	struct iovec vector;
+	vector.iov_base = const_cast<char*>(data);
+	vector.iov_len = size;
+	return vector;
+}
+
+/*! Write all vectors, with as few system calls as possible
+ */
+bool writeVectors(const int fd, std::vector<struct iovec> &vectors)
+{
+	size_t first = 0;
+
+	while (first < vectors.size()) {
+		size_t count = std::min(vectors.size() - first, MAX_WRITE_VECTORS);
+
+		ssize_t written = writev(fd, &vectors[first], count);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		// Skip what was written, a vector can be written partially
+		size_t remaining = written;
+		while (first < vectors.size() && remaining >= vectors[first].iov_len) {
+			remaining -= vectors[first].iov_len;
+			first++;
+		}
+
+		if (remaining > 0) {
+			vectors[first].iov_base = static_cast<char*>(vectors[first].iov_base) + remaining;
+			vectors[first].iov_len -= remaining;
+		}
+	}
+
+	return true;
+}
+
+}
+
 Builder::Builder() :
 	_content(""),
-	_tags("<!-- ", " -->")
+	_template(),
+	_templateFile(""),
+	_renderer(),
+	_tags("<!-- ", " -->"),
+	_escaping(false),
+	_compressionLevel(0),
+	_compressionThreshold(DEFAULT_COMPRESSION_THRESHOLD),
+	_entityTagging(false),
+	_precondition(HttpHeader::Status::UNDEFINED)
 {
 }
 
@@ -40,6 +149,13 @@ string& Builder::operator[](const string &key)
 	return _fields[key];
 }
 
+Template::Row& Builder::addRow(const string &key)
+{
+	Template::List &list = _lists[key];
+	list.push_back(Template::Row());
+	return list.back();
+}
+
 Cookie& Builder::operator()(const string &key)
 {
 	return _httpHeader.getCookie(key);
@@ -47,6 +163,16 @@ Cookie& Builder::operator()(const string &key)
 
 Builder& Builder::operator<<(const string &content)
 {
+	// Parsing on every append would be quadratic, so the content is
+	// parsed again only when it's built
+	if (_template) {
+		_content = _template->getContent();
+		_template.reset();
+	}
+
+	resetPrecondition();
+	_renderer = nullptr;
+	_templateFile.clear();
 	_content += content;
 	return *this;
 }
@@ -58,48 +184,124 @@ HttpHeader* Builder::operator->()
 
 string Builder::build() const
 {
-	string content = _content;
-	for (auto field: _fields) {
-		string key  = _tags.first + field.first + _tags.second;
-		boost::replace_all(content, key, field.second);
+	std::unique_ptr<Response> response = respond();
+
+	string result = response->header.toString(response->size);
+	result.reserve(result.size() + response->size);
+	for (auto part: response->parts) {
+		result.append(part.first, part.second);
 	}
 
-	return _httpHeader.toString(content.size()) + content;
+	return result;
 }
 
 void Builder::show() const
 {
-	std::cout << build() << std::endl;
+	// Anything written before with std::cout must go first
+	std::cout.flush();
+
+	std::unique_ptr<Response> response = respond();
+
+	string header = response->header.toString(response->size);
+
+	std::vector<struct iovec> vectors;
+	vectors.reserve(response->parts.size() + 1);
+	vectors.push_back(toVector(header.data(), header.size()));
+	for (auto part: response->parts) {
+		vectors.push_back(toVector(part.first, part.second));
+	}
+
+	if (writeVectors(STDOUT_FILENO, vectors) == false) {
+		// Client is gone, nothing to do
+	}
+
+	// The response is out, the uploaded files waiting for it can go
+	Cleanup::flush();
 }
 
 Builder& Builder::setContent(const string &content)
 {
-	_content = content;
+	resetPrecondition();
+	_renderer = nullptr;
+	_content.clear();
+	_templateFile.clear();
+	_template = std::make_shared<Template>(content, _tags);
 	return *this;
 }
 
 Builder& Builder::setTemplateFile(const string &templateFile)
 {
-	_content.clear();
-
-	std::ifstream fileStream(templateFile.c_str());
-	if (fileStream.good()) {
-		std::stringstream contentStream;
-		contentStream << fileStream.rdbuf();
-		_content = contentStream.str();
+	// The file is read and compiled only when it changes
+	std::shared_ptr<const Template> compiled = TemplateCache::get(templateFile, _tags);
+	if (!compiled) {
+		return setContent("");
 	}
 
+	resetPrecondition();
+	_renderer = nullptr;
+	_content.clear();
+	_templateFile = templateFile;
+	_template = compiled;
+	return *this;
+}
+
+Builder& Builder::setRenderer(const Renderer &renderer)
+{
+	resetPrecondition();
+	_content.clear();
+	_templateFile.clear();
+	_template.reset();
+	_renderer = renderer;
 	return *this;
 }
 
 Builder& Builder::setTags(const std::pair<string, string> &tags)
 {
 	_tags = tags;
+
+	// Templates from files are compiled again by the cache, so they keep
+	// their includes
+	if (_templateFile.empty() == false) {
+		setTemplateFile(_templateFile);
+	} else if (_template) {
+		setContent(_template->getContent());
+	}
+
+	return *this;
+}
+
+Builder& Builder::setEscaping(const bool escaping)
+{
+	_escaping = escaping;
+	return *this;
+}
+
+Builder& Builder::setCompression(const int level, const size_t threshold)
+{
+	_compressionLevel = std::max(0, std::min(level, 9));
+	_compressionThreshold = threshold;
 	return *this;
 }
 
+Builder& Builder::setEntityTagging(const bool entityTagging)
+{
+	_entityTagging = entityTagging;
+	return *this;
+}
+
+bool Builder::checkPreconditions(const Precondition &precondition, const string &entityTag,
+                                 const boost::posix_time::ptime &lastModified)
+{
+	_httpHeader.setEntityTag(entityTag);
+	_httpHeader.setLastModified(lastModified);
+
+	_precondition = precondition.evaluate(entityTag, lastModified);
+	return _precondition == HttpHeader::Status::UNDEFINED;
+}
+
 Builder& Builder::clear()
 {
+	resetPrecondition();
 	clearFields();
 	clearCookies();
 	return *this;
@@ -108,6 +310,7 @@ Builder& Builder::clear()
 Builder& Builder::clearFields()
 {
 	_fields.clear();
+	_lists.clear();
 	return *this;
 }
 
@@ -117,4 +320,202 @@ Builder& Builder::clearCookies()
 	return *this;
 }
 
+void Builder::resetPrecondition()
+{
+	// The result belongs to the content it was checked for
+	_precondition = HttpHeader::Status::UNDEFINED;
+}
+
+string Builder::replaceFields(const string &content) const
+{
+	string result = content;
+	for (auto field: _fields) {
+		string key  = _tags.first + field.first + _tags.second;
+		boost::replace_all(result, key, field.second);
+	}
+
+	return result;
+}
+
+std::unique_ptr<Builder::Response> Builder::respond() const
+{
+	std::unique_ptr<Response> response;
+
+	// A mapped template rewritten in place while it was rendered gives
+	// zeros, the page is rendered again from the new file
+	for (unsigned int attempt = 0; attempt < MAX_RENDER_ATTEMPTS; attempt++) {
+		uint64_t generation = TemplateCache::getGeneration();
+
+		response.reset(new Response(_httpHeader));
+		prepare(*response);
+
+		if (TemplateCache::getGeneration() == generation) {
+			break;
+		}
+	}
+
+	return response;
+}
+
+void Builder::prepare(Response &response) const
+{
+	// The request failed the preconditions, there's nothing to build
+	if (_precondition == HttpHeader::Status::NOT_MODIFIED) {
+		response.header.setStatus(_precondition, "Not Modified");
+		return;
+	} else if (_precondition == HttpHeader::Status::PRECONDITION_FAILED) {
+		response.header.setStatus(_precondition, "Precondition Failed");
+		return;
+	}
+
+	if (_renderer) {
+		_renderer(_fields, _lists, response.content);
+
+	} else if (_tags.first.empty() || _tags.second.empty()) {
+		response.content = replaceFields(compile()->getContent());
+
+	} else {
+		response.compiled = compile();
+		response.size = response.compiled->render(_fields, _lists, response.parts,
+		                                          response.fragments, _escaping);
+	}
+
+	if (response.content.empty() == false) {
+		response.parts.push_back(Template::Part(response.content.data(),
+		                                        response.content.size()));
+		response.size = response.content.size();
+	}
+
+	Encoding::Value encoding = negotiate(response);
+
+	// Each content coding is a different representation
+	string opaque = "";
+	auto createEntityTag = [&opaque](const Encoding::Value coding) -> string {
+		return EntityTag::create(coding == Encoding::UNDEFINED ? opaque :
+		                         opaque + "-" + Encoding::toString(coding));
+	};
+
+	if (_entityTagging && response.header.getEntityTag().empty()) {
+		Digest digest(Digest::Algorithm::XXHASH64);
+		for (auto part: response.parts) {
+			digest.update(part.first, part.second);
+		}
+
+		// The tag that the client has when the content was compressed
+		// before
+		opaque = digest.toString();
+		response.header.setEntityTag(createEntityTag(encoding));
+	}
+
+	// The client already has the same content, the body isn't compressed
+	// or sent
+	if (isNotModified(response.header)) {
+		response.header.setStatus(HttpHeader::Status::NOT_MODIFIED, "Not Modified");
+		response.parts.clear();
+		response.content.clear();
+		response.size = 0;
+		return;
+	}
+
+	bool compressed = compress(response, encoding);
+
+	// Content that couldn't be compressed is sent as it is
+	if (opaque.empty() == false && compressed == false) {
+		response.header.setEntityTag(createEntityTag(Encoding::UNDEFINED));
+	}
+}
+
+Encoding::Value Builder::negotiate(Response &response) const
+{
+	// The application may have encoded the content already
+	if (_compressionLevel == 0 || response.size < _compressionThreshold ||
+	    response.header.getContentEncoding() != Encoding::UNDEFINED) {
+		return Encoding::UNDEFINED;
+	}
+
+	response.header.addVary("Accept-Encoding");
+
+	const char *acceptEncodingPtr = getenv("HTTP_ACCEPT_ENCODING");
+	if (acceptEncodingPtr == NULL) {
+		return Encoding::UNDEFINED;
+	}
+
+	Encoding::Value encoding = Encoding::negotiate(acceptEncodingPtr);
+	if (encoding != Encoding::GZIP && encoding != Encoding::DEFLATE) {
+		return Encoding::UNDEFINED;
+	}
+
+	return encoding;
+}
+
+bool Builder::isNotModified(const HttpHeader &header) const
+{
+	string entityTag = header.getEntityTag();
+	boost::posix_time::ptime lastModified = header.getLastModified();
+	HttpHeader::Status::Value status = header.getStatus().first;
+	if ((entityTag.empty() && lastModified.is_not_a_date_time()) ||
+	    (status != HttpHeader::Status::UNDEFINED && status != HttpHeader::Status::OK)) {
+		return false;
+	}
+
+	// Only GET and HEAD get NOT_MODIFIED. Other methods must fail with
+	// PRECONDITION_FAILED before changing anything (checkPreconditions),
+	// it's too late here
+	Precondition precondition;
+	precondition.readEnvironment();
+	return precondition.evaluate(entityTag, lastModified) == HttpHeader::Status::NOT_MODIFIED;
+}
+
+bool Builder::compress(Response &response, const Encoding::Value encoding) const
+{
+	if (encoding == Encoding::UNDEFINED) {
+		return false;
+	}
+
+	// Each part is compressed as it is, without joining them. The
+	// literal parts of templates are compressed only once
+	Deflater deflater(encoding, _compressionLevel);
+	string compressed = "";
+	if (response.compiled) {
+		if (response.compiled->deflate(response.parts, deflater, compressed) == false) {
+			return false;
+		}
+
+	} else {
+		for (auto part: response.parts) {
+			if (deflater.deflate(part.first, part.second, compressed) == false) {
+				return false;
+			}
+		}
+	}
+
+	if (deflater.finish(compressed) == false) {
+		return false;
+	}
+
+	response.content.swap(compressed);
+	response.parts.assign(1, Template::Part(response.content.data(), response.content.size()));
+	response.size = response.content.size();
+	response.header.setContentEncoding(encoding);
+	return true;
+}
+
+std::shared_ptr<const Template> Builder::compile() const
+{
+	// The current version of the file, it may have changed since it
+	// was defined
+	if (_templateFile.empty() == false) {
+		std::shared_ptr<const Template> compiled = TemplateCache::get(_templateFile, _tags);
+		if (compiled) {
+			return compiled;
+		}
+	}
+
+	if (_template) {
+		return _template;
+	}
+
+	return std::make_shared<Template>(_content, _tags);
+}
+
 CGIPLUS_NS_END
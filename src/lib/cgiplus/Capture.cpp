@@ -0,0 +1,397 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+}
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cgiplus/Capture.hpp>
+
+extern char **environ;
+
+CGIPLUS_NS_BEGIN
+
+// Beginning of each record, the last byte is the format version
+static const char RECORD_MAGIC[] = { 'C', 'G', 'I', 1 };
+static const size_t RECORD_MAGIC_SIZE = sizeof(RECORD_MAGIC);
+
+namespace {
+
+void putNumber(string &buffer, uint64_t number)
+{
+	while (number >= 0x80) {
+		buffer += static_cast<char>((number & 0x7f) | 0x80);
+		number >>= 7;
+	}
+
+	buffer += static_cast<char>(number);
+}
+
+void putText(string &buffer, const string &text)
+{
+	putNumber(buffer, text.size());
+	buffer += text;
+}
+
+bool getNumber(const string &data, size_t &position, uint64_t &number)
+{
+	number = 0;
+
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		if (position >= data.size()) {
+			return false;
+		}
+
+		unsigned char byte = static_cast<unsigned char>(data[position++]);
+		number |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool getText(const string &data, size_t &position, string &text)
+{
+	uint64_t size = 0;
+	if (getNumber(data, position, size) == false ||
+	    size > data.size() - position) {
+		return false;
+	}
+
+	text = data.substr(position, size);
+	position += size;
+	return true;
+}
+
+double sample()
+{
+	static thread_local std::mt19937 generator(std::random_device{}());
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	return distribution(generator);
+}
+
+}
+
+Capture::Request::Request() :
+	_timestamp(0),
+	_body("")
+{
+}
+
+Capture::Request& Capture::Request::setTimestamp(const uint64_t timestamp)
+{
+	_timestamp = timestamp;
+	return *this;
+}
+
+uint64_t Capture::Request::getTimestamp() const
+{
+	return _timestamp;
+}
+
+Capture::Request& Capture::Request::addEnvironment(const string &name, const string &value)
+{
+	_environment.push_back(std::make_pair(name, value));
+	return *this;
+}
+
+Capture::Request::Environment const& Capture::Request::getEnvironment() const
+{
+	return _environment;
+}
+
+Capture::Request& Capture::Request::setBody(const string &body)
+{
+	_body = body;
+	return *this;
+}
+
+string const& Capture::Request::getBody() const
+{
+	return _body;
+}
+
+Capture::Capture() :
+	_file(""),
+	_rate(1.0),
+	_maxBodySize(1024 * 1024)
+{
+	const char *filePtr = getenv("CGIPLUS_CAPTURE_FILE");
+	if (filePtr != NULL) {
+		_file = filePtr;
+	}
+
+	const char *ratePtr = getenv("CGIPLUS_CAPTURE_RATE");
+	if (ratePtr != NULL) {
+		try {
+			setRate(boost::lexical_cast<double>(ratePtr));
+		} catch (const boost::bad_lexical_cast &e) {}
+	}
+
+	const char *maxBodySizePtr = getenv("CGIPLUS_CAPTURE_MAX_BODY_SIZE");
+	if (maxBodySizePtr != NULL) {
+		try {
+			_maxBodySize = boost::lexical_cast<size_t>(maxBodySizePtr);
+		} catch (const boost::bad_lexical_cast &e) {}
+	}
+}
+
+Capture& Capture::setFile(const string &file)
+{
+	_file = file;
+	return *this;
+}
+
+string Capture::getFile() const
+{
+	return _file;
+}
+
+Capture& Capture::setRate(const double rate)
+{
+	_rate = (rate < 0.0 ? 0.0 : (rate > 1.0 ? 1.0 : rate));
+	return *this;
+}
+
+double Capture::getRate() const
+{
+	return _rate;
+}
+
+Capture& Capture::setMaxBodySize(const size_t maxBodySize)
+{
+	_maxBodySize = maxBodySize;
+	return *this;
+}
+
+size_t Capture::getMaxBodySize() const
+{
+	return _maxBodySize;
+}
+
+bool Capture::isEnabled() const
+{
+	return (_file.empty() == false && _rate > 0.0);
+}
+
+bool Capture::record(string &body) const
+{
+	if (isEnabled() == false || (_rate < 1.0 && sample() >= _rate)) {
+		return false;
+	}
+
+	size_t size = 0;
+	const char *sizePtr = getenv("CONTENT_LENGTH");
+	if (sizePtr != NULL) {
+		try {
+			size = boost::lexical_cast<size_t>(sizePtr);
+		} catch (const boost::bad_lexical_cast &e) {
+			return false;
+		}
+	}
+
+	// Big bodies would stay in memory while the request is parsed
+	if (size > _maxBodySize) {
+		return false;
+	}
+
+	body.assign(size, '\0');
+	if (size > 0) {
+		std::cin.read(&body[0], size);
+		body.resize(std::cin.gcount());
+	}
+
+	Request request;
+	request.setTimestamp(std::chrono::duration_cast<std::chrono::microseconds>
+	                     (std::chrono::system_clock::now().time_since_epoch()).count());
+	request.setBody(body);
+
+	for (char **variable = environ; *variable != NULL; variable++) {
+		string entry = *variable;
+
+		size_t separator = entry.find('=');
+		if (separator == string::npos) {
+			continue;
+		}
+
+		string name = entry.substr(0, separator);
+		if (isRequestVariable(name)) {
+			request.addEnvironment(name, entry.substr(separator + 1));
+		}
+	}
+
+	// The request is parsed even when the log isn't available
+	write(_file, request);
+	return true;
+}
+
+bool Capture::write(const string &file, const Request &request)
+{
+	string buffer(RECORD_MAGIC, RECORD_MAGIC_SIZE);
+	putNumber(buffer, request.getTimestamp());
+	putNumber(buffer, request.getEnvironment().size());
+	for (auto variable: request.getEnvironment()) {
+		putText(buffer, variable.first);
+		putText(buffer, variable.second);
+	}
+	putText(buffer, request.getBody());
+
+	int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (fd == -1) {
+		return false;
+	}
+
+	// Records of other processes must not be interleaved when the
+	// record is written in many calls
+	flock(fd, LOCK_EX);
+
+	bool success = true;
+	size_t written = 0;
+	while (written < buffer.size()) {
+		ssize_t result = ::write(fd, buffer.data() + written, buffer.size() - written);
+		if (result == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			success = false;
+			break;
+		}
+
+		written += result;
+	}
+
+	close(fd);
+	return success;
+}
+
+bool Capture::load(const string &file, std::vector<Request> &requests)
+{
+	std::ifstream input(file.c_str(), std::ios::binary);
+	if (input.good() == false) {
+		return false;
+	}
+
+	string data((std::istreambuf_iterator<char>(input)),
+	            std::istreambuf_iterator<char>());
+
+	size_t position = 0;
+	while (position < data.size()) {
+		if (data.compare(position, RECORD_MAGIC_SIZE, RECORD_MAGIC, RECORD_MAGIC_SIZE) != 0) {
+			return false;
+		}
+
+		position += RECORD_MAGIC_SIZE;
+
+		Request request;
+		uint64_t timestamp = 0, variables = 0;
+		if (getNumber(data, position, timestamp) == false ||
+		    getNumber(data, position, variables) == false) {
+			return false;
+		}
+
+		request.setTimestamp(timestamp);
+
+		for (uint64_t i = 0; i < variables; i++) {
+			string name = "", value = "";
+			if (getText(data, position, name) == false ||
+			    getText(data, position, value) == false) {
+				return false;
+			}
+
+			request.addEnvironment(name, value);
+		}
+
+		string body = "";
+		if (getText(data, position, body) == false) {
+			return false;
+		}
+
+		request.setBody(body);
+		requests.push_back(request);
+	}
+
+	return true;
+}
+
+bool Capture::isRequestVariable(const string &name)
+{
+	// Credentials and session cookies would let anyone with the log
+	// impersonate the users
+	if (name == "HTTP_AUTHORIZATION" || name == "HTTP_PROXY_AUTHORIZATION" ||
+	    name == "HTTP_COOKIE") {
+		return false;
+	}
+
+	if (boost::starts_with(name, "HTTP_")) {
+		return true;
+	}
+
+	static const char *variables[] = {
+		"AUTH_TYPE",
+		"CONTENT_LANGUAGE",
+		"CONTENT_LENGTH",
+		"CONTENT_TYPE",
+		"GATEWAY_INTERFACE",
+		"HTTPS",
+		"PATH_INFO",
+		"PATH_TRANSLATED",
+		"QUERY_STRING",
+		"REMOTE_ADDR",
+		"REMOTE_HOST",
+		"REMOTE_IDENT",
+		"REMOTE_USER",
+		"REQUEST_METHOD",
+		"REQUEST_URI",
+		"SCRIPT_NAME",
+		"SERVER_NAME",
+		"SERVER_PORT",
+		"SERVER_PROTOCOL",
+		"SERVER_SOFTWARE",
+		NULL
+	};
+
+	for (unsigned int i = 0; variables[i] != NULL; i++) {
+		if (name == variables[i]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+CGIPLUS_NS_END
@@ -17,6 +17,7 @@
   along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
@@ -35,11 +36,34 @@
 #include <boost/regex.hpp>
 
 #include <cgiplus/Cgi.hpp>
+#include <cgiplus/Inflater.hpp>
+#include <cgiplus/MultipartParser.hpp>
+#include <cgiplus/ReadPipeline.hpp>
 #include <cgiplus/UploadedFile.hpp>
 
 CGIPLUS_NS_BEGIN
 
+// Number of bytes read from the standard input at once
+static const unsigned int READ_BUFFER_SIZE = 65536;
+
+// Ring of buffers used to read big bodies while they are parsed
+static const unsigned int PIPELINE_BUFFERS = 4;
+static const size_t PIPELINE_BUFFER_SIZE = 1024 * 1024;
+
+// Maximum size of the upload token used to publish the progress
+static const size_t MAX_PROGRESS_TOKEN_SIZE = 128;
+
 Cgi::Cgi() :
+	_content(""),
+	_uri(""),
+	_remoteAddress("")
+{
+	readInputs();
+}
+
+Cgi::Cgi(const Settings &settings) :
+	_settings(settings),
+	_content(""),
 	_uri(""),
 	_remoteAddress("")
 {
@@ -49,9 +73,7 @@ Cgi::Cgi() :
 Cgi::~Cgi()
 {
 	for (auto file: _files) {
-		if (remove(file.second.c_str()) == -1) {
-			// Error while trying to remove file, leave the file there
-		}
+		file.second.remove();
 	}
 }
 
@@ -73,8 +95,20 @@ HttpHeader const* Cgi::operator->() const
 void Cgi::readInputs()
 {
 	clearInputs();
+
+	// A recorded request has its body already read, so the parsers
+	// read the recorded copy instead of the standard input
+	string capturedBody = "";
+	std::stringbuf captured;
+	std::streambuf *input = NULL;
+	if (_settings.getCapture().record(capturedBody)) {
+		captured.str(capturedBody);
+		input = std::cin.rdbuf(&captured);
+	}
+
 	readMethod();
 	readContentType();
+	readContentEncoding();
 	readQueryStringInputs();
 	readContentInputs();
 	readContentLanguages();
@@ -84,6 +118,12 @@ void Cgi::readInputs()
 	readCookies();
 	readURI();
 	readRemoteAddress();
+	readPreconditions();
+
+	if (input != NULL) {
+		std::cin.rdbuf(input);
+		std::cin.clear();
+	}
 }
 
 unsigned int Cgi::getNumberOfInputs() const
@@ -91,11 +131,38 @@ unsigned int Cgi::getNumberOfInputs() const
 	return _inputs.size();
 }
 
+std::vector<UploadedFile> Cgi::getFiles(const string &key) const
+{
+	std::vector<UploadedFile> files;
+
+	auto range = _files.equal_range(key);
+	for (auto file = range.first; file != range.second; file++) {
+		files.push_back(file->second);
+	}
+
+	return files;
+}
+
+unsigned int Cgi::getNumberOfFiles() const
+{
+	return _files.size();
+}
+
 unsigned int Cgi::getNumberOfCookies() const
 {
 	return _httpHeader.getCookies().size();
 }
 
+ResumableUpload const& Cgi::getResumableUpload() const
+{
+	return _resumableUpload;
+}
+
+string Cgi::getContent() const
+{
+	return _content;
+}
+
 string Cgi::getURI() const
 {
 	return _uri;
@@ -106,38 +173,31 @@ string Cgi::getRemoteAddress() const
 	return _remoteAddress;
 }
 
+Precondition const& Cgi::getPrecondition() const
+{
+	return _precondition;
+}
+
 void Cgi::clearInputs()
 {
 	_httpHeader.clear();
 	_inputs.clear();
 	_files.clear();
+	_content.clear();
+	_resumableUpload = ResumableUpload();
 	_uri.clear();
 	_remoteAddress.clear();
+	_precondition.clear();
+	_conversions.clear();
 }
 
 void Cgi::readMethod()
 {
 	const char *methodPtr = getenv("REQUEST_METHOD");
 	if (methodPtr != NULL) {
-		string method = boost::to_upper_copy((string) methodPtr);
-		if (method == "CONNECT") {
-			_httpHeader.setMethod(HttpHeader::Method::CONNECT);
-		} else if (method == "DELETE") {
-			_httpHeader.setMethod(HttpHeader::Method::DELETE);
-		} else if (method == "HEAD") {
-			_httpHeader.setMethod(HttpHeader::Method::HEAD);
-		} else if (method == "GET") {
-			_httpHeader.setMethod(HttpHeader::Method::GET);
-		} else if (method == "OPTIONS") {
-			_httpHeader.setMethod(HttpHeader::Method::OPTIONS);
-		} else if (method == "PATCH") {
-			_httpHeader.setMethod(HttpHeader::Method::PATCH);
-		} else if (method == "POST") {
-			_httpHeader.setMethod(HttpHeader::Method::POST);
-		} else if (method == "PUT") {
-			_httpHeader.setMethod(HttpHeader::Method::PUT);
-		} else if (method == "TRACE") {
-			_httpHeader.setMethod(HttpHeader::Method::TRACE);
+		HttpHeader::Method::Value method = HttpHeader::parseMethod(methodPtr);
+		if (method != HttpHeader::Method::UNDEFINED) {
+			_httpHeader.setMethod(method);
 		}
 	}
 }
@@ -180,6 +240,15 @@ void Cgi::readContentType()
 	}
 }
 
+void Cgi::readContentEncoding()
+{
+	const char *encodingPtr = getenv("HTTP_CONTENT_ENCODING");
+	if (encodingPtr == NULL) {
+		return;
+	}
+
+	_httpHeader.setContentEncoding(Encoding::detect(encodingPtr));
+}
 
 void Cgi::readQueryStringInputs()
 {
@@ -195,6 +264,11 @@ void Cgi::readQueryStringInputs()
 void Cgi::readContentInputs()
 {
 	HttpHeader::Method::Value method = _httpHeader.getMethod();
+	if ((method == HttpHeader::Method::PATCH || method == HttpHeader::Method::PUT) &&
+	    readResumableContent()) {
+		return;
+	}
+
 	if (method != HttpHeader::Method::POST && method != HttpHeader::Method::PUT) {
 		return;
 	}
@@ -204,23 +278,92 @@ void Cgi::readContentInputs()
 		return;
 	}
 
-	char inputsPtr[size + 1];
-	memset(inputsPtr, 0, size + 1);
-
-	std::cin.read(inputsPtr, size);
-	if (std::cin.good() == false) {
+	MediaType::Value contentType = _httpHeader.getContentType();
+	if (contentType == MediaType::MULTIPART_FORM_DATA) {
+		parseMultipart(size);
 		return;
 	}
 
-	string inputs = inputsPtr;
+	string inputs;
+	if (_httpHeader.getContentEncoding() != Encoding::GZIP &&
+	    _httpHeader.getContentEncoding() != Encoding::DEFLATE) {
+		inputs.reserve(size);
+	}
+
+	bool success = readContent(size, [&inputs](const char *data, const size_t dataSize) {
+			inputs.append(data, dataSize);
+		});
+
+	if (success == false) {
+		return;
+	}
 
-	MediaType::Value contentType = _httpHeader.getContentType();
 	if (contentType == MediaType::APPLICATION_X_WWW_FORM_URL_ENCODED) {
 		parse(inputs);
 
-	} else if (contentType == MediaType::MULTIPART_FORM_DATA) {
-		parseMultipart(inputs);
+	} else {
+		_content.swap(inputs);
+	}
+}
+
+bool Cgi::readResumableContent()
+{
+	string directory = _settings.getResumableDirectory();
+	if (directory.empty()) {
+		return false;
+	}
+
+	const char *contentRangePtr = getenv("HTTP_CONTENT_RANGE");
+	if (contentRangePtr == NULL) {
+		return false;
+	}
+
+	string id = "";
+
+	const char *idPtr = getenv("HTTP_X_UPLOAD_ID");
+	if (idPtr != NULL) {
+		id = idPtr;
+	} else {
+		auto input = _inputs.find("X-Upload-ID");
+		if (input != _inputs.end()) {
+			id = input->second;
+		}
+	}
+
+	if (id.empty()) {
+		return false;
 	}
+
+	// From now on the body belongs to the upload, even when the chunk
+	// is rejected. The application checks the offset to answer
+	_resumableUpload = ResumableUpload(directory, id);
+
+	uint64_t first = 0, last = 0, totalSize = 0;
+	if (ResumableUpload::parseContentRange(contentRangePtr, first, last, totalSize) == false) {
+		return true;
+	}
+
+	// Compressed chunks are checked only while they are written
+	bool compressed = (_httpHeader.getContentEncoding() == Encoding::GZIP ||
+	                   _httpHeader.getContentEncoding() == Encoding::DEFLATE);
+
+	unsigned int size = readContentSize();
+	if (compressed == false && size != last - first + 1) {
+		return true;
+	}
+
+	if (_resumableUpload.begin(first, totalSize) == false) {
+		return true;
+	}
+
+	ResumableUpload &upload = _resumableUpload;
+	readContent(size, [&upload](const char *data, const size_t dataSize) {
+			upload.write(data, dataSize);
+		});
+
+	// Commit what was received, even if the connection was lost
+	upload.end();
+	return true;
 }
 
 unsigned int Cgi::readContentSize() const
@@ -238,6 +381,123 @@ unsigned int Cgi::readContentSize() const
 	return size;
 }
 
+string Cgi::readProgressToken() const
+{
+	string token = "";
+
+	const char *tokenPtr = getenv("HTTP_X_PROGRESS_ID");
+	if (tokenPtr != NULL) {
+		token = tokenPtr;
+	} else {
+		auto input = _inputs.find("X-Progress-ID");
+		if (input != _inputs.end()) {
+			token = input->second;
+		}
+	}
+
+	// Protection against huge tokens
+	if (token.size() > MAX_PROGRESS_TOKEN_SIZE) {
+		return "";
+	}
+
+	return token;
+}
+
+bool Cgi::readContent(const unsigned int size,
+                      const std::function<void(const char*, const size_t)> &consumer)
+{
+	Progress progress;
+
+	string token = readProgressToken();
+	if (token.empty() == false) {
+		progress.start(token, size);
+	}
+
+	bool success = readContent(size, consumer, progress);
+	progress.finish(success);
+	return success;
+}
+
+bool Cgi::readContent(const unsigned int size,
+                      const std::function<void(const char*, const size_t)> &consumer,
+                      Progress &progress)
+{
+	Encoding::Value encoding = _httpHeader.getContentEncoding();
+	if (encoding == Encoding::UNKNOWN) {
+		// We don't know how to decode the body
+		return false;
+	}
+
+	bool compressed = (encoding == Encoding::GZIP ||
+	                   encoding == Encoding::DEFLATE);
+
+	Inflater inflater(encoding, _settings.getMaxContentSize());
+	string inflated;
+
+	auto process = [&](const char *data, const size_t dataSize) -> bool {
+		if (compressed == false) {
+			consumer(data, dataSize);
+			return true;
+		}
+
+		if (inflater.inflate(data, dataSize, inflated) == false) {
+			return false;
+		}
+
+		consumer(inflated.data(), inflated.size());
+		inflated.clear();
+		return true;
+	};
+
+	size_t threshold = _settings.getPipelineThreshold();
+	if (threshold > 0 && size >= threshold) {
+		// The input is read in another thread while this one parses
+		unsigned int read = 0;
+		ReadPipeline pipeline(PIPELINE_BUFFERS, PIPELINE_BUFFER_SIZE);
+
+		bool success = pipeline.run(size, [&](char *buffer, const size_t bufferSize) {
+				std::cin.read(buffer, bufferSize);
+				if (std::cin.gcount() != static_cast<std::streamsize>(bufferSize)) {
+					return false;
+				}
+
+				read += bufferSize;
+				progress.update(read);
+				return true;
+			}, process);
+
+		if (success == false) {
+			return false;
+		}
+
+	} else {
+		std::vector<char> buffer(std::min(size, READ_BUFFER_SIZE));
+
+		unsigned int remaining = size;
+		while (remaining > 0) {
+			unsigned int chunkSize = std::min(remaining, READ_BUFFER_SIZE);
+
+			std::cin.read(buffer.data(), chunkSize);
+			if (std::cin.gcount() != static_cast<std::streamsize>(chunkSize)) {
+				return false;
+			}
+
+			remaining -= chunkSize;
+			progress.update(size - remaining);
+
+			if (process(buffer.data(), chunkSize) == false) {
+				return false;
+			}
+		}
+	}
+
+	if (compressed && inflater.isFinished() == false) {
+		return false;
+	}
+
+	return true;
+}
+
 void Cgi::readContentLanguages()
 {
 	const char *languagesPtr = getenv("CONTENT_LANGUAGE");
@@ -421,6 +681,11 @@ void Cgi::readRemoteAddress()
 	_remoteAddress = remoteAddressPtr;
 }
 
+void Cgi::readPreconditions()
+{
+	_precondition.readEnvironment();
+}
+
 void Cgi::parse(string inputs)
 {
 	decode(inputs);
@@ -437,44 +702,68 @@ void Cgi::parse(string inputs)
 	}
 }
 
-void Cgi::parseMultipart(const string &inputs)
+bool Cgi::parseMultipart(const unsigned int size)
 {
 	string boundary = _httpHeader.getContentBoundary();
 	if (boundary.empty()) {
-		return;
+		return false;
 	}
 
-	UploadedFile uploadedFile;
-
-	size_t position = 0;
-	size_t firstOccurrence = 0;
-	size_t secondOccurrence = 0;
+	// Bodies that don't fit in memory need the spool, so the space is
+	// checked before receiving the files. For the others the spool is
+	// resolved only when a file is written to disk
+	string directory = "";
+	if (size > _settings.getUploadMemoryLimit()) {
+		directory = _settings.getSpool().resolve(size);
+		if (directory.empty()) {
+			return false;
+		}
+	}
 
-	while (true) {
-		firstOccurrence = inputs.find(boundary, position);
+	MultipartParser parser(boundary, _settings, directory, size);
 
-		if (firstOccurrence == string::npos) {
-			break;
+	// Files are processed in background while the body is parsed
+	auto processors = _settings.getUploadProcessors();
+	if (processors.empty() == false) {
+		if (!_workerPool) {
+			unsigned int workers = _settings.getUploadWorkers();
+			_workerPool = std::make_shared<WorkerPool>(workers, workers * 4);
 		}
 
-		position += firstOccurrence + boundary.size();
-		secondOccurrence = inputs.find(boundary, position);
+		std::shared_ptr<WorkerPool> workerPool = _workerPool;
+		parser.setFileCallback([workerPool, processors](UploadedFile &file) {
+				for (auto processor: processors) {
+					UploadedFile::Processor function = processor.second;
+					file.setResult(processor.first, workerPool->submit([file, function]() {
+								return function(file);
+							}));
+				}
+			});
+	}
 
-		if (secondOccurrence == string::npos) {
-			break;
-		}
+	bool success = readContent(size, [&parser](const char *data, const size_t dataSize) {
+			parser.feed(data, dataSize);
+		});
+
+	if (success == false) {
+		parser.discard();
+		return false;
+	}
 
-		unsigned int begin = firstOccurrence + boundary.size();
-		unsigned int end = secondOccurrence - (firstOccurrence + boundary.size());
+	parser.finish();
 
-		uploadedFile.setMultipart(inputs.substr(begin, end));
-		position = secondOccurrence + boundary.size();
+	for (auto field: parser.getFields()) {
+		if (_settings.getInputStripping()) {
+			removeDangerousHtmlCharacters(field.second);
+		}
+		_inputs[field.first] = field.second;
 	}
 
-	if (uploadedFile.getControlName().empty() == false &&
-	    uploadedFile.getFilename().empty() == false) {
-		_files[uploadedFile.getControlName()] = uploadedFile.getFilename();
+	for (auto file: parser.getFiles()) {
+		_files.insert(std::make_pair(file.getControlName(), file));
 	}
+
+	return true;
 }
 
 void Cgi::decode(string &inputs)
@@ -482,7 +771,10 @@ void Cgi::decode(string &inputs)
 	boost::trim(inputs);
 	decodeSpecialSymbols(inputs);
 	decodeHexadecimal(inputs);
-	removeDangerousHtmlCharacters(inputs);
+
+	if (_settings.getInputStripping()) {
+		removeDangerousHtmlCharacters(inputs);
+	}
 }
 
 void Cgi::decodeSpecialSymbols(string &inputs)
@@ -517,10 +809,11 @@ string Cgi::hexadecimalToText(const string &hexadecimal)
 
 void Cgi::removeDangerousHtmlCharacters(string &inputs)
 {
-	boost::replace_all(inputs, "'", "");
-	boost::replace_all(inputs, "\"", "");
-	boost::replace_all(inputs, "<", "");
-	boost::replace_all(inputs, ">", "");
+	// Single pass over the input
+	inputs.erase(std::remove_if(inputs.begin(), inputs.end(), [](const char character) {
+				return character == '\'' || character == '"' ||
+					character == '<' || character == '>';
+			}), inputs.end());
 }
 
 CGIPLUS_NS_END
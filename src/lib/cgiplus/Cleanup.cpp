@@ -0,0 +1,200 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cgiplus/Cleanup.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+void removeAll(const std::vector<string> &filenames)
+{
+	for (auto filename: filenames) {
+		if (std::remove(filename.c_str()) == -1) {
+			// Error while trying to remove file, leave the file there
+		}
+	}
+}
+
+/*! Keeps the files waiting to be removed. There's only one instance
+ * per process, and when it is destroyed (process exit) all files that
+ * are still waiting are removed.
+ */
+class Reaper
+{
+public:
+	static Reaper& getInstance()
+	{
+		static Reaper reaper;
+		return reaper;
+	}
+
+	~Reaper()
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+
+		_wakeUp.notify_all();
+		if (_thread.joinable()) {
+			_thread.join();
+		}
+
+		removeAll(_afterResponse);
+		removeAll(_background);
+	}
+
+	void afterResponse(const string &filename)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_afterResponse.push_back(filename);
+	}
+
+	void background(const string &filename)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_background.push_back(filename);
+
+			// The thread is started only when someone needs it
+			if (_thread.joinable() == false) {
+				_thread = std::thread(&Reaper::run, this);
+			}
+		}
+
+		_wakeUp.notify_one();
+	}
+
+	void flush()
+	{
+		std::vector<string> filenames;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			filenames.swap(_afterResponse);
+		}
+
+		removeAll(filenames);
+	}
+
+	size_t getPending()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		return _afterResponse.size() + _background.size() + _removing;
+	}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (_background.empty() == false || _removing > 0) {
+			_idle.wait(lock);
+		}
+	}
+
+private:
+	Reaper() :
+		_removing(0),
+		_stopping(false)
+	{
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		while (true) {
+			while (_background.empty() && _stopping == false) {
+				_wakeUp.wait(lock);
+			}
+
+			if (_background.empty() && _stopping) {
+				break;
+			}
+
+			// Everything that arrived since the last batch is removed
+			// together, without holding the lock
+			std::vector<string> batch;
+			batch.swap(_background);
+			_removing = batch.size();
+
+			lock.unlock();
+			removeAll(batch);
+			lock.lock();
+
+			_removing = 0;
+			_idle.notify_all();
+		}
+	}
+
+	std::vector<string> _afterResponse;
+	std::vector<string> _background;
+	size_t _removing;
+	bool _stopping;
+
+	std::mutex _mutex;
+	std::condition_variable _wakeUp;
+	std::condition_variable _idle;
+	std::thread _thread;
+};
+
+}
+
+void Cleanup::schedule(const string &filename, const Policy::Value policy)
+{
+	if (filename.empty()) {
+		return;
+	}
+
+	switch (policy) {
+	case Policy::AFTER_RESPONSE:
+		Reaper::getInstance().afterResponse(filename);
+		break;
+	case Policy::BACKGROUND:
+		Reaper::getInstance().background(filename);
+		break;
+	case Policy::IMMEDIATE:
+	case Policy::ANONYMOUS:
+		removeAll(std::vector<string>(1, filename));
+		break;
+	}
+}
+
+void Cleanup::flush()
+{
+	Reaper::getInstance().flush();
+}
+
+size_t Cleanup::getPending()
+{
+	return Reaper::getInstance().getPending();
+}
+
+void Cleanup::wait()
+{
+	Reaper::getInstance().wait();
+}
+
+CGIPLUS_NS_END
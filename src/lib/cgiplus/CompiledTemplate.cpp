@@ -0,0 +1,58 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cgiplus/CompiledTemplate.hpp>
+
+CGIPLUS_NS_BEGIN
+
+const string* CompiledTemplate::find(const Template::Fields &fields, const char *name)
+{
+	auto field = fields.find(name);
+	if (field == fields.end()) {
+		return NULL;
+	}
+
+	return &field->second;
+}
+
+const Template::List* CompiledTemplate::find(const Template::Lists &lists, const char *name)
+{
+	auto list = lists.find(name);
+	if (list == lists.end()) {
+		return NULL;
+	}
+
+	return &list->second;
+}
+
+void CompiledTemplate::append(const Template::Row &row, const char *column, string &output)
+{
+	auto value = row.find(column);
+	if (value != row.end()) {
+		output.append(value->second);
+	}
+}
+
+bool CompiledTemplate::isEmpty(const Template::Row &row, const char *column)
+{
+	auto value = row.find(column);
+	return value == row.end() || value->second.empty();
+}
+
+CGIPLUS_NS_END
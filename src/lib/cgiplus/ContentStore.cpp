@@ -0,0 +1,266 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+}
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <cgiplus/ContentStore.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+bool writeAll(const int fd, const char *data, const size_t size)
+{
+	size_t written = 0;
+	while (written < size) {
+		ssize_t result = ::write(fd, data + written, size - written);
+		if (result == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		written += result;
+	}
+
+	return true;
+}
+
+int createTemporary(const string &directory, string &filename)
+{
+	string pattern = directory + "/blob-XXXXXX";
+
+	std::vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+
+	int fd = mkstemp(path.data());
+	if (fd == -1) {
+		return -1;
+	}
+
+	filename = path.data();
+	return fd;
+}
+
+// Blobs are shared by many uploads, writing one of them would change
+// all the others
+const mode_t BLOB_MODE = 0444;
+
+// Anonymous files (/proc/self/fd/N) can only be linked following the
+// symbolic link
+bool linkFile(const string &from, const string &to)
+{
+	return (linkat(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(),
+	               AT_SYMLINK_FOLLOW) == 0);
+}
+
+}
+
+ContentStore::ContentStore() :
+	_directory("")
+{
+}
+
+ContentStore& ContentStore::setDirectory(const string &directory)
+{
+	_directory = directory;
+	return *this;
+}
+
+string ContentStore::getDirectory() const
+{
+	return _directory;
+}
+
+bool ContentStore::isEnabled() const
+{
+	return (_directory.empty() == false);
+}
+
+string ContentStore::getPath(const string &digest) const
+{
+	// The digest is used as a path, so only hexadecimal digits are
+	// allowed
+	if (isEnabled() == false || digest.size() != 64 ||
+	    digest.find_first_not_of("0123456789abcdef") != string::npos) {
+		return "";
+	}
+
+	return _directory + "/sha256/" + digest.substr(0, 2) + "/" + digest;
+}
+
+bool ContentStore::contains(const string &digest) const
+{
+	string path = getPath(digest);
+	if (path.empty()) {
+		return false;
+	}
+
+	struct stat info;
+	return (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode));
+}
+
+bool ContentStore::add(const string &digest, const string &filename) const
+{
+	string path = prepare(digest);
+	if (path.empty()) {
+		return false;
+	}
+
+	if (linkFile(filename, path)) {
+		// The uploaded file is now the blob
+		chmod(path.c_str(), BLOB_MODE);
+		return true;
+	}
+
+	if (errno == EEXIST) {
+		// Duplicated content, the file becomes another name of the blob.
+		// The link is created aside and renamed, so the file is never
+		// missing
+		string link = filename + "-blob";
+		if (linkFile(path, link) == false) {
+			return true;
+		}
+
+		if (rename(link.c_str(), filename.c_str()) == -1) {
+			unlink(link.c_str());
+		}
+
+		return true;
+	}
+
+	if (errno != EXDEV) {
+		return false;
+	}
+
+	if (contains(digest)) {
+		return true;
+	}
+
+	// Different file systems, the content must be copied
+	int input = open(filename.c_str(), O_RDONLY);
+	if (input == -1) {
+		return false;
+	}
+
+	string temporary;
+	int output = createTemporary(path.substr(0, path.rfind('/')), temporary);
+	if (output == -1) {
+		close(input);
+		return false;
+	}
+
+	bool success = true;
+	char buffer[65536];
+
+	while (true) {
+		ssize_t result = read(input, buffer, sizeof(buffer));
+		if (result == -1 && errno == EINTR) {
+			continue;
+		}
+
+		if (result <= 0) {
+			success = (result == 0);
+			break;
+		}
+
+		if (writeAll(output, buffer, result) == false) {
+			success = false;
+			break;
+		}
+	}
+
+	close(input);
+
+	if (fchmod(output, BLOB_MODE) == -1) {
+		success = false;
+	}
+
+	close(output);
+
+	if (success == false || rename(temporary.c_str(), path.c_str()) == -1) {
+		unlink(temporary.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool ContentStore::add(const string &digest, const char *data, const size_t size) const
+{
+	if (contains(digest)) {
+		return true;
+	}
+
+	string path = prepare(digest);
+	if (path.empty()) {
+		return false;
+	}
+
+	string temporary;
+	int fd = createTemporary(path.substr(0, path.rfind('/')), temporary);
+	if (fd == -1) {
+		return false;
+	}
+
+	bool success = (writeAll(fd, data, size) && fchmod(fd, BLOB_MODE) == 0);
+	close(fd);
+
+	// Rename is atomic, readers never see a partial blob. When two
+	// processes store the same content the result is the same
+	if (success == false || rename(temporary.c_str(), path.c_str()) == -1) {
+		unlink(temporary.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+string ContentStore::prepare(const string &digest) const
+{
+	string path = getPath(digest);
+	if (path.empty()) {
+		return "";
+	}
+
+	string algorithmDirectory = _directory + "/sha256";
+	string prefixDirectory = path.substr(0, path.rfind('/'));
+
+	if ((mkdir(_directory.c_str(), 0700) == -1 && errno != EEXIST) ||
+	    (mkdir(algorithmDirectory.c_str(), 0700) == -1 && errno != EEXIST) ||
+	    (mkdir(prefixDirectory.c_str(), 0700) == -1 && errno != EEXIST)) {
+		return "";
+	}
+
+	return path;
+}
+
+CGIPLUS_NS_END
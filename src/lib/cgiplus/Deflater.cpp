@@ -0,0 +1,236 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include <cgiplus/Deflater.hpp>
+
+CGIPLUS_NS_BEGIN
+
+// Raw deflate blocks, the header and the trailer are written here so
+// parts compressed before can be joined to the stream
+static const int RAW_WINDOW_BITS = -15;
+
+static const int MEMORY_LEVEL = 8;
+
+namespace {
+
+void appendLittleEndian(const uint32_t value, string &output)
+{
+	for (int i = 0; i < 4; i++) {
+		output += static_cast<char>((value >> (i * 8)) & 0xFF);
+	}
+}
+
+void appendBigEndian(const uint32_t value, string &output)
+{
+	for (int i = 3; i >= 0; i--) {
+		output += static_cast<char>((value >> (i * 8)) & 0xFF);
+	}
+}
+
+}
+
+Deflater::Deflater(const Encoding::Value encoding, const int level) :
+	_encoding(encoding),
+	_level(level),
+	_crc(crc32(0, Z_NULL, 0)),
+	_adler(adler32(0, Z_NULL, 0)),
+	_size(0),
+	_initialized(false),
+	_headerWritten(false),
+	_pending(false),
+	_failed(false)
+{
+	memset(&_stream, 0, sizeof(_stream));
+	_stream.zalloc = Z_NULL;
+	_stream.zfree = Z_NULL;
+	_stream.opaque = Z_NULL;
+
+	if (deflateInit2(&_stream, level, Z_DEFLATED, RAW_WINDOW_BITS, MEMORY_LEVEL,
+	                 Z_DEFAULT_STRATEGY) != Z_OK) {
+		_failed = true;
+		return;
+	}
+
+	_initialized = true;
+}
+
+Deflater::~Deflater()
+{
+	if (_initialized) {
+		deflateEnd(&_stream);
+	}
+}
+
+bool Deflater::deflate(const char *data, const size_t size, string &output)
+{
+	if (_failed) {
+		return false;
+	}
+
+	writeHeader(output);
+
+	_crc = crc32(_crc, reinterpret_cast<const Bytef*>(data), size);
+	_adler = adler32(_adler, reinterpret_cast<const Bytef*>(data), size);
+	_size += size;
+	_pending = _pending || size > 0;
+
+	_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	_stream.avail_in = size;
+
+	return run(Z_NO_FLUSH, output);
+}
+
+bool Deflater::join(const string &compressed, const size_t size, const uint32_t crc,
+                    const uint32_t adler, string &output)
+{
+	if (_failed) {
+		return false;
+	}
+
+	writeHeader(output);
+
+	// The part can't be referenced by the next data compressed here, and
+	// must start in a byte boundary
+	if (_pending) {
+		_stream.next_in = Z_NULL;
+		_stream.avail_in = 0;
+
+		if (run(Z_FULL_FLUSH, output) == false) {
+			return false;
+		}
+
+		_pending = false;
+	}
+
+	output.append(compressed);
+
+	_crc = crc32_combine(_crc, crc, size);
+	_adler = adler32_combine(_adler, adler, size);
+	_size += size;
+	return true;
+}
+
+bool Deflater::finish(string &output)
+{
+	if (_failed) {
+		return false;
+	}
+
+	writeHeader(output);
+
+	_stream.next_in = Z_NULL;
+	_stream.avail_in = 0;
+
+	if (run(Z_FINISH, output) == false) {
+		return false;
+	}
+
+	if (_encoding == Encoding::GZIP) {
+		appendLittleEndian(_crc, output);
+		appendLittleEndian(static_cast<uint32_t>(_size), output);
+	} else {
+		appendBigEndian(_adler, output);
+	}
+
+	return true;
+}
+
+bool Deflater::compressPart(const char *data, const size_t size, const int level,
+                            string &compressed, uint32_t &crc, uint32_t &adler)
+{
+	crc = crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data), size);
+	adler = adler32(adler32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data), size);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, level, Z_DEFLATED, RAW_WINDOW_BITS, MEMORY_LEVEL,
+	                 Z_DEFAULT_STRATEGY) != Z_OK) {
+		return false;
+	}
+
+	compressed.resize(deflateBound(&stream, size) + 16);
+
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream.avail_in = size;
+	stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+	stream.avail_out = compressed.size();
+
+	// Not the last block, ending in a byte boundary
+	int result = ::deflate(&stream, Z_SYNC_FLUSH);
+	bool success = (result == Z_OK && stream.avail_in == 0 && stream.avail_out > 0);
+
+	compressed.resize(compressed.size() - stream.avail_out);
+	deflateEnd(&stream);
+	return success;
+}
+
+bool Deflater::run(const int flush, string &output)
+{
+	char chunk[16384];
+
+	do {
+		_stream.next_out = reinterpret_cast<Bytef*>(chunk);
+		_stream.avail_out = sizeof(chunk);
+
+		int result = ::deflate(&_stream, flush);
+		if (result == Z_STREAM_ERROR) {
+			_failed = true;
+			return false;
+		}
+
+		output.append(chunk, sizeof(chunk) - _stream.avail_out);
+
+		if (result == Z_STREAM_END) {
+			break;
+		}
+
+		// A full output chunk means that zlib could have more data pending
+	} while (_stream.avail_in > 0 || _stream.avail_out == 0 || flush == Z_FINISH);
+
+	return true;
+}
+
+void Deflater::writeHeader(string &output)
+{
+	if (_headerWritten) {
+		return;
+	}
+
+	_headerWritten = true;
+
+	if (_encoding == Encoding::GZIP) {
+		// Magic, deflate method, no flags, no time, no extra flags, Unix
+		const char header[] = { '\x1F', '\x8B', 8, 0, 0, 0, 0, 0, 0, 3 };
+		output.append(header, sizeof(header));
+		return;
+	}
+
+	// 32 KB window and the compression level, with the check bits
+	unsigned int method = 0x78;
+	unsigned int flags = (_level == Z_DEFAULT_COMPRESSION ? 2 :
+	                      _level < 2 ? 0 : _level < 6 ? 1 : _level == 6 ? 2 : 3) << 6;
+	flags += (31 - (method * 256 + flags) % 31) % 31;
+
+	output += static_cast<char>(method);
+	output += static_cast<char>(flags);
+}
+
+CGIPLUS_NS_END
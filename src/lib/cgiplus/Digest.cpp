@@ -0,0 +1,404 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include <cgiplus/Digest.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+// CRC32C (Castagnoli) reflected polynomial
+const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+const uint32_t SHA256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+struct Crc32cTable
+{
+	Crc32cTable()
+	{
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int j = 0; j < 8; j++) {
+				crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+			}
+			values[i] = crc;
+		}
+	}
+
+	uint32_t values[256];
+};
+
+const Crc32cTable crc32cTable;
+
+inline uint32_t rotateRight(const uint32_t value, const int bits)
+{
+	return (value >> bits) | (value << (32 - bits));
+}
+
+inline uint64_t rotateLeft(const uint64_t value, const int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t read64(const unsigned char *data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+inline uint32_t read32(const unsigned char *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+inline uint64_t xxhRound(uint64_t accumulator, const uint64_t input)
+{
+	accumulator += input * XXH_PRIME64_2;
+	accumulator = rotateLeft(accumulator, 31);
+	return accumulator * XXH_PRIME64_1;
+}
+
+inline uint64_t xxhMergeRound(uint64_t accumulator, const uint64_t value)
+{
+	accumulator ^= xxhRound(0, value);
+	return accumulator * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+string toHexadecimal(const unsigned char *data, const size_t size)
+{
+	string hexadecimal;
+	hexadecimal.reserve(size * 2);
+
+	const char symbols[] = "0123456789abcdef";
+	for (size_t i = 0; i < size; i++) {
+		hexadecimal += symbols[data[i] >> 4];
+		hexadecimal += symbols[data[i] & 0x0f];
+	}
+
+	return hexadecimal;
+}
+
+}
+
+Digest::Digest(const Algorithm::Value algorithm) :
+	_algorithm(algorithm),
+	_length(0),
+	_crc(0xFFFFFFFF),
+	_blockSize(0)
+{
+	const uint32_t shaInitial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(_sha, shaInitial, sizeof(_sha));
+
+	// Seed is always zero
+	_xxh[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+	_xxh[1] = XXH_PRIME64_2;
+	_xxh[2] = 0;
+	_xxh[3] = 0 - XXH_PRIME64_1;
+}
+
+Digest& Digest::update(const char *data, const size_t size)
+{
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+
+	switch (_algorithm) {
+	case Algorithm::NONE:
+		break;
+	case Algorithm::CRC32C:
+		updateCrc32c(bytes, size);
+		break;
+	case Algorithm::SHA256:
+		updateSha256(bytes, size);
+		break;
+	case Algorithm::XXHASH64:
+		updateXxhash64(bytes, size);
+		break;
+	}
+
+	_length += size;
+	return *this;
+}
+
+string Digest::toString() const
+{
+	switch (_algorithm) {
+	case Algorithm::NONE:
+		break;
+
+	case Algorithm::CRC32C:
+		{
+			char hexadecimal[9];
+			snprintf(hexadecimal, sizeof(hexadecimal), "%08x", ~_crc);
+			return hexadecimal;
+		}
+
+	case Algorithm::SHA256:
+		{
+			// Finish a copy, so the object can still be updated
+			Digest copy(*this);
+
+			unsigned char padding[72];
+			memset(padding, 0, sizeof(padding));
+			padding[0] = 0x80;
+
+			size_t paddingSize = (_blockSize < 56) ? 56 - _blockSize : 120 - _blockSize;
+			uint64_t bits = _length * 8;
+			for (int i = 0; i < 8; i++) {
+				padding[paddingSize + i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+			}
+			copy.updateSha256(padding, paddingSize + 8);
+
+			unsigned char result[32];
+			for (int i = 0; i < 8; i++) {
+				result[i * 4] = static_cast<unsigned char>(copy._sha[i] >> 24);
+				result[i * 4 + 1] = static_cast<unsigned char>(copy._sha[i] >> 16);
+				result[i * 4 + 2] = static_cast<unsigned char>(copy._sha[i] >> 8);
+				result[i * 4 + 3] = static_cast<unsigned char>(copy._sha[i]);
+			}
+
+			return toHexadecimal(result, sizeof(result));
+		}
+
+	case Algorithm::XXHASH64:
+		{
+			uint64_t hash = 0;
+			if (_length >= 32) {
+				hash = rotateLeft(_xxh[0], 1) + rotateLeft(_xxh[1], 7) +
+					rotateLeft(_xxh[2], 12) + rotateLeft(_xxh[3], 18);
+				for (int i = 0; i < 4; i++) {
+					hash = xxhMergeRound(hash, _xxh[i]);
+				}
+			} else {
+				hash = XXH_PRIME64_5;
+			}
+
+			hash += _length;
+
+			const unsigned char *data = _block;
+			size_t size = _blockSize;
+
+			while (size >= 8) {
+				hash ^= xxhRound(0, read64(data));
+				hash = rotateLeft(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+				data += 8;
+				size -= 8;
+			}
+
+			if (size >= 4) {
+				hash ^= static_cast<uint64_t>(read32(data)) * XXH_PRIME64_1;
+				hash = rotateLeft(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+				data += 4;
+				size -= 4;
+			}
+
+			while (size > 0) {
+				hash ^= (*data) * XXH_PRIME64_5;
+				hash = rotateLeft(hash, 11) * XXH_PRIME64_1;
+				data++;
+				size--;
+			}
+
+			hash ^= hash >> 33;
+			hash *= XXH_PRIME64_2;
+			hash ^= hash >> 29;
+			hash *= XXH_PRIME64_3;
+			hash ^= hash >> 32;
+
+			char hexadecimal[17];
+			snprintf(hexadecimal, sizeof(hexadecimal), "%016llx",
+			         static_cast<unsigned long long>(hash));
+			return hexadecimal;
+		}
+	}
+
+	return "";
+}
+
+Digest::Algorithm::Value Digest::getAlgorithm() const
+{
+	return _algorithm;
+}
+
+string Digest::calculate(const Algorithm::Value algorithm, const string &data)
+{
+	return Digest(algorithm).update(data.data(), data.size()).toString();
+}
+
+void Digest::updateCrc32c(const unsigned char *data, size_t size)
+{
+	uint32_t crc = _crc;
+
+#ifdef __SSE4_2__
+	uint64_t crc64 = crc;
+	while (size >= 8) {
+		crc64 = _mm_crc32_u64(crc64, read64(data));
+		data += 8;
+		size -= 8;
+	}
+	crc = static_cast<uint32_t>(crc64);
+#endif
+
+	while (size > 0) {
+		crc = crc32cTable.values[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+		data++;
+		size--;
+	}
+
+	_crc = crc;
+}
+
+void Digest::updateSha256(const unsigned char *data, size_t size)
+{
+	if (_blockSize > 0) {
+		size_t missing = std::min(size, static_cast<size_t>(64) - _blockSize);
+		memcpy(_block + _blockSize, data, missing);
+		_blockSize += missing;
+		data += missing;
+		size -= missing;
+
+		if (_blockSize < 64) {
+			return;
+		}
+
+		transformSha256(_block);
+		_blockSize = 0;
+	}
+
+	while (size >= 64) {
+		transformSha256(data);
+		data += 64;
+		size -= 64;
+	}
+
+	memcpy(_block, data, size);
+	_blockSize = size;
+}
+
+void Digest::transformSha256(const unsigned char *block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++) {
+		w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) |
+			(static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+			(static_cast<uint32_t>(block[i * 4 + 2]) << 8) |
+			static_cast<uint32_t>(block[i * 4 + 3]);
+	}
+
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^
+			(w[i - 15] >> 3);
+		uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^
+			(w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = _sha[0], b = _sha[1], c = _sha[2], d = _sha[3];
+	uint32_t e = _sha[4], f = _sha[5], g = _sha[6], h = _sha[7];
+
+	for (int i = 0; i < 64; i++) {
+		uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+		uint32_t choice = (e & f) ^ (~e & g);
+		uint32_t temp1 = h + s1 + choice + SHA256_K[i] + w[i];
+		uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+		uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t temp2 = s0 + majority;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+
+	_sha[0] += a;
+	_sha[1] += b;
+	_sha[2] += c;
+	_sha[3] += d;
+	_sha[4] += e;
+	_sha[5] += f;
+	_sha[6] += g;
+	_sha[7] += h;
+}
+
+void Digest::updateXxhash64(const unsigned char *data, size_t size)
+{
+	if (_blockSize > 0) {
+		size_t missing = std::min(size, static_cast<size_t>(32) - _blockSize);
+		memcpy(_block + _blockSize, data, missing);
+		_blockSize += missing;
+		data += missing;
+		size -= missing;
+
+		if (_blockSize < 32) {
+			return;
+		}
+
+		for (int i = 0; i < 4; i++) {
+			_xxh[i] = xxhRound(_xxh[i], read64(_block + i * 8));
+		}
+		_blockSize = 0;
+	}
+
+	while (size >= 32) {
+		for (int i = 0; i < 4; i++) {
+			_xxh[i] = xxhRound(_xxh[i], read64(data + i * 8));
+		}
+		data += 32;
+		size -= 32;
+	}
+
+	memcpy(_block, data, size);
+	_blockSize = size;
+}
+
+CGIPLUS_NS_END
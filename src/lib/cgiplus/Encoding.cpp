@@ -0,0 +1,127 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+#include <cgiplus/Encoding.hpp>
+
+CGIPLUS_NS_BEGIN
+
+Encoding::Value Encoding::detect(const string &value)
+{
+	string encoding = boost::algorithm::to_lower_copy(value);
+	boost::trim(encoding);
+
+	if (encoding == "*") {
+		return ANY;
+
+	} else if (encoding == "identity") {
+		return IDENTITY;
+
+	} else if (encoding == "gzip" || encoding == "x-gzip") {
+		return GZIP;
+
+	} else if (encoding == "deflate") {
+		return DEFLATE;
+
+	} else {
+		return UNKNOWN;
+	}
+}
+
+string Encoding::toString(const Value value)
+{
+	switch(value) {
+	case UNDEFINED:
+		break;
+	case ANY:
+		return "*";
+	case IDENTITY:
+		return "identity";
+	case GZIP:
+		return "gzip";
+	case DEFLATE:
+		return "deflate";
+	case UNKNOWN:
+		break;
+	}
+
+	return "";
+}
+
+Encoding::Value Encoding::negotiate(const string &acceptEncoding)
+{
+	// Quality of each coding, -1 when it isn't in the list
+	double gzip = -1, deflate = -1, any = -1;
+
+	std::vector<string> encodingsList;
+	boost::split(encodingsList, acceptEncoding, boost::is_any_of(","));
+
+	for (auto encodingStr: encodingsList) {
+		std::vector<string> encodingItems;
+		boost::split(encodingItems, encodingStr, boost::is_any_of(";"));
+
+		double quality = 1;
+		if (encodingItems.size() == 2) {
+			std::vector<string> qualityItems;
+			boost::split(qualityItems, encodingItems[1], boost::is_any_of("="));
+
+			if (qualityItems.size() == 2 && boost::trim_copy(qualityItems[0]) == "q") {
+				quality = strtod(qualityItems[1].c_str(), NULL);
+			}
+		}
+
+		switch (detect(encodingItems[0])) {
+		case GZIP:
+			gzip = quality;
+			break;
+		case DEFLATE:
+			deflate = quality;
+			break;
+		case ANY:
+			any = quality;
+			break;
+		default:
+			break;
+		}
+	}
+
+	// "*" applies to the codings that are not in the list
+	if (gzip < 0) {
+		gzip = any;
+	}
+
+	if (deflate < 0) {
+		deflate = any;
+	}
+
+	if (gzip > 0 && gzip >= deflate) {
+		return GZIP;
+	} else if (deflate > 0) {
+		return DEFLATE;
+	}
+
+	return IDENTITY;
+}
+
+CGIPLUS_NS_END
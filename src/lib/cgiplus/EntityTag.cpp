@@ -0,0 +1,99 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <cgiplus/EntityTag.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+/*! Read the next entity tag of a list, from the position. Returns
+ * false when there's no valid entity tag.
+ */
+bool next(const string &list, size_t &position, string &opaque, bool &weak)
+{
+	while (position < list.size() &&
+	       (list[position] == ' ' || list[position] == '\t' || list[position] == ',')) {
+		position++;
+	}
+
+	weak = false;
+	if (list.compare(position, 2, "W/") == 0) {
+		weak = true;
+		position += 2;
+	}
+
+	if (position >= list.size() || list[position] != '"') {
+		return false;
+	}
+
+	size_t end = list.find('"', position + 1);
+	if (end == string::npos) {
+		return false;
+	}
+
+	opaque = list.substr(position + 1, end - position - 1);
+	position = end + 1;
+	return true;
+}
+
+}
+
+string EntityTag::create(const string &opaque, const bool weak)
+{
+	return (weak ? "W/\"" : "\"") + opaque + "\"";
+}
+
+bool EntityTag::match(const string &list, const string &entityTag,
+                      const Comparison::Value comparison)
+{
+	size_t position = 0;
+	string opaque = "";
+	bool weak = false;
+	if (next(entityTag, position, opaque, weak) == false) {
+		return false;
+	}
+
+	size_t begin = list.find_first_not_of(" \t");
+	if (begin != string::npos && list.compare(begin, 1, "*") == 0) {
+		return true;
+	}
+
+	if (comparison == Comparison::STRONG && weak) {
+		return false;
+	}
+
+	position = 0;
+	string itemOpaque = "";
+	bool itemWeak = false;
+	while (next(list, position, itemOpaque, itemWeak)) {
+		if (comparison == Comparison::STRONG && itemWeak) {
+			continue;
+		}
+
+		if (itemOpaque == opaque) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+CGIPLUS_NS_END
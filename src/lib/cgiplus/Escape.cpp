@@ -0,0 +1,406 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cctype>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cgiplus/Escape.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+const char TEXT_SPECIALS[] = "&<>\"'";
+const char ATTRIBUTE_SPECIALS[] = "&<>\"'`= \t\n\r\f";
+// Besides the control characters, space and non ASCII bytes
+const char URL_SPECIALS[] = "&<>\"'`\\^{}|\x7F";
+
+const char *SAFE_SCHEMES[] = { "http", "https", "ftp", "mailto", "tel" };
+
+// Attributes whose values are URLs
+const char *URL_ATTRIBUTES[] = { "href", "src", "action", "formaction", "cite",
+                                 "background", "poster", "longdesc", "usemap" };
+
+/*! \class Tables
+ *  \brief Special characters of each context and their replacements
+ */
+class Tables
+{
+public:
+	Tables()
+	{
+		memset(special, 0, sizeof(special));
+
+		for (const char *character = TEXT_SPECIALS; *character != '\0'; character++) {
+			special[Escape::Context::TEXT][static_cast<unsigned char>(*character)] = true;
+		}
+
+		for (const char *character = ATTRIBUTE_SPECIALS; *character != '\0'; character++) {
+			special[Escape::Context::ATTRIBUTE][static_cast<unsigned char>(*character)] = true;
+		}
+
+		for (const char *character = URL_SPECIALS; *character != '\0'; character++) {
+			special[Escape::Context::URL][static_cast<unsigned char>(*character)] = true;
+		}
+
+		const char hexadecimal[] = "0123456789ABCDEF";
+		for (unsigned int i = 0; i < 256; i++) {
+			if (i <= 0x20 || i >= 0x80) {
+				special[Escape::Context::URL][i] = true;
+			}
+
+			// Only the unreserved characters (RFC 3986) are kept in a component
+			special[Escape::Context::URL_COMPONENT][i] =
+				(isalnum(i) || i == '-' || i == '.' || i == '_' || i == '~') == false;
+
+			percent[i][0] = '%';
+			percent[i][1] = hexadecimal[i >> 4];
+			percent[i][2] = hexadecimal[i & 0x0F];
+		}
+	}
+
+	bool special[5][256];
+	char percent[256][3];
+};
+
+const Tables& getTables()
+{
+	static Tables tables;
+	return tables;
+}
+
+#ifdef __SSE2__
+/*! Search 16 bytes at a time for the special characters. Returns where
+ * the search stopped, the remaining bytes (less than 16) must be checked
+ * one by one
+ */
+size_t findVector(const char *data, const size_t size, const char *specials,
+                  const bool controls)
+{
+	__m128i vectors[16];
+	size_t count = 0;
+	for (; specials[count] != '\0'; count++) {
+		vectors[count] = _mm_set1_epi8(specials[count]);
+	}
+
+	// Signed comparison, so bytes from 0x80 are also below the limit
+	const __m128i limit = _mm_set1_epi8(0x21);
+
+	size_t position = 0;
+	while (position + 16 <= size) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+
+		__m128i found = _mm_setzero_si128();
+		for (size_t i = 0; i < count; i++) {
+			found = _mm_or_si128(found, _mm_cmpeq_epi8(block, vectors[i]));
+		}
+
+		if (controls) {
+			found = _mm_or_si128(found, _mm_cmplt_epi8(block, limit));
+		}
+
+		int mask = _mm_movemask_epi8(found);
+		if (mask != 0) {
+			return position + __builtin_ctz(mask);
+		}
+
+		position += 16;
+	}
+
+	return position;
+}
+
+/*! Search 16 bytes at a time for the characters that aren't unreserved
+ * in a URL component
+ */
+size_t findComponentVector(const char *data, const size_t size)
+{
+	// Signed comparison, so bytes from 0x80 are below all the ranges
+	const __m128i digitLow = _mm_set1_epi8('0' - 1), digitHigh = _mm_set1_epi8('9' + 1);
+	const __m128i upperLow = _mm_set1_epi8('A' - 1), upperHigh = _mm_set1_epi8('Z' + 1);
+	const __m128i lowerLow = _mm_set1_epi8('a' - 1), lowerHigh = _mm_set1_epi8('z' + 1);
+	const __m128i hyphen = _mm_set1_epi8('-'), dot = _mm_set1_epi8('.');
+	const __m128i underscore = _mm_set1_epi8('_'), tilde = _mm_set1_epi8('~');
+
+	size_t position = 0;
+	while (position + 16 <= size) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+
+		__m128i unreserved = _mm_and_si128(_mm_cmpgt_epi8(block, digitLow),
+		                                   _mm_cmplt_epi8(block, digitHigh));
+		unreserved = _mm_or_si128(unreserved, _mm_and_si128(_mm_cmpgt_epi8(block, upperLow),
+		                                                    _mm_cmplt_epi8(block, upperHigh)));
+		unreserved = _mm_or_si128(unreserved, _mm_and_si128(_mm_cmpgt_epi8(block, lowerLow),
+		                                                    _mm_cmplt_epi8(block, lowerHigh)));
+		unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, hyphen));
+		unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, dot));
+		unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, underscore));
+		unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, tilde));
+
+		int mask = _mm_movemask_epi8(unreserved) ^ 0xFFFF;
+		if (mask != 0) {
+			return position + __builtin_ctz(mask);
+		}
+
+		position += 16;
+	}
+
+	return position;
+}
+#endif
+
+}
+
+void Escape::append(const string &value, const Context::Value context, string &output)
+{
+	auto emit = [&output](const char *data, const size_t size) {
+		output.append(data, size);
+	};
+
+	apply(value.data(), value.size(), context, emit);
+}
+
+string Escape::toString(const string &value, const Context::Value context)
+{
+	string result = "";
+	append(value, context, result);
+	return result;
+}
+
+size_t Escape::find(const char *data, const size_t size, const Context::Value context)
+{
+	if (context == Context::NONE) {
+		return size;
+	}
+
+	size_t position = 0;
+
+#ifdef __SSE2__
+	switch (context) {
+	case Context::TEXT:
+		position = findVector(data, size, TEXT_SPECIALS, false);
+		break;
+	case Context::ATTRIBUTE:
+		position = findVector(data, size, ATTRIBUTE_SPECIALS, false);
+		break;
+	case Context::URL:
+		position = findVector(data, size, URL_SPECIALS, true);
+		break;
+	case Context::URL_COMPONENT:
+		position = findComponentVector(data, size);
+		break;
+	case Context::NONE:
+		break;
+	}
+#endif
+
+	// Remaining bytes, or the special character where the search stopped
+	const bool *special = getTables().special[context];
+	while (position < size && special[static_cast<unsigned char>(data[position])] == false) {
+		position++;
+	}
+
+	return position;
+}
+
+Escape::Piece Escape::getReplacement(const char character, const Context::Value context)
+{
+	if (context == Context::URL_COMPONENT) {
+		// Entities would be decoded before the URL, so "&amp;" would still
+		// start another parameter
+		return Piece(getTables().percent[static_cast<unsigned char>(character)], 3);
+	}
+
+	switch (character) {
+	case '&':
+		return Piece("&amp;", 5);
+	case '<':
+		if (context != Context::URL) {
+			return Piece("&lt;", 4);
+		}
+		break;
+	case '>':
+		if (context != Context::URL) {
+			return Piece("&gt;", 4);
+		}
+		break;
+	case '"':
+		if (context != Context::URL) {
+			return Piece("&quot;", 6);
+		}
+		break;
+	case '\'':
+		if (context != Context::URL) {
+			return Piece("&#39;", 5);
+		}
+		break;
+	case '`':
+		if (context == Context::ATTRIBUTE) {
+			return Piece("&#96;", 5);
+		}
+		break;
+	case '=':
+		return Piece("&#61;", 5);
+	case ' ':
+		if (context == Context::ATTRIBUTE) {
+			return Piece("&#32;", 5);
+		}
+		break;
+	case '\t':
+		if (context == Context::ATTRIBUTE) {
+			return Piece("&#9;", 4);
+		}
+		break;
+	case '\n':
+		if (context == Context::ATTRIBUTE) {
+			return Piece("&#10;", 5);
+		}
+		break;
+	case '\r':
+		if (context == Context::ATTRIBUTE) {
+			return Piece("&#13;", 5);
+		}
+		break;
+	case '\f':
+		if (context == Context::ATTRIBUTE) {
+			return Piece("&#12;", 5);
+		}
+		break;
+	}
+
+	if (context == Context::URL) {
+		return Piece(getTables().percent[static_cast<unsigned char>(character)], 3);
+	}
+
+	return Piece("", 0);
+}
+
+bool Escape::isSafeUrl(const char *data, const size_t size)
+{
+	// Browsers ignore white spaces and control characters in the scheme
+	string scheme = "";
+	for (size_t i = 0; i < size; i++) {
+		unsigned char character = data[i];
+		if (character == ':') {
+			for (auto safeScheme: SAFE_SCHEMES) {
+				if (scheme == safeScheme) {
+					return true;
+				}
+			}
+
+			return false;
+
+		} else if (character == '/' || character == '?' || character == '#') {
+			// Relative URL
+			return true;
+
+		} else if (character > 0x20) {
+			scheme += tolower(character);
+		}
+	}
+
+	return true;
+}
+
+Escape::Scanner::Scanner() :
+	_inTag(false),
+	_inValue(false),
+	_valueStarted(false),
+	_nameEnded(false),
+	_quote('\0'),
+	_attribute("")
+{
+}
+
+void Escape::Scanner::feed(const char *data, const size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		char character = data[i];
+
+		if (_inTag == false) {
+			if (character == '<') {
+				_inTag = true;
+				_inValue = false;
+				_valueStarted = false;
+				_nameEnded = false;
+				_quote = '\0';
+				_attribute.clear();
+			}
+
+		} else if (_quote != '\0') {
+			if (character == _quote) {
+				_quote = '\0';
+				_inValue = false;
+				_nameEnded = true;
+			} else {
+				_valueStarted = true;
+			}
+
+		} else if (character == '>') {
+			_inTag = false;
+
+		} else if (character == '"' || character == '\'') {
+			_quote = character;
+
+		} else if (character == '=') {
+			_inValue = true;
+			_valueStarted = false;
+
+		} else if (isspace(static_cast<unsigned char>(character))) {
+			if (_inValue && _valueStarted) {
+				_inValue = false;
+			}
+			_nameEnded = true;
+
+		} else if (_inValue) {
+			_valueStarted = true;
+
+		} else {
+			if (_nameEnded) {
+				_attribute.clear();
+				_nameEnded = false;
+			}
+			_attribute += tolower(static_cast<unsigned char>(character));
+		}
+	}
+}
+
+Escape::Context::Value Escape::Scanner::getContext() const
+{
+	if (_inTag == false) {
+		return Context::TEXT;
+	}
+
+	if (_inValue) {
+		for (auto urlAttribute: URL_ATTRIBUTES) {
+			if (_attribute == urlAttribute) {
+				// Only the start of the value decides the scheme
+				return _valueStarted ? Context::URL_COMPONENT : Context::URL;
+			}
+		}
+	}
+
+	return Context::ATTRIBUTE;
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,220 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <cgiplus/FragmentCache.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+const size_t DEFAULT_MAX_SIZE = 16 * 1024 * 1024;
+
+typedef std::chrono::steady_clock Clock;
+
+/*! \class Entry
+ *  \brief Rendered fragment and when it expires
+ */
+class Entry
+{
+public:
+	Entry(const string &key, const std::shared_ptr<const string> &content,
+	      const Clock::time_point &expiration, const bool expires) :
+		key(key),
+		content(content),
+		expiration(expiration),
+		expires(expires)
+	{
+	}
+
+	string key;
+	std::shared_ptr<const string> content;
+	Clock::time_point expiration;
+	bool expires;
+};
+
+/*! \class Cache
+ *  \brief List of fragments ordered by use (most recent first) and an
+ *         index by key
+ */
+class Cache
+{
+public:
+	static Cache& getInstance()
+	{
+		static Cache cache;
+		return cache;
+	}
+
+	std::shared_ptr<const string> get(const string &key)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto found = _index.find(key);
+		if (found == _index.end()) {
+			return std::shared_ptr<const string>();
+		}
+
+		auto entry = found->second;
+		if (entry->expires && entry->expiration <= Clock::now()) {
+			remove(entry);
+			return std::shared_ptr<const string>();
+		}
+
+		_entries.splice(_entries.begin(), _entries, entry);
+		return entry->content;
+	}
+
+	void set(const string &key, const std::shared_ptr<const string> &content,
+	         const unsigned int ttl)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		auto found = _index.find(key);
+		if (found != _index.end()) {
+			remove(found->second);
+		}
+
+		if (content->size() > _maxSize) {
+			return;
+		}
+
+		Clock::time_point expiration = Clock::now() + std::chrono::seconds(ttl);
+		_entries.push_front(Entry(key, content, expiration, ttl > 0));
+		_index[key] = _entries.begin();
+		_size += content->size();
+
+		evict();
+	}
+
+	void setMaxSize(const size_t maxSize)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_maxSize = maxSize;
+		evict();
+	}
+
+	size_t getMaxSize()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _maxSize;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_entries.clear();
+		_index.clear();
+		_size = 0;
+	}
+
+	size_t getSize()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _size;
+	}
+
+	size_t getNumberOfFragments()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _entries.size();
+	}
+
+private:
+	Cache() :
+		_size(0),
+		_maxSize(DEFAULT_MAX_SIZE)
+	{
+		const char *maxSize = getenv("CGIPLUS_FRAGMENT_CACHE_SIZE");
+		if (maxSize != NULL) {
+			_maxSize = strtoull(maxSize, NULL, 10);
+		}
+	}
+
+	Cache(const Cache &);
+	Cache& operator=(const Cache &);
+
+	void remove(std::list<Entry>::iterator entry)
+	{
+		_size -= entry->content->size();
+		_index.erase(entry->key);
+		_entries.erase(entry);
+	}
+
+	void evict()
+	{
+		while (_size > _maxSize && _entries.empty() == false) {
+			remove(std::prev(_entries.end()));
+		}
+	}
+
+	std::mutex _mutex;
+	std::list<Entry> _entries;
+	std::unordered_map<string, std::list<Entry>::iterator> _index;
+	size_t _size;
+	size_t _maxSize;
+};
+
+}
+
+std::shared_ptr<const string> FragmentCache::get(const string &key)
+{
+	return Cache::getInstance().get(key);
+}
+
+void FragmentCache::set(const string &key, const std::shared_ptr<const string> &content,
+                        const unsigned int ttl)
+{
+	if (content) {
+		Cache::getInstance().set(key, content, ttl);
+	}
+}
+
+void FragmentCache::setMaxSize(const size_t maxSize)
+{
+	Cache::getInstance().setMaxSize(maxSize);
+}
+
+size_t FragmentCache::getMaxSize()
+{
+	return Cache::getInstance().getMaxSize();
+}
+
+void FragmentCache::clear()
+{
+	Cache::getInstance().clear();
+}
+
+size_t FragmentCache::getSize()
+{
+	return Cache::getInstance().getSize();
+}
+
+size_t FragmentCache::getNumberOfFragments()
+{
+	return Cache::getInstance().getNumberOfFragments();
+}
+
+CGIPLUS_NS_END
@@ -17,12 +17,38 @@
   along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/join.hpp>
 #include <boost/lexical_cast.hpp>
 
 #include <cgiplus/HttpHeader.hpp>
 
 CGIPLUS_NS_BEGIN
 
+namespace {
+
+const char *WEEKDAYS[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+
+const char *MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+int toMonth(const char *name)
+{
+	for (int month = 0; month < 12; month++) {
+		if (strcmp(name, MONTHS[month]) == 0) {
+			return month + 1;
+		}
+	}
+
+	return 0;
+}
+
+}
+
 string HttpHeader::EOL("\r\n");
 
 HttpHeader::HttpHeader() :
@@ -31,7 +57,10 @@ HttpHeader::HttpHeader() :
 	_location(""),
 	_contentType(MediaType::UNDEFINED),
 	_contentCharset(Charset::UNDEFINED),
-	_contentBoundary("")
+	_contentBoundary(""),
+	_contentEncoding(Encoding::UNDEFINED),
+	_entityTag(""),
+	_lastModified(boost::posix_time::not_a_date_time)
 {
 }
 
@@ -102,6 +131,17 @@ string HttpHeader::getContentBoundary() const
 	return _contentBoundary;
 }
 
+HttpHeader& HttpHeader::setContentEncoding(const Encoding::Value encoding)
+{
+	_contentEncoding = encoding;
+	return *this;
+}
+
+Encoding::Value HttpHeader::getContentEncoding() const
+{
+	return _contentEncoding;
+}
+
 HttpHeader& HttpHeader::addContentLanguage(const Language::Value language)
 {
 	_contentLanguages.insert(language);
@@ -113,6 +153,42 @@ std::set<Language::Value> HttpHeader::getContentLanguages() const
 	return _contentLanguages;
 }
 
+HttpHeader& HttpHeader::addVary(const string &field)
+{
+	if (std::find(_vary.begin(), _vary.end(), field) == _vary.end()) {
+		_vary.push_back(field);
+	}
+
+	return *this;
+}
+
+std::vector<string> HttpHeader::getVary() const
+{
+	return _vary;
+}
+
+HttpHeader& HttpHeader::setEntityTag(const string &entityTag)
+{
+	_entityTag = entityTag;
+	return *this;
+}
+
+string HttpHeader::getEntityTag() const
+{
+	return _entityTag;
+}
+
+HttpHeader& HttpHeader::setLastModified(const boost::posix_time::ptime &lastModified)
+{
+	_lastModified = lastModified;
+	return *this;
+}
+
+boost::posix_time::ptime HttpHeader::getLastModified() const
+{
+	return _lastModified;
+}
+
 HttpHeader& HttpHeader::addAccept(const MediaType::Value accept)
 {
 	_accepts.insert(accept);
@@ -195,7 +271,11 @@ HttpHeader& HttpHeader::clear()
 	_contentType = MediaType::UNDEFINED;
 	_contentCharset = Charset::UNDEFINED;
 	_contentBoundary.clear();
+	_contentEncoding = Encoding::UNDEFINED;
 	_contentLanguages.clear();
+	_vary.clear();
+	_entityTag.clear();
+	_lastModified = boost::posix_time::not_a_date_time;
 	_accepts.clear();
 	_acceptLanguages.clear();
 	_acceptCharsets.clear();
@@ -230,6 +310,10 @@ string HttpHeader::toString(const unsigned int contentSize) const
 		header += EOL;
 	}
 	
+	if (_contentEncoding != Encoding::UNDEFINED) {
+		header += "Content-Encoding: " + Encoding::toString(_contentEncoding) + EOL;
+	}
+
 	if (contentSize > 0) {
 		header += "Content-Length: " + 
 			boost::lexical_cast<string>(contentSize) + EOL;
@@ -243,6 +327,18 @@ string HttpHeader::toString(const unsigned int contentSize) const
 		header = header.substr(0, header.size() - 1) + EOL;
 	}
 
+	if (_vary.empty() == false) {
+		header += "Vary: " + boost::algorithm::join(_vary, ", ") + EOL;
+	}
+
+	if (_entityTag.empty() == false) {
+		header += "ETag: " + _entityTag + EOL;
+	}
+
+	if (_lastModified.is_special() == false) {
+		header += "Last-Modified: " + formatDate(_lastModified) + EOL;
+	}
+
 	if (_accepts.empty() == false) {
 		header += "Accept: ";
 		for (MediaType::Value accept : _accepts) {
@@ -276,4 +372,83 @@ string HttpHeader::toString(const unsigned int contentSize) const
 	return header;
 }
 
+string HttpHeader::formatDate(const boost::posix_time::ptime &time)
+{
+	if (time.is_special()) {
+		return "";
+	}
+
+	boost::gregorian::date date = time.date();
+	boost::posix_time::time_duration timeOfDay = time.time_of_day();
+
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+	         WEEKDAYS[date.day_of_week().as_number()], static_cast<int>(date.day()),
+	         MONTHS[date.month() - 1], static_cast<int>(date.year()),
+	         static_cast<int>(timeOfDay.hours()), static_cast<int>(timeOfDay.minutes()),
+	         static_cast<int>(timeOfDay.seconds()));
+
+	return buffer;
+}
+
+boost::posix_time::ptime HttpHeader::parseDate(const string &date)
+{
+	char weekday[16], month[4];
+	int day = 0, year = 0, hours = 0, minutes = 0, seconds = 0;
+
+	// Sun, 06 Nov 1994 08:49:37 GMT
+	bool parsed = sscanf(date.c_str(), "%15[A-Za-z], %d %3s %d %d:%d:%d GMT",
+	                     weekday, &day, month, &year, &hours, &minutes, &seconds) == 7;
+
+	// Sunday, 06-Nov-94 08:49:37 GMT
+	if (parsed == false &&
+	    sscanf(date.c_str(), "%15[A-Za-z], %d-%3s-%d %d:%d:%d GMT",
+	           weekday, &day, month, &year, &hours, &minutes, &seconds) == 7) {
+		year += (year < 70 ? 2000 : (year < 100 ? 1900 : 0));
+		parsed = true;
+	}
+
+	// Sun Nov  6 08:49:37 1994
+	if (parsed == false) {
+		parsed = sscanf(date.c_str(), "%15[A-Za-z] %3s %d %d:%d:%d %d",
+		                weekday, month, &day, &hours, &minutes, &seconds, &year) == 7;
+	}
+
+	int monthNumber = parsed ? toMonth(month) : 0;
+	if (monthNumber == 0 || year < 1400 || year > 9999 || day < 1 ||
+	    day > boost::gregorian::gregorian_calendar::end_of_month_day(year, monthNumber) ||
+	    hours < 0 || hours > 23 || minutes < 0 || minutes > 59 || seconds < 0 || seconds > 60) {
+		return boost::posix_time::ptime(boost::posix_time::not_a_date_time);
+	}
+
+	return boost::posix_time::ptime(boost::gregorian::date(year, monthNumber, day),
+	                                boost::posix_time::time_duration(hours, minutes, seconds));
+}
+
+HttpHeader::Method::Value HttpHeader::parseMethod(const string &method)
+{
+	string name = boost::to_upper_copy(method);
+	if (name == "CONNECT") {
+		return Method::CONNECT;
+	} else if (name == "DELETE") {
+		return Method::DELETE;
+	} else if (name == "HEAD") {
+		return Method::HEAD;
+	} else if (name == "GET") {
+		return Method::GET;
+	} else if (name == "OPTIONS") {
+		return Method::OPTIONS;
+	} else if (name == "PATCH") {
+		return Method::PATCH;
+	} else if (name == "POST") {
+		return Method::POST;
+	} else if (name == "PUT") {
+		return Method::PUT;
+	} else if (name == "TRACE") {
+		return Method::TRACE;
+	}
+
+	return Method::UNDEFINED;
+}
+
 CGIPLUS_NS_END
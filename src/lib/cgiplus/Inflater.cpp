@@ -0,0 +1,137 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include <cgiplus/Inflater.hpp>
+
+CGIPLUS_NS_BEGIN
+
+// Automatic detection of zlib and gzip headers
+static const int AUTO_WINDOW_BITS = 15 + 32;
+
+// Deflate data without any header (some clients send "deflate" like this)
+static const int RAW_WINDOW_BITS = -15;
+
+Inflater::Inflater(const Encoding::Value encoding, const size_t limit) :
+	_encoding(encoding),
+	_limit(limit),
+	_initialized(false),
+	_finished(false),
+	_failed(false)
+{
+	_failed = (initialize(AUTO_WINDOW_BITS) == false);
+}
+
+Inflater::~Inflater()
+{
+	if (_initialized) {
+		inflateEnd(&_stream);
+	}
+}
+
+bool Inflater::inflate(const char *data, const size_t size, string &output)
+{
+	if (_failed) {
+		return false;
+	}
+
+	// Anything after the end of the compressed stream is ignored
+	if (_finished) {
+		return true;
+	}
+
+	bool firstChunk = (_stream.total_in == 0);
+
+	_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	_stream.avail_in = size;
+
+	char chunk[16384];
+
+	do {
+		_stream.next_out = reinterpret_cast<Bytef*>(chunk);
+		_stream.avail_out = sizeof(chunk);
+
+		int result = ::inflate(&_stream, Z_NO_FLUSH);
+
+		if (result == Z_DATA_ERROR && firstChunk && _stream.total_out == 0 &&
+		    _encoding == Encoding::DEFLATE) {
+			// Not a zlib stream, try again with raw deflate
+			inflateEnd(&_stream);
+			_initialized = false;
+			_encoding = Encoding::UNDEFINED;
+
+			if (initialize(RAW_WINDOW_BITS) == false) {
+				_failed = true;
+				return false;
+			}
+
+			return inflate(data, size, output);
+		}
+
+		if (result == Z_BUF_ERROR) {
+			// No progress possible, waiting for more input
+			break;
+		}
+
+		if (result != Z_OK && result != Z_STREAM_END) {
+			_failed = true;
+			return false;
+		}
+
+		size_t produced = sizeof(chunk) - _stream.avail_out;
+		if (_stream.total_out > _limit) {
+			_failed = true;
+			return false;
+		}
+
+		output.append(chunk, produced);
+
+		if (result == Z_STREAM_END) {
+			_finished = true;
+			break;
+		}
+
+		// A full output chunk means that zlib could have more data pending
+	} while (_stream.avail_in > 0 || _stream.avail_out == 0);
+
+	return true;
+}
+
+bool Inflater::isFinished() const
+{
+	return _finished;
+}
+
+bool Inflater::initialize(const int windowBits)
+{
+	memset(&_stream, 0, sizeof(_stream));
+	_stream.zalloc = Z_NULL;
+	_stream.zfree = Z_NULL;
+	_stream.opaque = Z_NULL;
+
+	if (inflateInit2(&_stream, windowBits) != Z_OK) {
+		return false;
+	}
+
+	_initialized = true;
+	return true;
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,299 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cgiplus/MultipartParser.hpp>
+
+CGIPLUS_NS_BEGIN
+
+// Protection against endless part headers
+static const size_t MAX_HEADERS_SIZE = 16384;
+
+MultipartParser::MultipartParser(const string &boundary,
+                                 const Settings &settings,
+                                 const string &directory,
+                                 const size_t expectedSize) :
+	_delimiter("\n--" + boundary),
+	_settings(settings),
+	_directory(directory),
+	_spool(std::make_shared<Spool>(settings.getSpool())),
+	_expectedSize(expectedSize),
+	_state(State::PREAMBLE),
+	_buffer("\n"),
+	_position(0),
+	_headersSize(0),
+	_partIsFile(false)
+{
+	// According to RFC 2046 the line break before each delimiter belongs
+	// to the delimiter. The first delimiter can be in the beginning of
+	// the body, so we start with a line break in the buffer to find all
+	// delimiters in the same way
+}
+
+void MultipartParser::feed(const char *data, const size_t size)
+{
+	if (_state == State::EPILOGUE) {
+		return;
+	}
+
+	_buffer.append(data, size);
+
+	bool progress = true;
+	while (progress) {
+		switch (_state) {
+		case State::PREAMBLE:
+			progress = parsePreamble();
+			break;
+		case State::DELIMITER:
+			progress = parseDelimiter();
+			break;
+		case State::HEADERS:
+			progress = parseHeaders();
+			break;
+		case State::BODY:
+			progress = parseBody();
+			break;
+		case State::EPILOGUE:
+			progress = false;
+			break;
+		}
+	}
+
+	if (_state == State::EPILOGUE) {
+		_buffer.clear();
+	} else {
+		_buffer.erase(0, _position);
+	}
+
+	_position = 0;
+}
+
+void MultipartParser::setFileCallback(const std::function<void(UploadedFile&)> &callback)
+{
+	_fileCallback = callback;
+}
+
+void MultipartParser::finish()
+{
+	if (_state == State::BODY && _partIsFile) {
+		// Incomplete file, the close delimiter was not found
+		_part.remove();
+	}
+
+	_state = State::EPILOGUE;
+	_buffer.clear();
+	_position = 0;
+}
+
+void MultipartParser::discard()
+{
+	finish();
+
+	for (auto file: _files) {
+		file.remove();
+	}
+
+	_fields.clear();
+	_files.clear();
+}
+
+std::vector<std::pair<string, string>> const& MultipartParser::getFields() const
+{
+	return _fields;
+}
+
+std::vector<UploadedFile> const& MultipartParser::getFiles() const
+{
+	return _files;
+}
+
+bool MultipartParser::parsePreamble()
+{
+	size_t found = _buffer.find(_delimiter, _position);
+	if (found == string::npos) {
+		// Keep only what could be the beginning of a delimiter
+		if (_buffer.size() - _position > _delimiter.size()) {
+			_position = _buffer.size() - _delimiter.size();
+		}
+		return false;
+	}
+
+	_position = found + _delimiter.size();
+	_state = State::DELIMITER;
+	return true;
+}
+
+bool MultipartParser::parseDelimiter()
+{
+	if (_buffer.size() - _position < 2) {
+		return false;
+	}
+
+	// Close delimiter
+	if (_buffer.compare(_position, 2, "--") == 0) {
+		_state = State::EPILOGUE;
+		return false;
+	}
+
+	// Ignore transport padding until the end of the line
+	size_t found = _buffer.find('\n', _position);
+	if (found == string::npos) {
+		if (_buffer.size() - _position > MAX_HEADERS_SIZE) {
+			_state = State::EPILOGUE;
+		}
+		return false;
+	}
+
+	_position = found + 1;
+	_state = State::HEADERS;
+	_headersSize = 0;
+
+	Digest::Algorithm::Value digest = _settings.getUploadDigest();
+	if (digest == Digest::Algorithm::NONE && _settings.getContentStore().isEnabled()) {
+		digest = Digest::Algorithm::SHA256;
+	}
+
+	_part = UploadedFile();
+	_part.setDigestAlgorithm(digest)
+		.setMemoryLimit(_settings.getUploadMemoryLimit())
+		.setCleanup(_settings.getUploadCleanup())
+		.setContentStore(_settings.getContentStore());
+
+	if (_directory.empty()) {
+		_part.setSpool(_spool, _expectedSize);
+	} else {
+		_part.setDirectory(_directory);
+	}
+	return true;
+}
+
+bool MultipartParser::parseHeaders()
+{
+	size_t found = _buffer.find('\n', _position);
+	if (found == string::npos) {
+		if (_headersSize + _buffer.size() - _position > MAX_HEADERS_SIZE) {
+			_state = State::EPILOGUE;
+		}
+		return false;
+	}
+
+	size_t end = found;
+	if (end > _position && _buffer[end - 1] == '\r') {
+		end--;
+	}
+
+	_headersSize += found + 1 - _position;
+	if (_headersSize > MAX_HEADERS_SIZE) {
+		_state = State::EPILOGUE;
+		return false;
+	}
+
+	if (end == _position) {
+		// Empty line, the payload starts after it
+		_position = found + 1;
+		beginPart();
+		return true;
+	}
+
+	_part.parseContentHeader(_buffer.substr(_position, end - _position));
+	_position = found + 1;
+	return true;
+}
+
+bool MultipartParser::parseBody()
+{
+	size_t found = _buffer.find(_delimiter, _position);
+	if (found == string::npos) {
+		// The end of the buffer could be the beginning of the delimiter
+		// (with a carriage return before it), so we keep it for later
+		if (_buffer.size() - _position > _delimiter.size()) {
+			size_t end = _buffer.size() - _delimiter.size();
+			appendPart(_buffer.data() + _position, end - _position);
+			_position = end;
+		}
+		return false;
+	}
+
+	size_t end = found;
+	if (end > _position && _buffer[end - 1] == '\r') {
+		end--;
+	}
+
+	appendPart(_buffer.data() + _position, end - _position);
+	endPart();
+
+	_position = found + _delimiter.size();
+	_state = State::DELIMITER;
+	return true;
+}
+
+void MultipartParser::beginPart()
+{
+	_state = State::BODY;
+	_partValue.clear();
+	_partIsFile = false;
+
+	if (_part.getClientFilename().empty() == false) {
+		_partIsFile = _part.open();
+	}
+}
+
+void MultipartParser::appendPart(const char *data, const size_t size)
+{
+	if (size == 0) {
+		return;
+	}
+
+	if (_partIsFile) {
+		_part.write(data, size);
+		return;
+	}
+
+	_partValue.append(data, size);
+
+	// Big fields are moved to a file
+	if (_partValue.size() > _settings.getMaxFieldSize() && _part.open()) {
+		_partIsFile = true;
+		_part.write(_partValue.data(), _partValue.size());
+		_partValue.clear();
+	}
+}
+
+void MultipartParser::endPart()
+{
+	if (_partIsFile) {
+		_part.close();
+
+		if (_part.getControlName().empty()) {
+			_part.remove();
+		} else {
+			_files.push_back(_part);
+			if (_fileCallback) {
+				_fileCallback(_files.back());
+			}
+		}
+
+	} else if (_part.getControlName().empty() == false) {
+		_fields.push_back(std::make_pair(_part.getControlName(), _partValue));
+	}
+
+	_partIsFile = false;
+	_partValue.clear();
+}
+
+CGIPLUS_NS_END
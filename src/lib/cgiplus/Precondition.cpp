@@ -0,0 +1,173 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdlib>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <cgiplus/EntityTag.hpp>
+#include <cgiplus/Precondition.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+bool isSafe(const HttpHeader::Method::Value method)
+{
+	return method == HttpHeader::Method::GET || method == HttpHeader::Method::HEAD;
+}
+
+}
+
+Precondition::Precondition() :
+	_method(HttpHeader::Method::UNDEFINED),
+	_ifMatch(""),
+	_ifNoneMatch("")
+{
+}
+
+Precondition& Precondition::setMethod(const HttpHeader::Method::Value method)
+{
+	_method = method;
+	return *this;
+}
+
+HttpHeader::Method::Value Precondition::getMethod() const
+{
+	return _method;
+}
+
+Precondition& Precondition::setIfMatch(const string &ifMatch)
+{
+	_ifMatch = boost::trim_copy(ifMatch);
+	return *this;
+}
+
+string Precondition::getIfMatch() const
+{
+	return _ifMatch;
+}
+
+Precondition& Precondition::setIfNoneMatch(const string &ifNoneMatch)
+{
+	_ifNoneMatch = boost::trim_copy(ifNoneMatch);
+	return *this;
+}
+
+string Precondition::getIfNoneMatch() const
+{
+	return _ifNoneMatch;
+}
+
+Precondition&
+Precondition::setIfModifiedSince(const boost::posix_time::ptime &ifModifiedSince)
+{
+	_ifModifiedSince = ifModifiedSince;
+	return *this;
+}
+
+boost::posix_time::ptime Precondition::getIfModifiedSince() const
+{
+	return _ifModifiedSince;
+}
+
+Precondition& Precondition::readEnvironment()
+{
+	clear();
+
+	const char *methodPtr = getenv("REQUEST_METHOD");
+	if (methodPtr != NULL) {
+		setMethod(HttpHeader::parseMethod(methodPtr));
+	}
+
+	const char *ifMatchPtr = getenv("HTTP_IF_MATCH");
+	if (ifMatchPtr != NULL) {
+		setIfMatch(ifMatchPtr);
+	}
+
+	const char *ifNoneMatchPtr = getenv("HTTP_IF_NONE_MATCH");
+	if (ifNoneMatchPtr != NULL) {
+		setIfNoneMatch(ifNoneMatchPtr);
+	}
+
+	// Invalid dates are ignored (RFC 7232 - Section 3.3)
+	const char *ifModifiedSincePtr = getenv("HTTP_IF_MODIFIED_SINCE");
+	if (ifModifiedSincePtr != NULL) {
+		setIfModifiedSince(HttpHeader::parseDate(ifModifiedSincePtr));
+	}
+
+	return *this;
+}
+
+bool Precondition::isEmpty() const
+{
+	return _ifMatch.empty() && _ifNoneMatch.empty() && _ifModifiedSince.is_not_a_date_time();
+}
+
+HttpHeader::Status::Value
+Precondition::evaluate(const string &entityTag,
+                       const boost::posix_time::ptime &lastModified) const
+{
+	// Without validators there's no current representation, "*" asks
+	// only if there's one
+	bool exists = entityTag.empty() == false || lastModified.is_not_a_date_time() == false;
+
+	if (_ifMatch.empty() == false) {
+		if (_ifMatch == "*" ? exists == false :
+		    EntityTag::match(_ifMatch, entityTag, EntityTag::Comparison::STRONG) == false) {
+			return HttpHeader::Status::PRECONDITION_FAILED;
+		}
+	}
+
+	if (_ifNoneMatch.empty() == false) {
+		if ((_ifNoneMatch == "*" && exists) ||
+		    EntityTag::match(_ifNoneMatch, entityTag, EntityTag::Comparison::WEAK)) {
+			return isSafe(_method) ? HttpHeader::Status::NOT_MODIFIED :
+				HttpHeader::Status::PRECONDITION_FAILED;
+		}
+
+		// If-Modified-Since is ignored when If-None-Match is sent
+		return HttpHeader::Status::UNDEFINED;
+	}
+
+	if (isSafe(_method) && _ifModifiedSince.is_not_a_date_time() == false &&
+	    lastModified.is_not_a_date_time() == false) {
+		// HTTP dates have only seconds
+		boost::posix_time::ptime modified(lastModified.date(), boost::posix_time::seconds(
+			lastModified.time_of_day().total_seconds()));
+
+		if (modified <= _ifModifiedSince) {
+			return HttpHeader::Status::NOT_MODIFIED;
+		}
+	}
+
+	return HttpHeader::Status::UNDEFINED;
+}
+
+Precondition& Precondition::clear()
+{
+	_method = HttpHeader::Method::UNDEFINED;
+	_ifMatch.clear();
+	_ifNoneMatch.clear();
+	_ifModifiedSince = boost::posix_time::not_a_date_time;
+	return *this;
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,324 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+
+#include <boost/lexical_cast.hpp>
+
+#include <cgiplus/Digest.hpp>
+#include <cgiplus/Progress.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+// Number of uploads that can be tracked at the same time and how many
+// slots are checked for each token
+const unsigned int NUMBER_OF_SLOTS = 4096;
+const unsigned int NUMBER_OF_PROBES = 32;
+
+// Finished uploads are kept for a while, so the last query of the
+// client still finds them
+const time_t EXPIRATION = 60;
+
+// Times a query reads a slot that changed while it was read
+const unsigned int NUMBER_OF_QUERY_ATTEMPTS = 4;
+
+// A slot being filled has the pid of its process in the lower bits of
+// the key, so a claim left by a process that died can be taken
+const uint64_t EMPTY_KEY = 0;
+const uint64_t CLAIMING_KEY = 0xFFFFFFFF00000000ULL;
+
+bool isClaiming(const uint64_t key)
+{
+	return (key & CLAIMING_KEY) == CLAIMING_KEY;
+}
+
+bool isDead(const pid_t pid)
+{
+	return (kill(pid, 0) == -1 && errno == ESRCH);
+}
+
+// Only lock-free atomics can be shared between processes
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "64 bits atomic operations must be lock-free");
+
+struct Slot
+{
+	std::atomic<uint64_t> key;
+	std::atomic<uint64_t> received;
+	std::atomic<uint64_t> expected;
+	std::atomic<int64_t> updated;
+	std::atomic<uint32_t> state;
+	std::atomic<uint32_t> pid;
+	char padding[24];
+};
+
+static_assert(sizeof(Slot) == 64, "each slot must use one cache line");
+
+Slot* getSegment()
+{
+	// Mapped only once per process, when the first upload is tracked
+	static Slot *segment = []() -> Slot* {
+		string name = "/cgiplus-progress-" + boost::lexical_cast<string>(getuid());
+		size_t size = NUMBER_OF_SLOTS * sizeof(Slot);
+
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+		if (fd == -1) {
+			return NULL;
+		}
+
+		// New segments are filled with zeros (empty slots)
+		struct stat info;
+		if (fstat(fd, &info) == -1 ||
+		    (static_cast<size_t>(info.st_size) < size && ftruncate(fd, size) == -1)) {
+			close(fd);
+			return NULL;
+		}
+
+		void *address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (address == MAP_FAILED) {
+			return NULL;
+		}
+
+		return static_cast<Slot*>(address);
+	}();
+
+	return segment;
+}
+
+uint64_t calculateKey(const string &token)
+{
+	string digest = Digest::calculate(Digest::Algorithm::XXHASH64, token);
+	uint64_t key = strtoull(digest.c_str(), NULL, 16);
+
+	if (key == EMPTY_KEY || isClaiming(key)) {
+		key = 1;
+	}
+
+	return key;
+}
+
+bool isExpired(const Slot &slot)
+{
+	uint32_t state = slot.state.load();
+	if (state == Progress::State::RECEIVING) {
+		// The upload process died without finishing
+		return isDead(static_cast<pid_t>(slot.pid.load()));
+	}
+
+	return (time(NULL) - slot.updated.load() > EXPIRATION);
+}
+
+Slot* findSlot(const uint64_t key)
+{
+	Slot *segment = getSegment();
+	if (segment == NULL) {
+		return NULL;
+	}
+
+	for (unsigned int probe = 0; probe < NUMBER_OF_PROBES; probe++) {
+		Slot &slot = segment[(key + probe) % NUMBER_OF_SLOTS];
+		if (slot.key.load() == key) {
+			return &slot;
+		}
+	}
+
+	return NULL;
+}
+
+Slot* claimSlot(const uint64_t key)
+{
+	Slot *segment = getSegment();
+	if (segment == NULL) {
+		return NULL;
+	}
+
+	for (unsigned int probe = 0; probe < NUMBER_OF_PROBES; probe++) {
+		Slot &slot = segment[(key + probe) % NUMBER_OF_SLOTS];
+
+		uint64_t current = slot.key.load();
+		if (isClaiming(current)) {
+			// Another process is filling the slot, unless it died
+			// before publishing the key
+			if (isDead(static_cast<pid_t>(current & ~CLAIMING_KEY)) == false) {
+				continue;
+			}
+
+		} else if (current != key && current != EMPTY_KEY && isExpired(slot) == false) {
+			// Not the same token again (client retry), nor a free slot
+			continue;
+		}
+
+		// While the slot is being filled the readers don't find it
+		uint64_t claim = CLAIMING_KEY | static_cast<uint32_t>(getpid());
+		if (slot.key.compare_exchange_strong(current, claim)) {
+			return &slot;
+		}
+	}
+
+	return NULL;
+}
+
+}
+
+string Progress::State::toString(const Value value)
+{
+	switch (value) {
+	case UNKNOWN:
+		return "unknown";
+	case RECEIVING:
+		return "receiving";
+	case FINISHED:
+		return "finished";
+	case FAILED:
+		return "failed";
+	}
+
+	return "";
+}
+
+Progress::Progress() :
+	_token(""),
+	_received(0),
+	_expected(0),
+	_state(State::UNKNOWN),
+	_slot(NULL)
+{
+}
+
+bool Progress::start(const string &token, const uint64_t expected)
+{
+	_token = token;
+	_received = 0;
+	_expected = expected;
+	_state = State::RECEIVING;
+
+	uint64_t key = calculateKey(token);
+
+	Slot *slot = claimSlot(key);
+	if (slot == NULL) {
+		_slot = NULL;
+		return false;
+	}
+
+	slot->received.store(0);
+	slot->expected.store(expected);
+	slot->updated.store(time(NULL));
+	slot->pid.store(static_cast<uint32_t>(getpid()));
+	slot->state.store(State::RECEIVING);
+	slot->key.store(key);
+
+	_slot = slot;
+	return true;
+}
+
+void Progress::update(const uint64_t received)
+{
+	_received = received;
+
+	if (_slot == NULL) {
+		return;
+	}
+
+	Slot *slot = static_cast<Slot*>(_slot);
+	slot->received.store(received, std::memory_order_relaxed);
+	slot->updated.store(time(NULL), std::memory_order_relaxed);
+}
+
+void Progress::finish(const bool success)
+{
+	_state = (success ? State::FINISHED : State::FAILED);
+
+	if (_slot == NULL) {
+		return;
+	}
+
+	Slot *slot = static_cast<Slot*>(_slot);
+	slot->updated.store(time(NULL));
+	slot->state.store(_state);
+	_slot = NULL;
+}
+
+Progress Progress::query(const string &token)
+{
+	Progress progress;
+	progress._token = token;
+
+	uint64_t key = calculateKey(token);
+
+	for (unsigned int attempt = 0; attempt < NUMBER_OF_QUERY_ATTEMPTS; attempt++) {
+		Slot *slot = findSlot(key);
+		if (slot == NULL) {
+			return progress;
+		}
+
+		uint64_t received = slot->received.load();
+		uint64_t expected = slot->expected.load();
+		uint32_t state = slot->state.load();
+
+		// An expired slot can be claimed by another upload while it is
+		// read. The key changes before the fields, so when it is the
+		// same after reading them, they belong to this upload
+		if (slot->key.load() == key) {
+			progress._received = received;
+			progress._expected = expected;
+			progress._state = static_cast<State::Value>(state);
+			return progress;
+		}
+	}
+
+	return progress;
+}
+
+string Progress::getToken() const
+{
+	return _token;
+}
+
+uint64_t Progress::getReceived() const
+{
+	return _received;
+}
+
+uint64_t Progress::getExpected() const
+{
+	return _expected;
+}
+
+Progress::State::Value Progress::getState() const
+{
+	return _state;
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,175 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <thread>
+
+#include <cgiplus/ReadPipeline.hpp>
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+/*! Stops and joins the reader thread when the consumer returns or
+ * throws, a thread destroyed while joinable terminates the process
+ */
+class ReaderGuard
+{
+public:
+	ReaderGuard(std::thread &thread, const std::function<void()> &stop) :
+		_thread(thread),
+		_stop(stop)
+	{
+	}
+
+	~ReaderGuard()
+	{
+		_stop();
+		_thread.join();
+	}
+
+private:
+	ReaderGuard(const ReaderGuard &);
+	ReaderGuard& operator=(const ReaderGuard &);
+
+	std::thread &_thread;
+	std::function<void()> _stop;
+};
+
+}
+
+ReadPipeline::ReadPipeline(const unsigned int buffers, const size_t bufferSize) :
+	_buffers(std::max(2u, buffers), std::vector<char>(bufferSize == 0 ? 1 : bufferSize)),
+	_sizes(std::max(2u, buffers), 0),
+	_bufferSize(bufferSize == 0 ? 1 : bufferSize),
+	_head(0),
+	_filled(0),
+	_finished(false),
+	_failed(false),
+	_stopping(false)
+{
+}
+
+bool ReadPipeline::run(const size_t size, const Reader &reader, const Consumer &consumer)
+{
+	_head = 0;
+	_filled = 0;
+	_finished = false;
+	_failed = false;
+	_stopping = false;
+
+	std::thread readerThread(&ReadPipeline::read, this, size, reader);
+	ReaderGuard guard(readerThread, [this]() {
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_stopping = true;
+			}
+
+			_notFull.notify_one();
+		});
+
+	bool success = true;
+
+	while (true) {
+		unsigned int current = 0;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (_filled == 0 && _finished == false) {
+				_notEmpty.wait(lock);
+			}
+
+			if (_filled == 0) {
+				success = (_failed == false);
+				break;
+			}
+
+			current = _head;
+		}
+
+		// The buffer belongs to the consumer until it is released
+		bool consumed = consumer(_buffers[current].data(), _sizes[current]);
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_head = (_head + 1) % _buffers.size();
+			_filled--;
+
+			if (consumed == false) {
+				_stopping = true;
+			}
+		}
+
+		_notFull.notify_one();
+
+		if (consumed == false) {
+			success = false;
+			break;
+		}
+	}
+
+	return success;
+}
+
+void ReadPipeline::read(const size_t size, const Reader &reader)
+{
+	size_t remaining = size;
+	unsigned int tail = 0;
+	bool failed = false;
+
+	while (remaining > 0) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (_filled == _buffers.size() && _stopping == false) {
+				_notFull.wait(lock);
+			}
+
+			if (_stopping) {
+				break;
+			}
+		}
+
+		size_t chunkSize = std::min(remaining, _bufferSize);
+		if (reader(_buffers[tail].data(), chunkSize) == false) {
+			failed = true;
+			break;
+		}
+
+		_sizes[tail] = chunkSize;
+		remaining -= chunkSize;
+		tail = (tail + 1) % _buffers.size();
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_filled++;
+		}
+
+		_notEmpty.notify_one();
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_finished = true;
+		_failed = failed;
+	}
+
+	_notEmpty.notify_one();
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,268 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+
+#include <cgiplus/Replay.hpp>
+
+extern char **environ;
+
+CGIPLUS_NS_BEGIN
+
+namespace {
+
+// Variable that enables the capture in the Settings of each request
+const char *CAPTURE_FILE_VARIABLE = "CGIPLUS_CAPTURE_FILE";
+
+/*! \class NullBuffer
+ *  \brief Output buffer that discards everything
+ */
+class NullBuffer : public std::streambuf
+{
+protected:
+	int overflow(int character)
+	{
+		return traits_type::not_eof(character);
+	}
+
+	std::streamsize xsputn(const char *, std::streamsize size)
+	{
+		return size;
+	}
+};
+
+Capture::Request::Environment getRequestVariables()
+{
+	Capture::Request::Environment variables;
+
+	for (char **variable = environ; *variable != NULL; variable++) {
+		string entry = *variable;
+
+		size_t separator = entry.find('=');
+		if (separator == string::npos) {
+			continue;
+		}
+
+		string name = entry.substr(0, separator);
+		if (Capture::isRequestVariable(name)) {
+			variables.push_back(std::make_pair(name, entry.substr(separator + 1)));
+		}
+	}
+
+	return variables;
+}
+
+void setRequestVariables(const Capture::Request::Environment &variables)
+{
+	// The environment can't change while it is iterated
+	for (auto variable: getRequestVariables()) {
+		unsetenv(variable.first.c_str());
+	}
+
+	for (auto variable: variables) {
+		setenv(variable.first.c_str(), variable.second.c_str(), 1);
+	}
+}
+
+/*! \class Redirection
+ *  \brief Restores the request environment and the standard streams,
+ *         even when the handler throws
+ */
+class Redirection
+{
+public:
+	Redirection() :
+		_environment(getRequestVariables()),
+		_captureFile(""),
+		_capturing(false),
+		_input(std::cin.rdbuf()),
+		_output(NULL),
+		_outputFd(-1)
+	{
+		// Replayed requests must not be captured again, the log would
+		// grow while it is replayed
+		const char *captureFilePtr = getenv(CAPTURE_FILE_VARIABLE);
+		if (captureFilePtr != NULL) {
+			_captureFile = captureFilePtr;
+			_capturing = true;
+			unsetenv(CAPTURE_FILE_VARIABLE);
+		}
+
+		// Output written before the replay goes to the original place
+		std::cout.flush();
+		fflush(stdout);
+		_output = std::cout.rdbuf(&_discard);
+
+		// Builder::show writes directly to the descriptor
+		int nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		if (nullFd != -1) {
+			_outputFd = dup(STDOUT_FILENO);
+			dup2(nullFd, STDOUT_FILENO);
+			close(nullFd);
+		}
+	}
+
+	~Redirection()
+	{
+		// Output of the handlers is discarded too
+		std::cout.flush();
+		fflush(stdout);
+
+		std::cin.rdbuf(_input);
+		std::cin.clear();
+		std::cout.rdbuf(_output);
+
+		if (_outputFd != -1) {
+			dup2(_outputFd, STDOUT_FILENO);
+			close(_outputFd);
+		}
+
+		setRequestVariables(_environment);
+
+		if (_capturing) {
+			setenv(CAPTURE_FILE_VARIABLE, _captureFile.c_str(), 1);
+		}
+	}
+
+	void prepare(const Capture::Request &request)
+	{
+		setRequestVariables(request.getEnvironment());
+
+		_body.str(request.getBody());
+		std::cin.rdbuf(&_body);
+		std::cin.clear();
+	}
+
+private:
+	Redirection(const Redirection &);
+	Redirection& operator=(const Redirection &);
+
+	Capture::Request::Environment _environment;
+	string _captureFile;
+	bool _capturing;
+	NullBuffer _discard;
+	std::stringbuf _body;
+	std::streambuf *_input;
+	std::streambuf *_output;
+	int _outputFd;
+};
+
+}
+
+Replay::Statistics::Statistics() :
+	_total(0)
+{
+}
+
+void Replay::Statistics::add(const uint64_t duration)
+{
+	_durations.push_back(duration);
+	_total += duration;
+}
+
+size_t Replay::Statistics::getRequests() const
+{
+	return _durations.size();
+}
+
+uint64_t Replay::Statistics::getTotal() const
+{
+	return _total;
+}
+
+uint64_t Replay::Statistics::getMean() const
+{
+	if (_durations.empty()) {
+		return 0;
+	}
+
+	return _total / _durations.size();
+}
+
+uint64_t Replay::Statistics::getPercentile(const double percentile) const
+{
+	if (_durations.empty()) {
+		return 0;
+	}
+
+	std::vector<uint64_t> durations = _durations;
+	std::sort(durations.begin(), durations.end());
+
+	// Nearest rank
+	double rank = std::ceil(std::min(100.0, std::max(0.0, percentile)) / 100.0 *
+	                        durations.size());
+	size_t position = (rank < 1.0 ? 0 : static_cast<size_t>(rank) - 1);
+	return durations[position];
+}
+
+Replay::Replay()
+{
+}
+
+bool Replay::load(const string &file)
+{
+	return Capture::load(file, _requests);
+}
+
+Replay& Replay::add(const Capture::Request &request)
+{
+	_requests.push_back(request);
+	return *this;
+}
+
+size_t Replay::getNumberOfRequests() const
+{
+	return _requests.size();
+}
+
+Replay::Statistics Replay::run(const Handler &handler, const unsigned int iterations) const
+{
+	Statistics statistics;
+	Redirection redirection;
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		for (auto &request: _requests) {
+			// Preparing the request is not part of the handler time
+			redirection.prepare(request);
+
+			auto start = std::chrono::steady_clock::now();
+			handler();
+			auto end = std::chrono::steady_clock::now();
+
+			statistics.add(std::chrono::duration_cast<std::chrono::nanoseconds>
+			               (end - start).count());
+		}
+	}
+
+	return statistics;
+}
+
+CGIPLUS_NS_END
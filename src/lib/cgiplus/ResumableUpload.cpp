@@ -0,0 +1,369 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+}
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cgiplus/ResumableUpload.hpp>
+
+CGIPLUS_NS_BEGIN
+
+// Protection against huge ids in file names
+static const size_t MAX_ID_SIZE = 128;
+
+namespace {
+
+bool syncDirectory(const string &directory)
+{
+	int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd == -1) {
+		return false;
+	}
+
+	bool success = (fsync(fd) == 0);
+	close(fd);
+	return success;
+}
+
+}
+
+/*! \class ResumableUpload::Handle
+ *  \brief Partial file opened (and locked) while a chunk is received
+ */
+class ResumableUpload::Handle
+{
+public:
+	Handle() :
+		fd(-1),
+		position(0)
+	{
+	}
+
+	~Handle()
+	{
+		if (fd != -1) {
+			// Closing also releases the lock
+			::close(fd);
+		}
+	}
+
+	int fd;
+	uint64_t position;
+
+private:
+	Handle(const Handle &);
+	Handle& operator=(const Handle &);
+};
+
+ResumableUpload::ResumableUpload() :
+	_directory(""),
+	_id(""),
+	_offset(0),
+	_totalSize(0)
+{
+}
+
+ResumableUpload::ResumableUpload(const string &directory, const string &id) :
+	_directory(directory),
+	_id(id),
+	_offset(0),
+	_totalSize(0)
+{
+	load();
+}
+
+bool ResumableUpload::begin(const uint64_t offset, const uint64_t totalSize)
+{
+	if (isValid() == false || _handle) {
+		return false;
+	}
+
+	std::shared_ptr<Handle> handle = std::make_shared<Handle>();
+
+	handle->fd = open(getPartFilename().c_str(), O_RDWR | O_CREAT, 0600);
+	if (handle->fd == -1) {
+		return false;
+	}
+
+	// Another request is writing in the same upload
+	if (flock(handle->fd, LOCK_EX | LOCK_NB) == -1) {
+		return false;
+	}
+
+	// The state could have changed while we were waiting for the file
+	if (load() == false) {
+		return false;
+	}
+
+	if (_totalSize == 0) {
+		// First chunk, the total size must be known
+		if (offset != 0 || totalSize == 0) {
+			return false;
+		}
+
+		// Without space the upload would fail only in the end. Some file
+		// systems don't support it, so the error is ignored
+		if (posix_fallocate(handle->fd, 0, totalSize) != 0) {
+			// Nothing to do
+		}
+
+		_totalSize = totalSize;
+		if (commit() == false) {
+			return false;
+		}
+
+	} else if (totalSize != 0 && totalSize != _totalSize) {
+		return false;
+	}
+
+	if (offset != _offset) {
+		return false;
+	}
+
+	handle->position = offset;
+	_handle = handle;
+	return true;
+}
+
+bool ResumableUpload::write(const char *data, const size_t size)
+{
+	if (!_handle || _handle->position + size > _totalSize) {
+		return false;
+	}
+
+	size_t written = 0;
+	while (written < size) {
+		ssize_t result = pwrite(_handle->fd, data + written, size - written,
+		                        _handle->position + written);
+		if (result == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			// Keep what was written until now
+			_handle->position += written;
+			return false;
+		}
+
+		written += result;
+	}
+
+	_handle->position += size;
+	return true;
+}
+
+bool ResumableUpload::end()
+{
+	if (!_handle) {
+		return false;
+	}
+
+	// The offset can only be committed after the data is on disk
+	bool success = (fdatasync(_handle->fd) == 0);
+	if (success) {
+		_offset = _handle->position;
+		success = commit();
+	}
+
+	_handle.reset();
+	return success;
+}
+
+bool ResumableUpload::finalize(const string &destination)
+{
+	if (isComplete() == false || _handle) {
+		return false;
+	}
+
+	if (rename(getPartFilename().c_str(), destination.c_str()) == -1) {
+		return false;
+	}
+
+	unlink(getOffsetFilename().c_str());
+	syncDirectory(_directory);
+
+	_offset = 0;
+	_totalSize = 0;
+	return true;
+}
+
+void ResumableUpload::abort()
+{
+	if (isValid() == false) {
+		return;
+	}
+
+	_handle.reset();
+
+	unlink(getPartFilename().c_str());
+	unlink(getOffsetFilename().c_str());
+
+	_offset = 0;
+	_totalSize = 0;
+}
+
+bool ResumableUpload::isValid() const
+{
+	if (_directory.empty() || _id.empty() || _id.size() > MAX_ID_SIZE) {
+		return false;
+	}
+
+	// The id is part of the file name
+	for (auto character: _id) {
+		if (isalnum(static_cast<unsigned char>(character)) == false &&
+		    character != '-' && character != '_') {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ResumableUpload::isComplete() const
+{
+	return (_totalSize > 0 && _offset == _totalSize);
+}
+
+string ResumableUpload::getId() const
+{
+	return _id;
+}
+
+uint64_t ResumableUpload::getOffset() const
+{
+	return _offset;
+}
+
+uint64_t ResumableUpload::getTotalSize() const
+{
+	return _totalSize;
+}
+
+bool ResumableUpload::parseContentRange(const string &contentRange,
+                                        uint64_t &first,
+                                        uint64_t &last,
+                                        uint64_t &totalSize)
+{
+	string range = boost::trim_copy(contentRange);
+	if (boost::istarts_with(range, "bytes ") == false) {
+		return false;
+	}
+
+	range = boost::trim_copy(range.substr(6));
+
+	size_t dash = range.find('-');
+	size_t slash = range.find('/');
+	if (dash == string::npos || slash == string::npos || dash > slash) {
+		return false;
+	}
+
+	try {
+		first = boost::lexical_cast<uint64_t>(range.substr(0, dash));
+		last = boost::lexical_cast<uint64_t>(range.substr(dash + 1, slash - dash - 1));
+
+		// The client may not know the total size in the next chunks
+		string total = range.substr(slash + 1);
+		totalSize = (total == "*" ? 0 : boost::lexical_cast<uint64_t>(total));
+
+	} catch (const boost::bad_lexical_cast &e) {
+		return false;
+	}
+
+	return (first <= last && (totalSize == 0 || last < totalSize));
+}
+
+bool ResumableUpload::load()
+{
+	_offset = 0;
+	_totalSize = 0;
+
+	if (isValid() == false) {
+		return false;
+	}
+
+	std::ifstream file(getOffsetFilename().c_str());
+	if (file.good() == false) {
+		// New upload
+		return true;
+	}
+
+	uint64_t offset = 0, totalSize = 0;
+	if ((file >> offset >> totalSize).fail() || offset > totalSize) {
+		return false;
+	}
+
+	_offset = offset;
+	_totalSize = totalSize;
+	return true;
+}
+
+bool ResumableUpload::commit()
+{
+	// The new state is written aside and renamed, so a crash never
+	// leaves a partial state
+	string filename = getOffsetFilename();
+	string temporary = filename + ".tmp";
+
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		return false;
+	}
+
+	std::stringstream state;
+	state << _offset << " " << _totalSize << "\n";
+	string content = state.str();
+
+	bool success = (::write(fd, content.data(), content.size()) ==
+	                static_cast<ssize_t>(content.size()));
+	success = (fsync(fd) == 0) && success;
+	close(fd);
+
+	if (success == false || rename(temporary.c_str(), filename.c_str()) == -1) {
+		unlink(temporary.c_str());
+		return false;
+	}
+
+	return syncDirectory(_directory);
+}
+
+string ResumableUpload::getPartFilename() const
+{
+	return _directory + "/" + _id + ".part";
+}
+
+string ResumableUpload::getOffsetFilename() const
+{
+	return _directory + "/" + _id + ".offset";
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,188 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <thread>
+
+#include <cgiplus/Settings.hpp>
+
+CGIPLUS_NS_BEGIN
+
+Settings::Settings() :
+	_maxContentSize(64 * 1024 * 1024),
+	_maxFieldSize(64 * 1024),
+	_uploadDigest(Digest::Algorithm::NONE),
+	_uploadMemoryLimit(64 * 1024),
+	_spool(),
+	_uploadCleanup(Cleanup::Policy::IMMEDIATE),
+	_contentStore(),
+	_resumableDirectory(""),
+	_uploadWorkers(std::max(1u, std::thread::hardware_concurrency())),
+	_pipelineThreshold(0),
+	_capture(),
+	_inputStripping(true)
+{
+}
+
+Settings& Settings::setMaxContentSize(const size_t maxContentSize)
+{
+	_maxContentSize = maxContentSize;
+	return *this;
+}
+
+size_t Settings::getMaxContentSize() const
+{
+	return _maxContentSize;
+}
+
+Settings& Settings::setUploadDigest(const Digest::Algorithm::Value algorithm)
+{
+	_uploadDigest = algorithm;
+	return *this;
+}
+
+Digest::Algorithm::Value Settings::getUploadDigest() const
+{
+	return _uploadDigest;
+}
+
+Settings& Settings::setMaxFieldSize(const size_t maxFieldSize)
+{
+	_maxFieldSize = maxFieldSize;
+	return *this;
+}
+
+size_t Settings::getMaxFieldSize() const
+{
+	return _maxFieldSize;
+}
+
+Settings& Settings::setUploadMemoryLimit(const size_t memoryLimit)
+{
+	_uploadMemoryLimit = memoryLimit;
+	return *this;
+}
+
+size_t Settings::getUploadMemoryLimit() const
+{
+	return _uploadMemoryLimit;
+}
+
+Settings& Settings::setSpool(const Spool &spool)
+{
+	_spool = spool;
+	return *this;
+}
+
+Spool const& Settings::getSpool() const
+{
+	return _spool;
+}
+
+Settings& Settings::setUploadCleanup(const Cleanup::Policy::Value cleanup)
+{
+	_uploadCleanup = cleanup;
+	return *this;
+}
+
+Cleanup::Policy::Value Settings::getUploadCleanup() const
+{
+	return _uploadCleanup;
+}
+
+Settings& Settings::setContentStore(const ContentStore &contentStore)
+{
+	_contentStore = contentStore;
+	return *this;
+}
+
+ContentStore const& Settings::getContentStore() const
+{
+	return _contentStore;
+}
+
+Settings& Settings::setResumableDirectory(const string &directory)
+{
+	_resumableDirectory = directory;
+	return *this;
+}
+
+string Settings::getResumableDirectory() const
+{
+	return _resumableDirectory;
+}
+
+Settings& Settings::addUploadProcessor(const string &name,
+                                       const UploadedFile::Processor &processor)
+{
+	_uploadProcessors.push_back(std::make_pair(name, processor));
+	return *this;
+}
+
+std::vector<std::pair<string, UploadedFile::Processor>> const&
+Settings::getUploadProcessors() const
+{
+	return _uploadProcessors;
+}
+
+Settings& Settings::setUploadWorkers(const unsigned int workers)
+{
+	_uploadWorkers = (workers == 0 ? 1 : workers);
+	return *this;
+}
+
+unsigned int Settings::getUploadWorkers() const
+{
+	return _uploadWorkers;
+}
+
+Settings& Settings::setPipelineThreshold(const size_t threshold)
+{
+	_pipelineThreshold = threshold;
+	return *this;
+}
+
+size_t Settings::getPipelineThreshold() const
+{
+	return _pipelineThreshold;
+}
+
+Settings& Settings::setCapture(const Capture &capture)
+{
+	_capture = capture;
+	return *this;
+}
+
+Capture const& Settings::getCapture() const
+{
+	return _capture;
+}
+
+Settings& Settings::setInputStripping(const bool inputStripping)
+{
+	_inputStripping = inputStripping;
+	return *this;
+}
+
+bool Settings::getInputStripping() const
+{
+	return _inputStripping;
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,215 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cgiplus/Spool.hpp>
+
+CGIPLUS_NS_BEGIN
+
+#ifdef __linux__
+static const long TMPFS_MAGIC_NUMBER = 0x01021994;
+#endif
+
+Spool::Spool() :
+	_directory(""),
+	_sharding(Sharding::WORKER),
+	_shards(16)
+{
+	const char *directoryPtr = getenv("CGIPLUS_SPOOL_DIRECTORY");
+	if (directoryPtr != NULL) {
+		_directory = directoryPtr;
+	}
+
+	const char *shardingPtr = getenv("CGIPLUS_SPOOL_SHARDING");
+	if (shardingPtr != NULL) {
+		string sharding = boost::to_lower_copy((string) shardingPtr);
+		if (sharding == "none") {
+			_sharding = Sharding::NONE;
+		} else if (sharding == "worker") {
+			_sharding = Sharding::WORKER;
+		} else if (sharding == "cpu") {
+			_sharding = Sharding::CPU;
+		}
+	}
+
+	const char *shardsPtr = getenv("CGIPLUS_SPOOL_SHARDS");
+	if (shardsPtr != NULL) {
+		try {
+			_shards = boost::lexical_cast<unsigned int>(shardsPtr);
+		} catch (const boost::bad_lexical_cast &e) {}
+	}
+
+	if (_shards == 0) {
+		_shards = 1;
+	}
+}
+
+Spool& Spool::setDirectory(const string &directory)
+{
+	_directory = directory;
+	return *this;
+}
+
+string Spool::getDirectory() const
+{
+	return _directory;
+}
+
+Spool& Spool::setSharding(const Sharding::Value sharding, const unsigned int shards)
+{
+	_sharding = sharding;
+	_shards = (shards == 0 ? 1 : shards);
+	return *this;
+}
+
+Spool::Sharding::Value Spool::getSharding() const
+{
+	return _sharding;
+}
+
+unsigned int Spool::getShards() const
+{
+	return _shards;
+}
+
+string Spool::resolve(const size_t expectedSize) const
+{
+	std::vector<string> candidates;
+
+	if (_directory.empty() == false) {
+		candidates.push_back(_directory);
+
+	} else {
+		const char *tmpdirPtr = getenv("TMPDIR");
+		if (tmpdirPtr != NULL && *tmpdirPtr != '\0') {
+			candidates.push_back(tmpdirPtr);
+		}
+
+		candidates.push_back("/dev/shm");
+		candidates.push_back("/tmp");
+
+		// Memory file systems first
+		std::stable_partition(candidates.begin(), candidates.end(), isTmpfs);
+	}
+
+	for (auto candidate: candidates) {
+		if (getAvailableSpace(candidate) < expectedSize) {
+			continue;
+		}
+
+		string directory = prepare(candidate);
+		if (directory.empty() == false) {
+			return directory;
+		}
+	}
+
+	return "";
+}
+
+bool Spool::isTmpfs(const string &directory)
+{
+#ifdef __linux__
+	struct statfs info;
+	if (statfs(directory.c_str(), &info) == -1) {
+		return false;
+	}
+
+	return (static_cast<long>(info.f_type) == TMPFS_MAGIC_NUMBER);
+#else
+	return false;
+#endif
+}
+
+size_t Spool::getAvailableSpace(const string &directory)
+{
+	struct statvfs info;
+	if (statvfs(directory.c_str(), &info) == -1) {
+		return 0;
+	}
+
+	return static_cast<size_t>(info.f_bavail) * info.f_frsize;
+}
+
+string Spool::prepare(const string &directory) const
+{
+	if (access(directory.c_str(), W_OK | X_OK) == -1) {
+		return "";
+	}
+
+	if (_sharding == Sharding::NONE) {
+		return directory;
+	}
+
+	unsigned int shard = 0;
+	string prefix = "";
+
+	if (_sharding == Sharding::WORKER) {
+		shard = static_cast<unsigned int>(getpid()) % _shards;
+		prefix = "worker-";
+
+	} else {
+		int cpu = -1;
+#ifdef __linux__
+		cpu = sched_getcpu();
+#endif
+		shard = (cpu < 0 ? 0 : static_cast<unsigned int>(cpu) % _shards);
+		prefix = "cpu-";
+	}
+
+	// Each user has its own tree, so shared directories like /tmp are
+	// safe to use
+	string base = directory + "/cgiplus-" + boost::lexical_cast<string>(getuid());
+	if (mkdir(base.c_str(), 0700) == -1 && errno != EEXIST) {
+		return "";
+	}
+
+	// Don't trust a directory (or a link) created by someone else
+	struct stat info;
+	if (lstat(base.c_str(), &info) == -1 || S_ISDIR(info.st_mode) == false ||
+	    info.st_uid != getuid()) {
+		return "";
+	}
+
+	string shardDirectory = base + "/" + prefix + boost::lexical_cast<string>(shard);
+	if (mkdir(shardDirectory.c_str(), 0700) == -1 && errno != EEXIST) {
+		return "";
+	}
+
+	return shardDirectory;
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,802 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <boost/algorithm/string.hpp>
+
+#include <cgiplus/Digest.hpp>
+#include <cgiplus/Escape.hpp>
+#include <cgiplus/FragmentCache.hpp>
+#include <cgiplus/Template.hpp>
+#include <cgiplus/TemplateCache.hpp>
+
+CGIPLUS_NS_BEGIN
+
+const uint32_t Template::NO_LOOP = std::numeric_limits<uint32_t>::max();
+
+// Smaller literal parts are compressed with the field values, joining
+// them would cost more (flush) than compressing them again
+static const size_t MIN_DEFLATED_SIZE = 64;
+
+// Limit of templates searched for the literal parts (with includes)
+static const size_t MAX_DEFLATED_TEMPLATES = 64;
+
+namespace {
+
+/*! Returns the path of an included file, relative to the directory of
+ * the including file. Absolute paths and paths with ".." are rejected
+ * (empty result), so a template can't include files outside its
+ * directory
+ */
+string resolveInclude(const string &file, const string &path)
+{
+	if (path.empty() || path[0] == '/') {
+		return "";
+	}
+
+	std::vector<string> components;
+	boost::split(components, path, boost::is_any_of("/"));
+	for (auto component: components) {
+		if (component == "..") {
+			return "";
+		}
+	}
+
+	size_t slash = file.rfind('/');
+	if (slash == string::npos) {
+		return path;
+	}
+
+	return file.substr(0, slash + 1) + path;
+}
+
+/*! Sums the size of the result
+ */
+class SizeEmitter
+{
+public:
+	SizeEmitter() :
+		size(0)
+	{
+	}
+
+	void operator()(const char *, const size_t partSize)
+	{
+		size += partSize;
+	}
+
+	size_t size;
+};
+
+/*! Copies the result into a buffer with the final size
+ */
+class CopyEmitter
+{
+public:
+	explicit CopyEmitter(char *buffer) :
+		buffer(buffer)
+	{
+	}
+
+	void operator()(const char *data, const size_t size)
+	{
+		memcpy(buffer, data, size);
+		buffer += size;
+	}
+
+	char *buffer;
+};
+
+/*! Lists the parts of the result
+ */
+class PartEmitter
+{
+public:
+	explicit PartEmitter(std::vector<Template::Part> &parts) :
+		parts(parts),
+		size(0)
+	{
+	}
+
+	void operator()(const char *data, const size_t partSize)
+	{
+		if (partSize > 0) {
+			parts.push_back(Template::Part(data, partSize));
+			size += partSize;
+		}
+	}
+
+	std::vector<Template::Part> &parts;
+	size_t size;
+};
+
+/*! Appends the result in a string
+ */
+class StringEmitter
+{
+public:
+	explicit StringEmitter(string &output) :
+		output(output)
+	{
+	}
+
+	void operator()(const char *data, const size_t size)
+	{
+		output.append(data, size);
+	}
+
+	string &output;
+};
+
+/*! Conditional or loop that is not closed yet
+ */
+class Block
+{
+public:
+	enum Kind {
+		IF,
+		ELSE,
+		FOR,
+		CACHE
+	};
+
+	Block(const Kind kind, const size_t instruction) :
+		kind(kind),
+		instruction(instruction)
+	{
+	}
+
+	Kind kind;
+
+	// Instruction that jumps to the end of the block
+	size_t instruction;
+};
+
+}
+
+/*! \class Frame
+ *  \brief State of a template execution
+ */
+class Template::Frame
+{
+public:
+	Frame(const Fields &fields, const Lists &lists, const bool escape,
+	      Fragments &fragments, const size_t slots, const uint32_t loops) :
+		fields(fields),
+		lists(lists),
+		escape(escape),
+		fragments(fragments),
+		values(slots, NULL),
+		rows(slots, NULL),
+		loops(loops)
+	{
+	}
+
+	const Fields &fields;
+	const Lists &lists;
+	bool escape;
+	Fragments &fragments;
+
+	// Field and list of each slot
+	std::vector<const string*> values;
+	std::vector<const List*> rows;
+
+	// Current list and row of each loop
+	std::vector<std::pair<const List*, size_t>> loops;
+};
+
+Template::Instruction::Instruction(const Opcode opcode, const uint32_t a,
+                                   const uint32_t b, const uint32_t c,
+                                   const uint8_t context) :
+	opcode(opcode),
+	context(context),
+	a(a),
+	b(b),
+	c(c)
+{
+}
+
+Template::Template() :
+	_owner(),
+	_data(NULL),
+	_size(0),
+	_file(""),
+	_identity(""),
+	_loops(0)
+{
+}
+
+Template::Template(const string &content, const std::pair<string, string> &tags,
+                   const string &file) :
+	_owner(std::make_shared<const string>(content)),
+	_data(static_cast<const string*>(_owner.get())->data()),
+	_size(content.size()),
+	_file(file),
+	_identity(""),
+	_loops(0)
+{
+	compile(tags, true);
+	identify();
+}
+
+Template::Template(const char *data, const size_t size,
+                   const std::shared_ptr<const void> &owner,
+                   const std::pair<string, string> &tags,
+                   const string &file) :
+	_owner(owner),
+	_data(data),
+	_size(size),
+	_file(file),
+	_identity(""),
+	_loops(0)
+{
+	compile(tags, true);
+	identify();
+}
+
+string Template::getContent() const
+{
+	return string(_data == NULL ? "" : _data, _size);
+}
+
+size_t Template::getSize() const
+{
+	return _size;
+}
+
+size_t Template::getNumberOfSlots() const
+{
+	return _slots.size();
+}
+
+std::vector<Template::Include> const& Template::getIncludes() const
+{
+	return _includes;
+}
+
+void Template::render(const Fields &fields, const Lists &lists, string &output,
+                      const bool escape) const
+{
+	// The result is measured first, so the output is allocated once
+	Fragments fragments;
+	SizeEmitter sizeEmitter;
+	execute(fields, lists, escape, fragments, sizeEmitter);
+
+	size_t position = output.size();
+	output.resize(position + sizeEmitter.size);
+
+	CopyEmitter copyEmitter(&output[0] + position);
+	execute(fields, lists, escape, fragments, copyEmitter);
+}
+
+size_t Template::render(const Fields &fields, const Lists &lists, std::vector<Part> &parts,
+                        Fragments &fragments, const bool escape) const
+{
+	PartEmitter partEmitter(parts);
+	execute(fields, lists, escape, fragments, partEmitter);
+	return partEmitter.size;
+}
+
+bool Template::deflate(const std::vector<Part> &parts, Deflater &deflater,
+                       string &output) const
+{
+	// Templates whose literal parts may be in the result
+	std::vector<const Template*> templates(1, this);
+	for (size_t i = 0; i < templates.size(); i++) {
+		for (auto include: templates[i]->_includes) {
+			if (include.second && templates.size() < MAX_DEFLATED_TEMPLATES) {
+				templates.push_back(include.second.get());
+			}
+		}
+	}
+
+	for (auto part: parts) {
+		const Deflated *deflated = NULL;
+		for (auto compiled: templates) {
+			deflated = compiled->findDeflated(part);
+			if (deflated != NULL) {
+				break;
+			}
+		}
+
+		bool success = false;
+		if (deflated != NULL) {
+			success = deflater.join(deflated->data, deflated->size, deflated->crc,
+			                        deflated->adler, output);
+		} else {
+			success = deflater.deflate(part.first, part.second, output);
+		}
+
+		if (success == false) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template<class Emit>
+void Template::execute(const Fields &fields, const Lists &lists, const bool escape,
+                       Fragments &fragments, Emit &emit) const
+{
+	Frame frame(fields, lists, escape, fragments, _slots.size(), _loops);
+
+	// Each name is looked up only once
+	for (size_t i = 0; i < _slots.size(); i++) {
+		auto field = fields.find(_slots[i]);
+		if (field != fields.end()) {
+			frame.values[i] = &field->second;
+		}
+
+		auto list = lists.find(_slots[i]);
+		if (list != lists.end()) {
+			frame.rows[i] = &list->second;
+		}
+	}
+
+	run(frame, 0, _code.size(), emit);
+}
+
+template<class Emit>
+void Template::run(Frame &frame, const size_t begin, const size_t end, Emit &emit) const
+{
+	std::vector<const string*> &values = frame.values;
+	std::vector<const List*> &rows = frame.rows;
+	std::vector<std::pair<const List*, size_t>> &loops = frame.loops;
+
+	size_t counter = begin;
+	while (counter < end) {
+		const Instruction &instruction = _code[counter++];
+
+		switch (instruction.opcode) {
+		case Instruction::LITERAL:
+			emit(_data + instruction.a, instruction.b);
+			break;
+
+		case Instruction::FIELD:
+			if (values[instruction.a] != NULL) {
+				const string *value = values[instruction.a];
+				if (frame.escape) {
+					Escape::apply(value->data(), value->size(),
+					              static_cast<Escape::Context::Value>(instruction.context), emit);
+				} else {
+					emit(value->data(), value->size());
+				}
+			} else {
+				emit(_data + instruction.b, instruction.c);
+			}
+			break;
+
+		case Instruction::COLUMN: {
+			auto &loop = loops[instruction.a];
+			const Row &row = (*loop.first)[loop.second];
+
+			auto column = row.find(_columns[instruction.b]);
+			if (column == row.end()) {
+				break;
+			}
+
+			if (frame.escape) {
+				Escape::apply(column->second.data(), column->second.size(),
+				              static_cast<Escape::Context::Value>(instruction.context), emit);
+			} else {
+				emit(column->second.data(), column->second.size());
+			}
+		} break;
+
+		case Instruction::JUMP:
+			counter = instruction.c;
+			break;
+
+		case Instruction::JUMP_IF_EMPTY:
+		case Instruction::JUMP_IF_NOT_EMPTY: {
+			bool empty = true;
+
+			if (instruction.a == NO_LOOP) {
+				const string *value = values[instruction.b];
+				const List *list = rows[instruction.b];
+				empty = ((value == NULL || value->empty()) &&
+				         (list == NULL || list->empty()));
+
+			} else {
+				auto &loop = loops[instruction.a];
+				const Row &row = (*loop.first)[loop.second];
+
+				auto column = row.find(_columns[instruction.b]);
+				empty = (column == row.end() || column->second.empty());
+			}
+
+			if (empty == (instruction.opcode == Instruction::JUMP_IF_EMPTY)) {
+				counter = instruction.c;
+			}
+		} break;
+
+		case Instruction::LOOP:
+			if (rows[instruction.a] == NULL || rows[instruction.a]->empty()) {
+				counter = instruction.c;
+			} else {
+				loops[instruction.b] = std::make_pair(rows[instruction.a], 0);
+			}
+			break;
+
+		case Instruction::NEXT: {
+			auto &loop = loops[instruction.a];
+			if (++loop.second < loop.first->size()) {
+				counter = instruction.b;
+			}
+		} break;
+
+		case Instruction::INCLUDE:
+			if (_includes[instruction.a].second) {
+				_includes[instruction.a].second->execute(frame.fields, frame.lists, frame.escape,
+				                                         frame.fragments, emit);
+			}
+			break;
+
+		case Instruction::CACHE: {
+			const string &fragment = getFragment(frame, counter);
+			emit(fragment.data(), fragment.size());
+			counter = instruction.c;
+		} break;
+		}
+	}
+}
+
+const string& Template::getFragment(Frame &frame, const size_t begin) const
+{
+	const Instruction &instruction = _code[begin - 1];
+	const Fragment &definition = _fragments[instruction.a];
+
+	Digest digest(Digest::Algorithm::XXHASH64);
+	digest.update(_identity.data(), _identity.size());
+	digest.update(definition.name.data(), definition.name.size());
+	digest.update(frame.escape ? "\1" : "\0", 1);
+	for (auto reference: definition.references) {
+		const string *value = NULL;
+		if (reference.first == NO_LOOP) {
+			value = frame.values[reference.second];
+		} else {
+			auto &loop = frame.loops[reference.first];
+			const Row &row = (*loop.first)[loop.second];
+
+			auto column = row.find(_columns[reference.second]);
+			if (column != row.end()) {
+				value = &column->second;
+			}
+		}
+
+		// Size before the value, so the values can't be confused
+		uint64_t size = (value == NULL ? UINT64_MAX : value->size());
+		digest.update(reinterpret_cast<const char*>(&size), sizeof(size));
+		if (value != NULL) {
+			digest.update(value->data(), value->size());
+		}
+	}
+
+	string cacheKey = digest.toString();
+
+	// The fragment is looked up once per render and key, so all passes
+	// over the template see the same content
+	auto fragment = frame.fragments.find(cacheKey);
+	if (fragment != frame.fragments.end()) {
+		return *fragment->second;
+	}
+
+	std::shared_ptr<const string> content = FragmentCache::get(cacheKey);
+	if (!content) {
+		std::shared_ptr<string> rendered = std::make_shared<string>();
+		StringEmitter stringEmitter(*rendered);
+		run(frame, begin, instruction.c, stringEmitter);
+
+		content = rendered;
+		FragmentCache::set(cacheKey, content, definition.ttl);
+	}
+
+	frame.fragments[cacheKey] = content;
+	return *content;
+}
+
+std::shared_ptr<const std::vector<Template::Deflated>> Template::getDeflated() const
+{
+	std::shared_ptr<const std::vector<Deflated>> deflated = std::atomic_load(&_deflated);
+	if (deflated) {
+		return deflated;
+	}
+
+	// Literal instructions are in the same order of the content
+	std::shared_ptr<std::vector<Deflated>> created = std::make_shared<std::vector<Deflated>>();
+	for (auto &instruction: _code) {
+		if (instruction.opcode != Instruction::LITERAL || instruction.b < MIN_DEFLATED_SIZE) {
+			continue;
+		}
+
+		Deflated part;
+		part.offset = instruction.a;
+		part.size = instruction.b;
+		if (Deflater::compressPart(_data + part.offset, part.size, Z_BEST_COMPRESSION,
+		                           part.data, part.crc, part.adler)) {
+			created->push_back(part);
+		}
+	}
+
+	// Threads that compressed at the same time use the first result, so
+	// the parts are never released
+	deflated = created;
+	std::shared_ptr<const std::vector<Deflated>> current;
+	if (std::atomic_compare_exchange_strong(&_deflated, &current, deflated)) {
+		return deflated;
+	}
+
+	return current;
+}
+
+const Template::Deflated* Template::findDeflated(const Part &part) const
+{
+	uintptr_t address = reinterpret_cast<uintptr_t>(part.first);
+	uintptr_t begin = reinterpret_cast<uintptr_t>(_data);
+	if (_data == NULL || address < begin || address >= begin + _size ||
+	    part.second < MIN_DEFLATED_SIZE) {
+		return NULL;
+	}
+
+	size_t offset = address - begin;
+	auto deflated = getDeflated();
+
+	auto found = std::lower_bound(deflated->begin(), deflated->end(), offset,
+	                              [](const Deflated &item, const size_t value) {
+		                              return item.offset < value;
+	                              });
+
+	if (found == deflated->end() || found->offset != offset || found->size != part.second) {
+		return NULL;
+	}
+
+	return &(*found);
+}
+
+void Template::compile(const std::pair<string, string> &tags, const bool control)
+{
+	_code.clear();
+	_slots.clear();
+	_columns.clear();
+	_includes.clear();
+	_fragments.clear();
+	_loops = 0;
+
+	if (tags.first.empty() || tags.second.empty()) {
+		if (_size > 0) {
+			_code.push_back(Instruction(Instruction::LITERAL, 0, _size, 0));
+		}
+
+		return;
+	}
+
+	std::map<string, uint32_t> slots;
+	auto getSlot = [&] (const string &name) -> uint32_t {
+		auto slot = slots.find(name);
+		if (slot == slots.end()) {
+			slot = slots.insert(std::make_pair(name, _slots.size())).first;
+			_slots.push_back(name);
+		}
+
+		return slot->second;
+	};
+
+	std::map<string, uint32_t> columns;
+	auto getColumn = [&] (const string &name) -> uint32_t {
+		auto column = columns.find(name);
+		if (column == columns.end()) {
+			column = columns.insert(std::make_pair(name, _columns.size())).first;
+			_columns.push_back(name);
+		}
+
+		return column->second;
+	};
+
+	// Variables of the open loops, the position is the loop number
+	std::vector<string> variables;
+	std::vector<Block> blocks;
+
+	// "row.column" is a column when "row" is the variable of an open
+	// loop, otherwise it's a field
+	auto getReference = [&] (const string &name, uint32_t &loop, uint32_t &index) {
+		size_t dot = name.find('.');
+		if (dot != string::npos) {
+			string variable = name.substr(0, dot);
+			for (size_t i = variables.size(); i > 0; i--) {
+				if (variables[i - 1] == variable) {
+					loop = i - 1;
+					index = getColumn(name.substr(dot + 1));
+					return;
+				}
+			}
+		}
+
+		loop = NO_LOOP;
+		index = getSlot(name);
+	};
+
+	const char *end = _data + _size;
+	const char *literal = _data;
+	const char *position = _data;
+	bool failed = false;
+
+	// Where each field is written in the page, to escape it
+	Escape::Scanner scanner;
+
+	while (failed == false) {
+		const char *tagBegin = std::search(position, end, tags.first.begin(), tags.first.end());
+		if (tagBegin == end) {
+			break;
+		}
+
+		const char *nameBegin = tagBegin + tags.first.size();
+		const char *nameEnd = std::search(nameBegin, end, tags.second.begin(), tags.second.end());
+		if (nameEnd == end) {
+			break;
+		}
+
+		// For "<!-- <!-- name -->" only the last beginning is part of
+		// the tag
+		const char *lastBegin = std::find_end(nameBegin, nameEnd,
+		                                      tags.first.begin(), tags.first.end());
+		if (lastBegin != nameEnd) {
+			tagBegin = lastBegin;
+			nameBegin = tagBegin + tags.first.size();
+		}
+
+		const char *tagEnd = nameEnd + tags.second.size();
+		string name(nameBegin, nameEnd);
+
+		if (tagBegin > literal) {
+			_code.push_back(Instruction(Instruction::LITERAL, literal - _data,
+			                            tagBegin - literal, 0));
+			scanner.feed(literal, tagBegin - literal);
+		}
+
+		literal = tagEnd;
+		position = tagEnd;
+
+		std::vector<string> words;
+		if (control) {
+			string statement = boost::trim_copy(name);
+			boost::split(words, statement, boost::is_space(), boost::token_compress_on);
+		}
+
+		if (words.size() == 1 && words[0] == "end") {
+			if (blocks.empty()) {
+				failed = true;
+				break;
+			}
+
+			Block block = blocks.back();
+			blocks.pop_back();
+
+			if (block.kind == Block::FOR) {
+				// The loop body starts after the LOOP instruction
+				uint32_t loop = variables.size() - 1;
+				_code.push_back(Instruction(Instruction::NEXT, loop, block.instruction + 1, 0));
+				variables.pop_back();
+			}
+
+			_code[block.instruction].c = _code.size();
+
+		} else if (words.size() == 1 && words[0] == "else") {
+			if (blocks.empty() || blocks.back().kind != Block::IF) {
+				failed = true;
+				break;
+			}
+
+			_code.push_back(Instruction(Instruction::JUMP, 0, 0, 0));
+			_code[blocks.back().instruction].c = _code.size();
+			blocks.back() = Block(Block::ELSE, _code.size() - 1);
+
+		} else if ((words.size() == 2 && words[0] == "if") ||
+		           (words.size() == 3 && words[0] == "if" && words[1] == "not")) {
+			uint32_t loop = NO_LOOP, index = 0;
+			getReference(words.back(), loop, index);
+
+			// The block is skipped when the condition is false
+			Instruction::Opcode opcode = (words.size() == 2 ?
+			                              Instruction::JUMP_IF_EMPTY :
+			                              Instruction::JUMP_IF_NOT_EMPTY);
+
+			blocks.push_back(Block(Block::IF, _code.size()));
+			_code.push_back(Instruction(opcode, loop, index, 0));
+
+		} else if (words.size() == 4 && words[0] == "for" && words[2] == "in") {
+			uint32_t loop = variables.size();
+			_loops = std::max(_loops, loop + 1);
+
+			blocks.push_back(Block(Block::FOR, _code.size()));
+			_code.push_back(Instruction(Instruction::LOOP, getSlot(words[3]), loop, 0));
+			variables.push_back(words[1]);
+
+		} else if (words.size() >= 3 && words[0] == "cache" &&
+		           words[2].find_first_not_of("0123456789") == string::npos) {
+			Fragment fragment;
+			fragment.name = words[1];
+			fragment.ttl = strtoul(words[2].c_str(), NULL, 10);
+			for (size_t i = 3; i < words.size(); i++) {
+				uint32_t loop = NO_LOOP, index = 0;
+				getReference(words[i], loop, index);
+				fragment.references.push_back(std::make_pair(loop, index));
+			}
+
+			blocks.push_back(Block(Block::CACHE, _code.size()));
+			_code.push_back(Instruction(Instruction::CACHE, _fragments.size(), 0, 0));
+			_fragments.push_back(fragment);
+
+		} else if (words.size() == 2 && words[0] == "include") {
+			// Only templates read from files include others, rejected
+			// includes render nothing
+			string path = _file.empty() ? "" : resolveInclude(_file, words[1]);
+
+			_code.push_back(Instruction(Instruction::INCLUDE, _includes.size(), 0, 0));
+			_includes.push_back(Include(words[1], path.empty() ?
+			                            std::shared_ptr<const Template>() :
+			                            TemplateCache::get(path, tags)));
+
+		} else {
+			uint32_t loop = NO_LOOP, index = 0;
+			getReference(name, loop, index);
+
+			if (loop == NO_LOOP) {
+				_code.push_back(Instruction(Instruction::FIELD, index, tagBegin - _data,
+				                            tagEnd - tagBegin, scanner.getContext()));
+			} else {
+				_code.push_back(Instruction(Instruction::COLUMN, loop, index, 0,
+				                            scanner.getContext()));
+			}
+		}
+	}
+
+	if (failed || blocks.empty() == false) {
+		// Probably comments that look like statements
+		compile(tags, false);
+		return;
+	}
+
+	if (literal < end) {
+		_code.push_back(Instruction(Instruction::LITERAL, literal - _data, end - literal, 0));
+	}
+}
+
+void Template::identify()
+{
+	Digest digest(Digest::Algorithm::XXHASH64);
+	if (_data != NULL) {
+		digest.update(_data, _size);
+	}
+
+	for (auto include: _includes) {
+		if (include.second) {
+			digest.update(include.second->_identity.data(), include.second->_identity.size());
+		}
+	}
+
+	_identity = digest.toString();
+}
+
+CGIPLUS_NS_END
@@ -0,0 +1,584 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include <cgiplus/TemplateCache.hpp>
+
+CGIPLUS_NS_BEGIN
+
+// Templates smaller than this are copied to memory. Mapping small
+// files is not worth it, and a copy is not affected when the file is
+// truncated while it is used
+static const size_t MAP_THRESHOLD = 64 * 1024;
+
+// Time between the checks of changed files (inotify events or file
+// status), so most renders don't need a system call
+static const unsigned int DEFAULT_CHECK_INTERVAL = 1000;
+
+// Events that make the template be read again
+static const uint32_t WATCH_EVENTS = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+	IN_MOVE_SELF | IN_DELETE_SELF;
+
+namespace {
+
+// Number of mappings invalidated, renders that started before a change
+// may have read zeros
+std::atomic<uint64_t> generation(0);
+
+/*! Read only private mapping of a file, unmapped when the last
+ * template that uses it is destroyed. A private mapping still shows the
+ * changes written to the file, and reading pages after the end of a
+ * truncated file raises SIGBUS
+ */
+class Mapping
+{
+public:
+	Mapping(const int fd, const size_t size) :
+		_data(MAP_FAILED),
+		_size(size)
+	{
+		_data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (_data != MAP_FAILED) {
+			// Only a hint, the pages are read ahead when possible
+			madvise(_data, size, MADV_WILLNEED);
+		}
+	}
+
+	~Mapping()
+	{
+		if (_data != MAP_FAILED) {
+			munmap(_data, _size);
+		}
+	}
+
+	/*! Replace the pages by anonymous zero pages, so templates still
+	 * being rendered never read after the end of a file rewritten in
+	 * place. The new mapping replaces the old one atomically. Returns
+	 * false when there was no memory for the new mapping, then the
+	 * pages still show the file. Either way the generation changes, so
+	 * the renders that used the pages are done again
+	 */
+	bool invalidate()
+	{
+		if (_data == MAP_FAILED) {
+			return true;
+		}
+
+		void *data = mmap(_data, _size, PROT_READ,
+		                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+		generation++;
+		return (data != MAP_FAILED);
+	}
+
+	bool isValid() const
+	{
+		return (_data != MAP_FAILED);
+	}
+
+	const char* getData() const
+	{
+		return static_cast<const char*>(_data);
+	}
+
+private:
+	Mapping(const Mapping &);
+	Mapping& operator=(const Mapping &);
+
+	void *_data;
+	size_t _size;
+};
+
+/*! Compiled template and the file state when it was read
+ */
+class Entry
+{
+public:
+	Entry() :
+		file(""),
+		watch(-1),
+		modification(0),
+		size(0),
+		inode(0),
+		device(0),
+		stale(false)
+	{
+	}
+
+	string file;
+	std::shared_ptr<const Template> compiled;
+
+	// Only for the templates rendered from a mapped file
+	std::shared_ptr<Mapping> mapping;
+
+	int watch;
+	int64_t modification;
+	off_t size;
+	ino_t inode;
+	dev_t device;
+
+	std::atomic<bool> stale;
+
+private:
+	Entry(const Entry &);
+	Entry& operator=(const Entry &);
+};
+
+typedef std::map<string, std::shared_ptr<Entry>> Entries;
+
+string makeKey(const string &file, const std::pair<string, string> &tags)
+{
+	// The tags are part of the key, because the same file can be
+	// compiled with different delimiters
+	return file + '\0' + tags.first + '\0' + tags.second;
+}
+
+int64_t getModification(const struct stat &status)
+{
+	return static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 +
+		status.st_mtim.tv_nsec;
+}
+
+bool isSameFile(const Entry &entry, const struct stat &status)
+{
+	return (entry.modification == getModification(status) &&
+	        entry.size == status.st_size &&
+	        entry.inode == status.st_ino &&
+	        entry.device == status.st_dev);
+}
+
+/*! A file replaced with rename is a new inode, and the old mapping is
+ * still valid. The same inode with other contents was rewritten in
+ * place
+ */
+void invalidateRewritten(const Entry &entry, const struct stat &status)
+{
+	if (entry.mapping && entry.inode == status.st_ino && entry.device == status.st_dev &&
+	    isSameFile(entry, status) == false) {
+		entry.mapping->invalidate();
+	}
+}
+
+/*! Removes the key from the set when the template is loaded (or when
+ * loading it fails)
+ */
+class LoadingGuard
+{
+public:
+	LoadingGuard(std::set<string> &loading, const string &key) :
+		_loading(loading),
+		_key(key)
+	{
+	}
+
+	~LoadingGuard()
+	{
+		_loading.erase(_key);
+	}
+
+private:
+	LoadingGuard(const LoadingGuard &);
+	LoadingGuard& operator=(const LoadingGuard &);
+
+	std::set<string> &_loading;
+	const string &_key;
+};
+
+/*! There's only one cache per process
+ */
+class Cache
+{
+public:
+	static Cache& getInstance()
+	{
+		static Cache cache;
+		return cache;
+	}
+
+	~Cache()
+	{
+		if (_inotify != -1) {
+			close(_inotify);
+		}
+	}
+
+	std::shared_ptr<const Template> get(const string &file,
+	                                    const std::pair<string, string> &tags)
+	{
+		bool check = isCheckTime();
+		if (check) {
+			drain();
+		}
+
+		string key = makeKey(file, tags);
+
+		std::shared_ptr<const Entries> entries = std::atomic_load(&_entries);
+		auto entry = entries->find(key);
+		if (entry != entries->end() && isFresh(*entry->second, *entries, tags, check)) {
+			return entry->second->compiled;
+		}
+
+		// A file that includes itself (directly or not) is not included
+		// again
+		static thread_local std::set<string> loading;
+		if (loading.insert(key).second == false) {
+			return std::shared_ptr<const Template>();
+		}
+
+		LoadingGuard guard(loading, key);
+		return load(key, file, tags);
+	}
+
+	void clear()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		std::shared_ptr<const Entries> entries = std::atomic_load(&_entries);
+
+		std::set<int> watches;
+		for (auto &entry: *entries) {
+			if (entry.second->watch != -1) {
+				watches.insert(entry.second->watch);
+			}
+		}
+
+		for (auto watch: watches) {
+			inotify_rm_watch(_inotify, watch);
+		}
+
+		std::atomic_store(&_entries, std::make_shared<const Entries>());
+	}
+
+	size_t getSize()
+	{
+		return std::atomic_load(&_entries)->size();
+	}
+
+	void setCheckInterval(const unsigned int checkInterval)
+	{
+		_checkInterval = checkInterval;
+
+		// The new interval starts now
+		_nextCheck = 0;
+	}
+
+	unsigned int getCheckInterval() const
+	{
+		return _checkInterval;
+	}
+
+private:
+	Cache() :
+		_inotify(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+		_events(0),
+		_checkInterval(DEFAULT_CHECK_INTERVAL),
+		_nextCheck(0),
+		_entries(std::make_shared<const Entries>())
+	{
+		const char *checkInterval = getenv("CGIPLUS_TEMPLATE_CHECK_INTERVAL");
+		if (checkInterval != NULL) {
+			_checkInterval = strtoul(checkInterval, NULL, 10);
+		}
+	}
+
+	Cache(const Cache &);
+	Cache& operator=(const Cache &);
+
+	/*! Only one thread checks the files in each interval. The steady
+	 * clock is read without a system call (vDSO)
+	 */
+	bool isCheckTime()
+	{
+		int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+
+		int64_t next = _nextCheck.load(std::memory_order_relaxed);
+		if (now < next) {
+			return false;
+		}
+
+		return _nextCheck.compare_exchange_strong(next, now + _checkInterval.load());
+	}
+
+	bool isFresh(const Entry &entry, const Entries &entries,
+	             const std::pair<string, string> &tags, const bool check) const
+	{
+		if (entry.stale) {
+			return false;
+		}
+
+		// Without a watch, the file status is checked in each interval
+		if (entry.watch == -1 && check) {
+			struct stat status;
+			if (stat(entry.file.c_str(), &status) == -1) {
+				return false;
+			}
+
+			if (isSameFile(entry, status) == false) {
+				invalidateRewritten(entry, status);
+				return false;
+			}
+		}
+
+		// The included templates must be the current ones. Files that
+		// couldn't be included are only checked when this file changes
+		for (auto &include: entry.compiled->getIncludes()) {
+			if (!include.second) {
+				continue;
+			}
+
+			auto included = entries.find(makeKey(include.first, tags));
+			if (included == entries.end() ||
+			    included->second->compiled != include.second ||
+			    isFresh(*included->second, entries, tags, check) == false) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/*! Read the pending inotify events, without waiting. The kernel
+	 * queues the event when the file is changed, so a change is always
+	 * seen by the next request.
+	 */
+	void drain()
+	{
+		if (_inotify == -1) {
+			return;
+		}
+
+		alignas(struct inotify_event) char buffer[4096];
+
+		while (true) {
+			ssize_t size = ::read(_inotify, buffer, sizeof(buffer));
+			if (size <= 0) {
+				// EAGAIN when there's no event
+				break;
+			}
+
+			std::set<int> watches, modified;
+			bool overflow = false;
+
+			for (char *position = buffer; position < buffer + size;) {
+				struct inotify_event *event =
+					reinterpret_cast<struct inotify_event*>(position);
+
+				if (event->mask & IN_Q_OVERFLOW) {
+					overflow = true;
+				} else {
+					watches.insert(event->wd);
+				}
+
+				if (event->mask & IN_MODIFY) {
+					modified.insert(event->wd);
+				}
+
+				position += sizeof(struct inotify_event) + event->len;
+			}
+
+			_events++;
+
+			std::shared_ptr<const Entries> entries = std::atomic_load(&_entries);
+			for (auto &entry: *entries) {
+				if (overflow || watches.count(entry.second->watch) > 0) {
+					entry.second->stale = true;
+				}
+
+				// The mapped file was written in place. When the queue
+				// overflows, the events are lost and the file is checked
+				if (!entry.second->mapping) {
+					continue;
+				} else if (modified.count(entry.second->watch) > 0) {
+					entry.second->mapping->invalidate();
+				} else if (overflow) {
+					struct stat status;
+					if (stat(entry.second->file.c_str(), &status) == 0) {
+						invalidateRewritten(*entry.second, status);
+					}
+				}
+			}
+		}
+	}
+
+	std::shared_ptr<const Template> load(const string &key,
+	                                     const string &file,
+	                                     const std::pair<string, string> &tags)
+	{
+		std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+		entry->file = file;
+
+		// The watch is added before reading, so a change while the file
+		// is read is not lost
+		uint64_t events = _events;
+		if (_inotify != -1) {
+			entry->watch = inotify_add_watch(_inotify, file.c_str(), WATCH_EVENTS);
+		}
+
+		entry->compiled = readFile(file, tags, *entry);
+		if (!entry->compiled) {
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			std::shared_ptr<Entries> entries =
+				std::make_shared<Entries>(*std::atomic_load(&_entries));
+			if (entries->erase(key) > 0) {
+				std::atomic_store(&_entries, std::shared_ptr<const Entries>(entries));
+			}
+
+			return std::shared_ptr<const Template>();
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			std::shared_ptr<Entries> entries =
+				std::make_shared<Entries>(*std::atomic_load(&_entries));
+			(*entries)[key] = entry;
+			std::atomic_store(&_entries, std::shared_ptr<const Entries>(entries));
+		}
+
+		// Some event was read by another thread before the entry was in
+		// the cache, it could be for this file
+		if (_events != events) {
+			entry->stale = true;
+		}
+
+		return entry->compiled;
+	}
+
+	std::shared_ptr<const Template> readFile(const string &file,
+	                                         const std::pair<string, string> &tags,
+	                                         Entry &entry)
+	{
+		int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			return std::shared_ptr<const Template>();
+		}
+
+		struct stat status;
+		if (fstat(fd, &status) == -1) {
+			close(fd);
+			return std::shared_ptr<const Template>();
+		}
+
+		entry.modification = getModification(status);
+		entry.size = status.st_size;
+		entry.inode = status.st_ino;
+		entry.device = status.st_dev;
+
+		size_t size = status.st_size;
+
+		// Big templates are rendered directly from the page cache
+		if (size > MAP_THRESHOLD) {
+			std::shared_ptr<Mapping> mapping = std::make_shared<Mapping>(fd, size);
+			if (mapping->isValid()) {
+				close(fd);
+				entry.mapping = mapping;
+				return std::make_shared<Template>(mapping->getData(), size, mapping, tags,
+				                                  file);
+			}
+		}
+
+		string content(size, '\0');
+
+		size_t position = 0;
+		while (position < content.size()) {
+			ssize_t result = ::read(fd, &content[position], content.size() - position);
+			if (result == -1 && errno == EINTR) {
+				continue;
+			} else if (result <= 0) {
+				break;
+			}
+
+			position += result;
+		}
+
+		content.resize(position);
+		close(fd);
+		return std::make_shared<Template>(content, tags, file);
+	}
+
+	int _inotify;
+	std::atomic<uint64_t> _events;
+
+	// Milliseconds, and the steady clock time of the next check
+	std::atomic<unsigned int> _checkInterval;
+	std::atomic<int64_t> _nextCheck;
+
+	// Readers only load the pointer (libstdc++ protects the shared_ptr
+	// atomics with a small pool of spinlocks, not with this mutex), the
+	// mutex is for writers
+	std::shared_ptr<const Entries> _entries;
+	std::mutex _mutex;
+};
+
+}
+
+std::shared_ptr<const Template> TemplateCache::get(const string &file,
+                                                   const std::pair<string, string> &tags)
+{
+	return Cache::getInstance().get(file, tags);
+}
+
+uint64_t TemplateCache::getGeneration()
+{
+	return generation;
+}
+
+void TemplateCache::clear()
+{
+	Cache::getInstance().clear();
+}
+
+size_t TemplateCache::getSize()
+{
+	return Cache::getInstance().getSize();
+}
+
+void TemplateCache::setCheckInterval(const unsigned int checkInterval)
+{
+	Cache::getInstance().setCheckInterval(checkInterval);
+}
+
+unsigned int TemplateCache::getCheckInterval()
+{
+	return Cache::getInstance().getCheckInterval();
+}
+
+TemplateCache::TemplateCache()
+{
+}
+
+CGIPLUS_NS_END
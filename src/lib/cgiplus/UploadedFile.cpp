@@ -18,117 +18,540 @@
 */
 
 extern "C" {
+#include <fcntl.h>
 #include <unistd.h>
 }
 
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
-#include <sstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <vector>
 
+#include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <cgiplus/UploadedFile.hpp>
 
 CGIPLUS_NS_BEGIN
 
-UploadedFile::UploadedFile() :
-	_filename(""),
-	_controlName("")
+namespace {
+
+bool writeAll(const int fd, const char *data, const size_t size)
 {
+	size_t written = 0;
+	while (written < size) {
+		ssize_t result = ::write(fd, data + written, size - written);
+		if (result == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		written += result;
+	}
+
+	return true;
 }
 
-void UploadedFile::setMultipart(const string &multipart)
+int createSpoolFile(const string &directory, string &filename)
 {
-	// Each part is expected to contain "Content-disposition"
-	bool dispositionFound = false;
+	string pattern = "uploaded_file-XXXXXX";
+	if (directory.empty() == false) {
+		pattern = directory + "/" + pattern;
+	}
 
-	std::stringstream ss(multipart);
-	string line;
+	std::vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
 
-	// Try to find headers
-	while (std::getline(ss, line)) {
-		if (line.find("Content-") != string::npos) {
-			// Content-disposition is a special case
-			if (line.find("Content-Disposition") != string::npos) {
-				dispositionFound = true;
-			}
+	int fd = mkstemp(path.data());
+	if (fd == -1) {
+		return -1;
+	}
 
-			parseContentHeader(line);
-			continue;
+	filename = path.data();
+	return fd;
+}
+
+int createAnonymousFile(const string &directory, string &filename)
+{
+#ifdef O_TMPFILE
+	string path = (directory.empty() ? "." : directory);
+
+	int fd = ::open(path.c_str(), O_TMPFILE | O_RDWR, 0600);
+	if (fd == -1) {
+		return -1;
+	}
+
+	// The file has no name, the application can only reach it through
+	// the descriptor
+	filename = "/proc/self/fd/" + boost::lexical_cast<string>(fd);
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+}
+
+/*! \class UploadedFile::Storage
+ *  \brief Payload shared by all copies of an UploadedFile
+ *
+ * The payload lives in memory until it is too big or until a path is
+ * requested, then it is moved to a file. Processors can access the
+ * storage from other threads, so the file creation is protected.
+ */
+class UploadedFile::Storage
+{
+public:
+	Storage() :
+		filename(""),
+		canonicalPath(""),
+		fd(-1),
+		anonymous(false),
+		removed(false)
+	{
+	}
+
+	~Storage()
+	{
+		closeFile();
+	}
+
+	bool createFile(const string &directory, const Cleanup::Policy::Value cleanup)
+	{
+		if (filename.empty() == false) {
+			return true;
 		}
 
-		// CRLF is used to separate lines of data
-		boost::trim(line);
+		if (cleanup == Cleanup::Policy::ANONYMOUS) {
+			fd = createAnonymousFile(directory, filename);
+			anonymous = (fd != -1);
+		}
 
-		// Content-disposition is mandatory
-		if (line.empty() && dispositionFound) {
-			break;
+		// File systems without O_TMPFILE support get a named file
+		if (fd == -1) {
+			fd = createSpoolFile(directory, filename);
 		}
+
+		if (fd == -1) {
+			return false;
+		}
+
+		bool success = writeAll(fd, memory.data(), memory.size());
+		string().swap(memory);
+		return success;
 	}
 
-	// Payload ends with "--"
-	int begin = ss.tellg();
-	int end = multipart.find_last_of("--") - ss.tellg() - 1;
+	void closeFile()
+	{
+		if (fd != -1) {
+			::close(fd);
+			fd = -1;
+		}
+	}
 
-	// Write data into file
-	generateRandomFilename();
-	std::ofstream file(_filename); // TODO: Write binary?
-	file << multipart.substr(begin, end);
-	file.close();
-}
+	// Anonymous files exist only while the descriptor is open
+	void releaseFile()
+	{
+		if (anonymous == false) {
+			closeFile();
+		}
+	}
 
-string UploadedFile::getFilename() const
+	string memory;
+	string filename;
+	string canonicalPath;
+	int fd;
+	bool anonymous;
+
+	// After remove the payload is gone, nothing is created again
+	bool removed;
+
+	std::map<string, std::shared_future<string>> results;
+	std::mutex mutex;
+
+private:
+	Storage(const Storage &);
+	Storage& operator=(const Storage &);
+};
+
+UploadedFile::UploadedFile() :
+	_clientFilename(""),
+	_controlName(""),
+	_directory(""),
+	_spool(),
+	_expectedSize(0),
+	_cleanup(Cleanup::Policy::IMMEDIATE),
+	_contentStore(),
+	_memoryLimit(64 * 1024),
+	_size(0),
+	_digestValue("")
 {
-	return _filename;
 }
 
-string UploadedFile::getControlName() const
+void UploadedFile::setMultipart(const string &multipart)
 {
-	return _controlName;
+	// Headers and payload are separated by an empty line. Some clients
+	// use only LF instead of CRLF, so we accept both
+	size_t payloadBegin = string::npos;
+	size_t headersEnd = 0;
+
+	if (boost::starts_with(multipart, "\r\n")) {
+		payloadBegin = 2;
+	} else if (boost::starts_with(multipart, "\n")) {
+		payloadBegin = 1;
+	} else {
+		size_t crlf = multipart.find("\r\n\r\n");
+		size_t lf = multipart.find("\n\n");
+
+		if (crlf != string::npos && (lf == string::npos || crlf < lf)) {
+			headersEnd = crlf;
+			payloadBegin = crlf + 4;
+		} else if (lf != string::npos) {
+			headersEnd = lf;
+			payloadBegin = lf + 2;
+		}
+	}
+
+	// Content-disposition is mandatory
+	if (payloadBegin == string::npos) {
+		return;
+	}
+
+	std::vector<string> lines;
+	string headers = multipart.substr(0, headersEnd);
+	boost::split(lines, headers, boost::is_any_of("\n"));
+
+	for (auto line: lines) {
+		boost::trim(line);
+		parseContentHeader(line);
+	}
+
+	if (open() == false) {
+		return;
+	}
+
+	write(multipart.data() + payloadBegin, multipart.size() - payloadBegin);
+	close();
 }
 
 void UploadedFile::parseContentHeader(const string &contentHeader)
 {
-	std::vector<string> keysValues;
-	boost::split(keysValues, contentHeader, boost::is_any_of(":"));
+	size_t separator = contentHeader.find(":");
+	if (separator == string::npos) {
+		return;
+	}
 
-	if (keysValues.size() != 2 || keysValues[0] != "Content-Disposition") {
+	string key = boost::trim_copy(contentHeader.substr(0, separator));
+	if (boost::iequals(key, "Content-Disposition") == false) {
 		return;
 	}
 
-	boost::split(keysValues, keysValues[1], boost::is_any_of(";"));
+	std::vector<string> keysValues;
+	string value = contentHeader.substr(separator + 1);
+	boost::split(keysValues, value, boost::is_any_of(";"));
 
 	for (auto keyValue: keysValues) {
 		boost::trim(keyValue);
 
+		size_t pos = keyValue.find("=");
+		if (pos == string::npos) {
+			continue;
+		}
+
+		string parameter = keyValue.substr(pos + 1);
+		boost::trim(parameter);
+		if (parameter.size() >= 2 && boost::starts_with(parameter, "\"") &&
+		    boost::ends_with(parameter, "\"")) {
+			parameter = parameter.substr(1, parameter.size() - 2);
+		}
+
 		if (boost::starts_with(keyValue, "name=")) {
-			size_t pos = keyValue.find("=");
-			_controlName = keyValue.substr(pos + 2, keyValue.size() - pos - 3);
-			
+			_controlName = parameter;
+
 		} else if (boost::starts_with(keyValue,"filename=")) {
-			size_t pos = keyValue.find("=");
-			_filename = keyValue.substr(pos + 2, keyValue.size() - pos - 3);
+			_clientFilename = parameter;
 		}
 	}
 }
 
-void UploadedFile::generateRandomFilename()
+bool UploadedFile::open()
 {
-	// For now we are ignoring the current filename because this field
-	// is optional in upload parameters.
+	close();
 
-	char filename[21] = "uploaded_file-XXXXXX";
+	_storage = std::make_shared<Storage>();
+	_size = 0;
+	_digest = Digest(_digest.getAlgorithm());
+	_digestValue.clear();
 
-	int fd = mkstemp(filename);
-	if (fd == -1) {
+	return true;
+}
+
+bool UploadedFile::write(const char *data, const size_t size)
+{
+	if (!_storage || _storage->removed) {
+		return false;
+	}
+
+	_digest.update(data, size);
+	_size += size;
+
+	if (_storage->filename.empty()) {
+		if (_storage->memory.size() + size <= _memoryLimit) {
+			_storage->memory.append(data, size);
+			return true;
+		}
+
+		// Too big to stay in memory
+		if (_storage->createFile(getDirectory(), _cleanup) == false) {
+			return false;
+		}
+	}
+
+	return writeAll(_storage->fd, data, size);
+}
+
+void UploadedFile::close()
+{
+	if (!_storage) {
 		return;
 	}
-	close(fd);
 
-	_filename = static_cast<string>(filename);
+	_storage->releaseFile();
+	_digestValue = _digest.toString();
+
+	// Only a cryptographic digest can identify the content
+	if (_contentStore.isEnabled() &&
+	    _digest.getAlgorithm() == Digest::Algorithm::SHA256) {
+		bool stored = false;
+		if (_storage->filename.empty()) {
+			stored = _contentStore.add(_digestValue, _storage->memory.data(),
+			                           _storage->memory.size());
+		} else {
+			stored = _contentStore.add(_digestValue, _storage->filename);
+		}
+
+		if (stored) {
+			_storage->canonicalPath = _contentStore.getPath(_digestValue);
+		}
+	}
+}
+
+void UploadedFile::remove()
+{
+	if (!_storage) {
+		return;
+	}
+
+	// Processors could still be reading the file
+	waitResults();
+
+	std::lock_guard<std::mutex> lock(_storage->mutex);
+	_storage->closeFile();
+
+	if (_storage->anonymous == false) {
+		Cleanup::schedule(_storage->filename, _cleanup);
+	}
+
+	_storage->filename.clear();
+	_storage->canonicalPath.clear();
+	_storage->anonymous = false;
+	_storage->removed = true;
+
+	string().swap(_storage->memory);
+}
+
+UploadedFile& UploadedFile::setMemoryLimit(const size_t memoryLimit)
+{
+	_memoryLimit = memoryLimit;
+	return *this;
+}
+
+UploadedFile& UploadedFile::setDirectory(const string &directory)
+{
+	_directory = directory;
+	_spool.reset();
+	return *this;
+}
+
+UploadedFile& UploadedFile::setSpool(const std::shared_ptr<const Spool> &spool,
+                                     const size_t expectedSize)
+{
+	_spool = spool;
+	_expectedSize = expectedSize;
+	return *this;
+}
+
+UploadedFile& UploadedFile::setCleanup(const Cleanup::Policy::Value cleanup)
+{
+	_cleanup = cleanup;
+	return *this;
+}
+
+Cleanup::Policy::Value UploadedFile::getCleanup() const
+{
+	return _cleanup;
+}
+
+UploadedFile& UploadedFile::setContentStore(const ContentStore &contentStore)
+{
+	_contentStore = contentStore;
+	return *this;
+}
+
+string UploadedFile::getCanonicalPath() const
+{
+	if (!_storage) {
+		return "";
+	}
+
+	return _storage->canonicalPath;
+}
+
+bool UploadedFile::isInMemory() const
+{
+	if (!_storage) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(_storage->mutex);
+	return _storage->removed == false && _storage->filename.empty();
+}
+
+string UploadedFile::getContent() const
+{
+	if (!_storage) {
+		return "";
+	}
+
+	std::unique_lock<std::mutex> lock(_storage->mutex);
+	if (_storage->filename.empty()) {
+		return _storage->memory;
+	}
+
+	string filename = _storage->filename;
+	lock.unlock();
+
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	return string((std::istreambuf_iterator<char>(file)),
+	              std::istreambuf_iterator<char>());
+}
+
+UploadedFile& UploadedFile::setDigestAlgorithm(const Digest::Algorithm::Value algorithm)
+{
+	_digest = Digest(algorithm);
+	return *this;
+}
+
+Digest::Algorithm::Value UploadedFile::getDigestAlgorithm() const
+{
+	return _digest.getAlgorithm();
+}
+
+string UploadedFile::getDigest() const
+{
+	return _digestValue;
+}
+
+size_t UploadedFile::getSize() const
+{
+	return _size;
+}
+
+string UploadedFile::getFilename() const
+{
+	if (!_storage) {
+		return "";
+	}
+
+	std::lock_guard<std::mutex> lock(_storage->mutex);
+	if (_storage->removed) {
+		return "";
+	}
+
+	if (_storage->filename.empty()) {
+		// The file is created only when someone needs it
+		if (_storage->createFile(getDirectory(), _cleanup) == false) {
+			return "";
+		}
+		_storage->releaseFile();
+	}
+
+	return _storage->filename;
+}
+
+void UploadedFile::setResult(const string &processor,
+                             const std::shared_future<string> &result)
+{
+	if (!_storage) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(_storage->mutex);
+	_storage->results[processor] = result;
+}
+
+std::shared_future<string> UploadedFile::getResult(const string &processor) const
+{
+	if (!_storage) {
+		return std::shared_future<string>();
+	}
+
+	std::lock_guard<std::mutex> lock(_storage->mutex);
+
+	auto result = _storage->results.find(processor);
+	if (result == _storage->results.end()) {
+		return std::shared_future<string>();
+	}
+
+	return result->second;
+}
+
+void UploadedFile::waitResults() const
+{
+	if (!_storage) {
+		return;
+	}
+
+	std::map<string, std::shared_future<string>> results;
+
+	{
+		std::lock_guard<std::mutex> lock(_storage->mutex);
+		results = _storage->results;
+	}
+
+	for (auto result: results) {
+		result.second.wait();
+	}
+}
+
+string UploadedFile::getClientFilename() const
+{
+	return _clientFilename;
+}
+
+string UploadedFile::getControlName() const
+{
+	return _controlName;
+}
+
+string UploadedFile::getDirectory() const
+{
+	if (_spool) {
+		return _spool->resolve(_expectedSize);
+	}
+
+	return _directory;
 }
 
 CGIPLUS_NS_END
@@ -0,0 +1,111 @@
+/*
+  CGIplus Copyright (C) 2012 Rafael Dantas Justo
+
+  This file is part of CGIplus.
+
+  CGIplus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  CGIplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+
+#include <cgiplus/WorkerPool.hpp>
+
+CGIPLUS_NS_BEGIN
+
+WorkerPool::WorkerPool(const unsigned int workers, const size_t queueSize) :
+	_queueSize(queueSize == 0 ? 1 : queueSize),
+	_stopping(false)
+{
+	unsigned int numberOfThreads = (workers == 0 ? 1 : workers);
+	for (unsigned int i = 0; i < numberOfThreads; i++) {
+		_threads.push_back(std::thread(&WorkerPool::run, this));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+
+	_notEmpty.notify_all();
+
+	for (auto &thread: _threads) {
+		thread.join();
+	}
+}
+
+std::shared_future<string> WorkerPool::submit(const std::function<string()> &task)
+{
+	// The shared state of the future keeps the function, so it is
+	// released after running. Otherwise objects captured by the task
+	// (like an uploaded file that stores this future) are never
+	// destroyed
+	auto function = std::make_shared<std::function<string()>>(task);
+	auto run = [function]() {
+		std::function<string()> current;
+		current.swap(*function);
+		return current();
+	};
+
+	// std::function must be copyable, so the packaged task is shared
+	auto packagedTask = std::make_shared<std::packaged_task<string()>>(run);
+	std::shared_future<string> result = packagedTask->get_future().share();
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (_queue.size() >= _queueSize) {
+			_notFull.wait(lock);
+		}
+
+		_queue.push_back([packagedTask]() {
+				(*packagedTask)();
+			});
+	}
+
+	_notEmpty.notify_one();
+	return result;
+}
+
+unsigned int WorkerPool::getWorkers() const
+{
+	return _threads.size();
+}
+
+void WorkerPool::run()
+{
+	while (true) {
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (_queue.empty() && _stopping == false) {
+				_notEmpty.wait(lock);
+			}
+
+			if (_queue.empty()) {
+				return;
+			}
+
+			task = _queue.front();
+			_queue.pop_front();
+		}
+
+		_notFull.notify_one();
+		task();
+	}
+}
+
+CGIPLUS_NS_END
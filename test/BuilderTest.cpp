@@ -17,26 +17,54 @@
   along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
 #include <cstdio>
 #include <fstream>
+#include <iostream>
+#include <iterator>
 
 #include <boost/lexical_cast.hpp>
 
 #include <cgiplus/Builder.hpp>
 #include <cgiplus/Charset.hpp>
+#include <cgiplus/Cleanup.hpp>
 #include <cgiplus/Cookie.hpp>
+#include <cgiplus/Encoding.hpp>
+#include <cgiplus/EntityTag.hpp>
+#include <cgiplus/Escape.hpp>
+#include <cgiplus/FragmentCache.hpp>
 #include <cgiplus/HttpHeader.hpp>
+#include <cgiplus/Inflater.hpp>
 #include <cgiplus/Language.hpp>
 #include <cgiplus/MediaType.hpp>
+#include <cgiplus/Precondition.hpp>
+#include <cgiplus/Template.hpp>
+#include <cgiplus/TemplateCache.hpp>
+
+#include "PageTemplate.hpp"
 
 using boost::lexical_cast;
 
 using cgiplus::Builder;
 using cgiplus::Charset;
+using cgiplus::Cleanup;
 using cgiplus::Cookie;
+using cgiplus::Encoding;
+using cgiplus::EntityTag;
+using cgiplus::Escape;
+using cgiplus::FragmentCache;
 using cgiplus::HttpHeader;
+using cgiplus::Inflater;
 using cgiplus::Language;
 using cgiplus::MediaType;
+using cgiplus::Precondition;
+using cgiplus::Template;
+using cgiplus::TemplateCache;
 
 // When you need to run only one test, compile only this file with the
 // STAND_ALONE flag.
@@ -99,6 +127,180 @@ BOOST_AUTO_TEST_CASE(mustReplaceWhenThereIsAKeyMatch)
 	BOOST_CHECK_EQUAL(builder2.build(), content2);
 }
 
+BOOST_AUTO_TEST_CASE(mustReplaceTagsInASinglePass)
+{
+	Builder builder;
+	builder->setContentType(MediaType::TEXT_HTML);
+
+	string form = "";
+	string expected = "";
+	for (unsigned int i = 0; i < 200; i++) {
+		string key = "field" + lexical_cast<string>(i);
+		form += "<p><!-- " + key + " --></p>";
+		expected += "<p>" + lexical_cast<string>(i * 2) + "</p>";
+		builder[key] = lexical_cast<string>(i * 2);
+	}
+
+	// Repeated tags, tags without fields, nested beginnings and values
+	// that look like tags
+	form += "<!-- field1 --><!-- unknown --><!-- <!-- field2 --><!-- tag -->";
+	expected += "2<!-- unknown --><!-- 4<!-- field3 -->";
+	builder["tag"] = "<!-- field3 -->";
+
+	builder.setContent(form);
+
+	string header = "Content-Type: text/html" + HttpHeader::EOL +
+		"Content-Length: " + lexical_cast<string>(expected.size()) +
+		HttpHeader::EOL + HttpHeader::EOL;
+	BOOST_CHECK_EQUAL(builder.build(), header + expected);
+
+	builder << "<!-- field3 -->";
+	expected += "6";
+
+	header = "Content-Type: text/html" + HttpHeader::EOL +
+		"Content-Length: " + lexical_cast<string>(expected.size()) +
+		HttpHeader::EOL + HttpHeader::EOL;
+	BOOST_CHECK_EQUAL(builder.build(), header + expected);
+
+	Builder tagsBuilder;
+	tagsBuilder.setContent("Hello {{name}}, <!-- name -->");
+	tagsBuilder.setTags(std::make_pair("{{", "}}"));
+	tagsBuilder["name"] = "World";
+
+	BOOST_CHECK_EQUAL(tagsBuilder.build(),
+	                  "Content-Length: 26" + HttpHeader::EOL + HttpHeader::EOL +
+	                  "Hello World, <!-- name -->");
+}
+
+BOOST_AUTO_TEST_CASE(mustShowTheSameContentThatIsBuilt)
+{
+	string form = "";
+	for (unsigned int i = 0; i < 3000; i++) {
+		form += "<li><!-- item --> " + lexical_cast<string>(i) + "<!-- empty --></li>";
+	}
+
+	Builder builder;
+	builder.setContent(form);
+	builder->setContentType(MediaType::TEXT_HTML);
+	builder["item"] = "Item";
+	builder["empty"] = "";
+
+	// Anything buffered by the test framework must stay in the
+	// original output
+	std::cout.flush();
+
+	// The content is written directly to the descriptor
+	int outputFd = dup(STDOUT_FILENO);
+	int fileFd = open("builder-show.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	dup2(fileFd, STDOUT_FILENO);
+	close(fileFd);
+
+	// Removed only after the response
+	std::ofstream("builder-cleanup.tmp") << "upload";
+	Cleanup::schedule("builder-cleanup.tmp", Cleanup::Policy::AFTER_RESPONSE);
+
+	// Still in the buffer, show must write it first
+	std::cout << "Before";
+	builder.show();
+
+	dup2(outputFd, STDOUT_FILENO);
+	close(outputFd);
+
+	std::ifstream file("builder-show.tmp");
+	string content((std::istreambuf_iterator<char>(file)),
+	               std::istreambuf_iterator<char>());
+
+	BOOST_CHECK(content == "Before" + builder.build());
+	BOOST_CHECK_EQUAL(std::ifstream("builder-cleanup.tmp").good(), false);
+	BOOST_CHECK_EQUAL(Cleanup::getPending(), 0);
+
+	remove("builder-show.tmp");
+}
+
+BOOST_AUTO_TEST_CASE(mustExecuteTemplateStatements)
+{
+	std::ofstream includeFile("template-include.tmp");
+	includeFile << "<footer><!-- title --></footer>";
+	includeFile.close();
+
+	string form = "<h1><!-- title --></h1>"
+		"<!-- if admin -->Admin<!-- else -->User<!-- end -->"
+		"<table><!-- for user in users -->"
+		"<tr><td><!-- user.name --></td>"
+		"<!-- if user.email --><td><!-- user.email --></td><!-- end -->"
+		"<!-- for tag in tags --><i><!-- tag.name --></i><!-- end -->"
+		"</tr><!-- end --></table>"
+		"<!-- if not empty -->Empty<!-- end -->"
+		"<!-- include template-include.tmp -->";
+
+	std::ofstream formFile("template-form.tmp");
+	formFile << form;
+	formFile.close();
+
+	Builder builder;
+	builder.setTemplateFile("template-form.tmp");
+	builder["title"] = "Users";
+
+	Template::Row &first = builder.addRow("users");
+	first["name"] = "Rafael";
+	first["email"] = "rafael@example.com";
+	builder.addRow("users")["name"] = "Other";
+	builder.addRow("tags")["name"] = "a";
+	builder.addRow("tags")["name"] = "b";
+
+	string expected = "<h1>Users</h1>User<table>"
+		"<tr><td>Rafael</td><td>rafael@example.com</td><i>a</i><i>b</i></tr>"
+		"<tr><td>Other</td><i>a</i><i>b</i></tr>"
+		"</table>Empty<footer>Users</footer>";
+
+	string header = "Content-Length: " + lexical_cast<string>(expected.size()) +
+		HttpHeader::EOL + HttpHeader::EOL;
+	BOOST_CHECK_EQUAL(builder.build(), header + expected);
+
+	builder["admin"] = "yes";
+	builder.clearFields();
+	builder["admin"] = "yes";
+
+	expected = "<h1><!-- title --></h1>Admin<table></table>Empty<footer><!-- title --></footer>";
+	header = "Content-Length: " + lexical_cast<string>(expected.size()) +
+		HttpHeader::EOL + HttpHeader::EOL;
+	BOOST_CHECK_EQUAL(builder.build(), header + expected);
+
+	// Includes are kept when the delimiter changes
+	builder.setTags(std::make_pair("<!--", "-->"));
+	BOOST_CHECK_EQUAL(builder.build(), header + expected);
+
+	// Only template files include others, inside their directory
+	builder.setContent(form);
+	BOOST_CHECK(builder.build().find("<footer>") == string::npos);
+
+	mkdir("template-dir.tmp", 0700);
+	std::ofstream nestedFile("template-dir.tmp/form.tmp");
+	nestedFile << "<!-- include ../template-include.tmp --><!-- include /etc/passwd -->"
+	           << "<!-- include template-include.tmp -->";
+	nestedFile.close();
+
+	std::ofstream siblingFile("template-dir.tmp/template-include.tmp");
+	siblingFile << "<nav></nav>";
+	siblingFile.close();
+
+	builder.setTemplateFile("template-dir.tmp/form.tmp");
+	BOOST_CHECK_EQUAL(builder.build(),
+	                  "Content-Length: 11" + HttpHeader::EOL + HttpHeader::EOL + "<nav></nav>");
+
+	// Comments that look like statements are simple tags
+	builder.setContent("<!-- if you change this --><!-- end -->x<!-- end -->");
+	BOOST_CHECK_EQUAL(builder.build(),
+	                  "Content-Length: 52" + HttpHeader::EOL + HttpHeader::EOL +
+	                  "<!-- if you change this --><!-- end -->x<!-- end -->");
+
+	remove("template-dir.tmp/template-include.tmp");
+	remove("template-dir.tmp/form.tmp");
+	rmdir("template-dir.tmp");
+	remove("template-form.tmp");
+	remove("template-include.tmp");
+}
+
 BOOST_AUTO_TEST_CASE(mustDefineCookieCorrectly)
 {
 	string form = "<html><body>Test</body></html>";
@@ -144,6 +346,486 @@ BOOST_AUTO_TEST_CASE(mustLoadATemplateFileCorrectly)
 	remove("template-file.tmp");
 }
 
+BOOST_AUTO_TEST_CASE(mustNotReadMappedTemplateRewrittenInPlace)
+{
+	std::pair<string, string> tags("<!-- ", " -->");
+
+	unsigned int checkInterval = TemplateCache::getCheckInterval();
+	TemplateCache::setCheckInterval(0);
+
+	// Big enough to be mapped
+	string big(100 * 1024, 'x');
+	std::ofstream templateFile("template-mapped.tmp");
+	templateFile << big;
+	templateFile.close();
+
+	auto first = TemplateCache::get("template-mapped.tmp", tags);
+	BOOST_REQUIRE(first);
+	BOOST_CHECK(first->getContent() == big);
+
+	Builder builder;
+	builder.setTemplateFile("template-mapped.tmp");
+
+	// Truncated, the old pages are after the end of the file
+	uint64_t generation = TemplateCache::getGeneration();
+	templateFile.open("template-mapped.tmp");
+	templateFile << "Small";
+	templateFile.close();
+
+	auto second = TemplateCache::get("template-mapped.tmp", tags);
+	BOOST_REQUIRE(second);
+	BOOST_CHECK_EQUAL(second->getContent(), "Small");
+	BOOST_CHECK(first->getContent() == string(big.size(), '\0'));
+	BOOST_CHECK(TemplateCache::getGeneration() > generation);
+
+	// The builder renders the new file, not the zeros
+	BOOST_CHECK_EQUAL(builder.build(),
+	                  "Content-Length: 5" + HttpHeader::EOL + HttpHeader::EOL + "Small");
+
+	TemplateCache::clear();
+	TemplateCache::setCheckInterval(checkInterval);
+	remove("template-mapped.tmp");
+}
+
+BOOST_AUTO_TEST_CASE(mustReadTemplateFileOnlyWhenItChanges)
+{
+	std::pair<string, string> tags("<!-- ", " -->");
+
+	// Files checked on every access
+	unsigned int checkInterval = TemplateCache::getCheckInterval();
+	TemplateCache::setCheckInterval(0);
+
+	std::ofstream templateFile("template-cache.tmp");
+	templateFile << "First <!-- test -->";
+	templateFile.close();
+
+	auto first = TemplateCache::get("template-cache.tmp", tags);
+	BOOST_REQUIRE(first);
+	BOOST_CHECK_EQUAL(first->getContent(), "First <!-- test -->");
+	BOOST_CHECK(TemplateCache::get("template-cache.tmp", tags) == first);
+
+	Builder builder;
+	builder.setTemplateFile("template-cache.tmp");
+	builder["test"] = "version";
+	BOOST_CHECK_EQUAL(builder.build(),
+	                  "Content-Length: 13" + HttpHeader::EOL + HttpHeader::EOL +
+	                  "First version");
+
+	// Changed in place
+	templateFile.open("template-cache.tmp");
+	templateFile << "Second <!-- test -->";
+	templateFile.close();
+
+	auto second = TemplateCache::get("template-cache.tmp", tags);
+	BOOST_REQUIRE(second);
+	BOOST_CHECK_EQUAL(second->getContent(), "Second <!-- test -->");
+
+	// Replaced by another file
+	templateFile.open("template-cache.new");
+	templateFile << "Third <!-- test -->";
+	templateFile.close();
+	rename("template-cache.new", "template-cache.tmp");
+
+	builder.setTemplateFile("template-cache.tmp");
+	BOOST_CHECK_EQUAL(builder.build(),
+	                  "Content-Length: 13" + HttpHeader::EOL + HttpHeader::EOL +
+	                  "Third version");
+
+	// Changes are seen only in the next check
+	TemplateCache::setCheckInterval(60 * 1000);
+	auto third = TemplateCache::get("template-cache.tmp", tags);
+
+	templateFile.open("template-cache.tmp");
+	templateFile << "Fourth <!-- test -->";
+	templateFile.close();
+
+	BOOST_CHECK(TemplateCache::get("template-cache.tmp", tags) == third);
+	TemplateCache::setCheckInterval(0);
+
+	remove("template-cache.tmp");
+	BOOST_CHECK(!TemplateCache::get("template-cache.tmp", tags));
+
+	TemplateCache::clear();
+	BOOST_CHECK_EQUAL(TemplateCache::getSize(), 0);
+	TemplateCache::setCheckInterval(checkInterval);
+}
+
+BOOST_AUTO_TEST_CASE(mustRenderBigTemplateFiles)
+{
+	string form = "";
+	string expected = "";
+	for (unsigned int i = 0; i < 10000; i++) {
+		form += "<tr><td><!-- row --></td><td>" + lexical_cast<string>(i) + "</td></tr>";
+		expected += "<tr><td>value</td><td>" + lexical_cast<string>(i) + "</td></tr>";
+	}
+
+	std::ofstream templateFile("template-big.tmp");
+	templateFile << form;
+	templateFile.close();
+
+	Builder builder;
+	builder.setTemplateFile("template-big.tmp");
+	builder["row"] = "value";
+
+	string content = "Content-Length: " + lexical_cast<string>(expected.size()) +
+		HttpHeader::EOL + HttpHeader::EOL + expected;
+	BOOST_CHECK(builder.build() == content);
+
+	builder << "<!-- row -->";
+	expected += "value";
+
+	content = "Content-Length: " + lexical_cast<string>(expected.size()) +
+		HttpHeader::EOL + HttpHeader::EOL + expected;
+	BOOST_CHECK(builder.build() == content);
+
+	remove("template-big.tmp");
+}
+
+BOOST_AUTO_TEST_CASE(mustCompressContentAcceptedByClient)
+{
+	BOOST_CHECK_EQUAL(Encoding::negotiate("deflate;q=0.5, gzip"), Encoding::GZIP);
+	BOOST_CHECK_EQUAL(Encoding::negotiate("gzip;q=0.5, deflate"), Encoding::DEFLATE);
+	BOOST_CHECK_EQUAL(Encoding::negotiate("*;q=0.8"), Encoding::GZIP);
+	BOOST_CHECK_EQUAL(Encoding::negotiate("gzip;q=0, *"), Encoding::DEFLATE);
+	BOOST_CHECK_EQUAL(Encoding::negotiate("br, identity"), Encoding::IDENTITY);
+
+	string form = "";
+	for (unsigned int i = 0; i < 200; i++) {
+		form += "<li><!-- item --> " + lexical_cast<string>(i) + "</li>";
+	}
+
+	Builder builder;
+	builder.setContent(form);
+	builder["item"] = "Item";
+	builder.setCompression(6);
+
+	string plain = builder.build();
+
+	setenv("HTTP_ACCEPT_ENCODING", "deflate;q=0.5, gzip", 1);
+	string content = builder.build();
+
+	size_t separator = content.find(HttpHeader::EOL + HttpHeader::EOL);
+	BOOST_REQUIRE(separator != string::npos);
+	string header = content.substr(0, separator);
+	string body = content.substr(separator + HttpHeader::EOL.size() * 2);
+
+	BOOST_CHECK(header.find("Content-Encoding: gzip") != string::npos);
+	BOOST_CHECK(header.find("Vary: Accept-Encoding") != string::npos);
+	BOOST_CHECK(header.find("Content-Length: " + lexical_cast<string>(body.size())) !=
+	            string::npos);
+	BOOST_CHECK(body.size() < plain.size() / 4);
+
+	Inflater inflater(Encoding::GZIP, 1024 * 1024);
+	string inflated = "";
+	BOOST_CHECK(inflater.inflate(body.data(), body.size(), inflated));
+	BOOST_CHECK(inflater.isFinished());
+	BOOST_CHECK_EQUAL(inflated, plain.substr(plain.find(HttpHeader::EOL + HttpHeader::EOL) +
+	                                         HttpHeader::EOL.size() * 2));
+
+	// Client doesn't accept any compression
+	setenv("HTTP_ACCEPT_ENCODING", "gzip;q=0, identity", 1);
+	content = builder.build();
+	BOOST_CHECK(content.find("Content-Encoding") == string::npos);
+	BOOST_CHECK(content.find("Vary: Accept-Encoding") != string::npos);
+
+	// Small content is never compressed
+	setenv("HTTP_ACCEPT_ENCODING", "gzip", 1);
+	builder.setContent("Small <!-- item -->");
+	BOOST_CHECK_EQUAL(builder.build(), "Content-Length: 10" + HttpHeader::EOL +
+	                  HttpHeader::EOL + "Small Item");
+
+	unsetenv("HTTP_ACCEPT_ENCODING");
+}
+
+BOOST_AUTO_TEST_CASE(mustJoinPrecompressedTemplateParts)
+{
+	string literal = "";
+	for (unsigned int i = 0; i < 20; i++) {
+		literal += "<p class=\"static\">Static paragraph number " + lexical_cast<string>(i) + "</p>";
+	}
+
+	Builder builder;
+	builder.setContent("<html>" + literal + "<!-- title -->" + literal +
+	                   "<!-- for row in rows --><li><!-- row.name --></li>" + literal +
+	                   "<!-- end --></html>");
+	builder["title"] = "Title";
+	for (unsigned int i = 0; i < 10; i++) {
+		builder.addRow("rows")["name"] = "Row " + lexical_cast<string>(i);
+	}
+	builder.setCompression(1);
+
+	string plain = builder.build();
+	plain = plain.substr(plain.find(HttpHeader::EOL + HttpHeader::EOL) +
+	                     HttpHeader::EOL.size() * 2);
+
+	// Compressed literal parts are reused by the next responses
+	for (unsigned int i = 0; i < 2; i++) {
+		setenv("HTTP_ACCEPT_ENCODING", "gzip", 1);
+		string content = builder.build();
+		string body = content.substr(content.find(HttpHeader::EOL + HttpHeader::EOL) +
+		                             HttpHeader::EOL.size() * 2);
+		BOOST_CHECK(content.find("Content-Encoding: gzip") != string::npos);
+
+		Inflater gzipInflater(Encoding::GZIP, 1024 * 1024);
+		string inflated = "";
+		BOOST_CHECK(gzipInflater.inflate(body.data(), body.size(), inflated));
+		BOOST_CHECK(gzipInflater.isFinished());
+		BOOST_CHECK_EQUAL(inflated, plain);
+
+		setenv("HTTP_ACCEPT_ENCODING", "deflate", 1);
+		content = builder.build();
+		body = content.substr(content.find(HttpHeader::EOL + HttpHeader::EOL) +
+		                      HttpHeader::EOL.size() * 2);
+		BOOST_CHECK(content.find("Content-Encoding: deflate") != string::npos);
+
+		Inflater deflateInflater(Encoding::DEFLATE, 1024 * 1024);
+		inflated = "";
+		BOOST_CHECK(deflateInflater.inflate(body.data(), body.size(), inflated));
+		BOOST_CHECK(deflateInflater.isFinished());
+		BOOST_CHECK_EQUAL(inflated, plain);
+	}
+
+	unsetenv("HTTP_ACCEPT_ENCODING");
+}
+
+BOOST_AUTO_TEST_CASE(mustAnswerNotModifiedWhenEntityTagMatches)
+{
+	BOOST_CHECK(EntityTag::match("\"a\", W/\"b\"", "\"b\"", EntityTag::Comparison::WEAK));
+	BOOST_CHECK(EntityTag::match("\"a\", W/\"b\"", "\"b\"", EntityTag::Comparison::STRONG) == false);
+	BOOST_CHECK(EntityTag::match(" *", "\"c\"", EntityTag::Comparison::STRONG));
+	BOOST_CHECK(EntityTag::match("\"a,b\"", "\"a,b\"", EntityTag::Comparison::STRONG));
+	BOOST_CHECK(EntityTag::match("a", "\"a\"", EntityTag::Comparison::WEAK) == false);
+
+	Builder builder;
+	builder.setContent("Hello <!-- name -->!");
+	builder["name"] = "World";
+	builder.setEntityTagging(true);
+
+	string content = builder.build();
+	size_t begin = content.find("ETag: \"");
+	BOOST_REQUIRE(begin != string::npos);
+	string entityTag = content.substr(begin + 6, content.find(HttpHeader::EOL, begin) - begin - 6);
+	BOOST_CHECK_EQUAL(entityTag.size(), 18);
+
+	setenv("REQUEST_METHOD", "GET", 1);
+	setenv("HTTP_IF_NONE_MATCH", ("\"other\", " + entityTag).c_str(), 1);
+	BOOST_CHECK_EQUAL(builder.build(), "Status: 304 Not Modified" + HttpHeader::EOL +
+	                  "ETag: " + entityTag + HttpHeader::EOL + HttpHeader::EOL);
+
+	// Different content has a different tag
+	builder["name"] = "Moon";
+	content = builder.build();
+	BOOST_CHECK(content.find("Status: 304") == string::npos);
+	BOOST_CHECK(content.find("Hello Moon!") != string::npos);
+
+	// Only safe methods are answered with NOT_MODIFIED
+	builder["name"] = "World";
+	setenv("REQUEST_METHOD", "POST", 1);
+	BOOST_CHECK(builder.build().find("Hello World!") != string::npos);
+
+	// Compressed content has the coding in the tag
+	setenv("REQUEST_METHOD", "GET", 1);
+	setenv("HTTP_ACCEPT_ENCODING", "gzip", 1);
+	builder.setCompression(6, 0);
+	content = builder.build();
+	BOOST_CHECK(content.find("Content-Encoding: gzip") != string::npos);
+
+	begin = content.find("ETag: \"");
+	BOOST_REQUIRE(begin != string::npos);
+	string compressedTag = content.substr(begin + 6,
+	                                      content.find(HttpHeader::EOL, begin) - begin - 6);
+	BOOST_CHECK_EQUAL(compressedTag, entityTag.substr(0, entityTag.size() - 1) + "-gzip\"");
+
+	setenv("HTTP_IF_NONE_MATCH", compressedTag.c_str(), 1);
+	BOOST_CHECK_EQUAL(builder.build().find("Status: 304 Not Modified"), 0);
+
+	unsetenv("HTTP_ACCEPT_ENCODING");
+	unsetenv("REQUEST_METHOD");
+	unsetenv("HTTP_IF_NONE_MATCH");
+}
+
+BOOST_AUTO_TEST_CASE(mustAnswerPreconditionsBeforeBuilding)
+{
+	Precondition precondition;
+	precondition.setMethod(HttpHeader::Method::GET).setIfNoneMatch("\"v1\"");
+
+	Builder builder;
+	builder.setContent("Expensive <!-- name -->");
+	BOOST_CHECK(builder.checkPreconditions(precondition, EntityTag::create("v1")) == false);
+	builder["name"] = "content";
+	BOOST_CHECK_EQUAL(builder.build(), "Status: 304 Not Modified" + HttpHeader::EOL +
+	                  "ETag: \"v1\"" + HttpHeader::EOL + HttpHeader::EOL);
+
+	precondition.setMethod(HttpHeader::Method::DELETE);
+	BOOST_CHECK(builder.checkPreconditions(precondition, EntityTag::create("v1")) == false);
+	BOOST_CHECK_EQUAL(builder.build(), "Status: 412 Precondition Failed" + HttpHeader::EOL +
+	                  "ETag: \"v1\"" + HttpHeader::EOL + HttpHeader::EOL);
+
+	// Other content was not checked, so it's built
+	builder.setContent("Other <!-- name -->");
+	BOOST_CHECK_EQUAL(builder.build(), "Content-Length: 13" + HttpHeader::EOL +
+	                  "ETag: \"v1\"" + HttpHeader::EOL + HttpHeader::EOL + "Other content");
+
+	// The validators are sent with the content
+	Builder fresh;
+	fresh.setContent("Expensive <!-- name -->");
+	fresh["name"] = "content";
+	boost::posix_time::ptime lastModified =
+		boost::posix_time::time_from_string("2012-01-02 03:04:05");
+	BOOST_CHECK(fresh.checkPreconditions(Precondition(), EntityTag::create("v2"), lastModified));
+	BOOST_CHECK_EQUAL(fresh.build(), "Content-Length: 17" + HttpHeader::EOL +
+	                  "ETag: \"v2\"" + HttpHeader::EOL +
+	                  "Last-Modified: Mon, 02 Jan 2012 03:04:05 GMT" + HttpHeader::EOL +
+	                  HttpHeader::EOL + "Expensive content");
+}
+
+BOOST_AUTO_TEST_CASE(mustEscapeFieldsAccordingToContext)
+{
+	Builder builder;
+	builder.setContent("<p title=\"<!-- name -->\"><!-- name --></p>"
+	                   "<a href='<!-- link -->'>x</a><img src=<!-- image -->>"
+	                   "<!-- for row in rows --><i class=<!-- row.name -->><!-- row.name --></i><!-- end -->"
+	                   "<a href=\"<!-- bad -->\">y</a>"
+	                   "<a href=\"/search?q=<!-- query -->&amp;page=<!-- bad -->\">z</a>"
+	                   "<form action=/send/<!-- query -->>");
+	builder["query"] = "time: 10:30&x=1 #top";
+	builder["name"] = "<b>\"Tom & Jerry's\"</b> = x";
+	builder["link"] = "/search?q=a b&x=\"<y>\"";
+	builder["image"] = "http://host/\xC3\xA9.png";
+	builder["bad"] = " Java\tScript:alert(1)";
+	builder.addRow("rows")["name"] = "a b";
+
+	string raw = builder.build();
+	BOOST_CHECK(raw.find("<b>\"Tom & Jerry's\"</b> = x</p>") != string::npos);
+
+	builder.setEscaping(true);
+	string expected =
+		"<p title=\"&lt;b&gt;&quot;Tom&#32;&amp;&#32;Jerry&#39;s&quot;&lt;/b&gt;&#32;&#61;&#32;x\">"
+		"&lt;b&gt;&quot;Tom &amp; Jerry&#39;s&quot;&lt;/b&gt; = x</p>"
+		"<a href='/search?q=a%20b&amp;x=%22%3Cy%3E%22'>x</a><img src=http://host/%C3%A9.png>"
+		"<i class=a&#32;b>a b</i>"
+		"<a href=\"#\">y</a>"
+		"<a href=\"/search?q=time%3A%2010%3A30%26x%3D1%20%23top&amp;page="
+		"%20Java%09Script%3Aalert%281%29\">z</a>"
+		"<form action=/send/time%3A%2010%3A30%26x%3D1%20%23top>";
+
+	string content = builder.build();
+	BOOST_CHECK_EQUAL(content.substr(content.size() - expected.size()), expected);
+
+	// Long values are searched by blocks
+	string clean(100, 'a');
+	BOOST_CHECK_EQUAL(Escape::toString(clean + "<" + clean, Escape::Context::TEXT),
+	                  clean + "&lt;" + clean);
+	BOOST_CHECK_EQUAL(Escape::toString(clean + "\x01", Escape::Context::URL),
+	                  clean + "%01");
+	BOOST_CHECK_EQUAL(Escape::toString(clean, Escape::Context::ATTRIBUTE), clean);
+	BOOST_CHECK_EQUAL(Escape::toString("mailto:a@b", Escape::Context::URL), "mailto:a@b");
+	BOOST_CHECK_EQUAL(Escape::toString(clean + "/" + clean, Escape::Context::URL_COMPONENT),
+	                  clean + "%2F" + clean);
+	BOOST_CHECK_EQUAL(Escape::toString("\xC3\xA9-._~", Escape::Context::URL_COMPONENT),
+	                  "%C3%A9-._~");
+}
+
+BOOST_AUTO_TEST_CASE(mustCacheTemplateFragments)
+{
+	FragmentCache::clear();
+
+	Builder builder;
+	builder.setContent("<!-- cache navigation 0 section --><nav><!-- section --> "
+	                   "<!-- user --></nav><!-- end --><!-- user -->");
+	builder["section"] = "news";
+	builder["user"] = "john";
+
+	string content = builder.build();
+	BOOST_CHECK_EQUAL(content.substr(content.find("<nav>")), "<nav>news john</nav>john");
+	BOOST_CHECK_EQUAL(FragmentCache::getNumberOfFragments(), 1);
+
+	// The fragment depends only on the section
+	builder["user"] = "mary";
+	content = builder.build();
+	BOOST_CHECK_EQUAL(content.substr(content.find("<nav>")), "<nav>news john</nav>mary");
+
+	builder["section"] = "sports";
+	content = builder.build();
+	BOOST_CHECK_EQUAL(content.substr(content.find("<nav>")), "<nav>sports mary</nav>mary");
+	BOOST_CHECK_EQUAL(FragmentCache::getNumberOfFragments(), 2);
+	BOOST_CHECK_EQUAL(FragmentCache::getSize(), 42);
+
+	// The least recently used fragment is removed
+	size_t maxSize = FragmentCache::getMaxSize();
+	FragmentCache::setMaxSize(30);
+	BOOST_CHECK_EQUAL(FragmentCache::getNumberOfFragments(), 1);
+
+	builder["section"] = "news";
+	content = builder.build();
+	BOOST_CHECK_EQUAL(content.substr(content.find("<nav>")), "<nav>news mary</nav>mary");
+
+	FragmentCache::setMaxSize(maxSize);
+
+	// Another template (or a new version) with the same fragment name
+	builder.setContent("<!-- cache navigation 0 section -->"
+	                   "<menu><!-- section --></menu><!-- end -->");
+	BOOST_CHECK_EQUAL(builder.build(), "Content-Length: 17" + HttpHeader::EOL + HttpHeader::EOL +
+	                  "<menu>news</menu>");
+
+	// Inside loops the fragment depends on the columns of the row
+	builder.setContent("<!-- for row in rows --><!-- cache item 0 row.name -->"
+	                   "<li><!-- row.name --></li><!-- end --><!-- end -->");
+	builder.addRow("rows")["name"] = "a";
+	builder.addRow("rows")["name"] = "b";
+	builder.addRow("rows")["name"] = "a";
+	BOOST_CHECK_EQUAL(builder.build(), "Content-Length: 30" + HttpHeader::EOL + HttpHeader::EOL +
+	                  "<li>a</li><li>b</li><li>a</li>");
+
+	FragmentCache::clear();
+	BOOST_CHECK_EQUAL(FragmentCache::getSize(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mustRenderTemplatesCompiledIntoCpp)
+{
+	templates::PageTemplate page;
+	page.title = "Users";
+	page.footer = "End";
+
+	string output = "";
+	page.render(output);
+	BOOST_CHECK_EQUAL(output, "<h1>Users</h1>\nNo users\n\nEnd\n");
+
+	Template::Row row;
+	row["name"] = "John";
+	row["admin"] = "yes";
+	page.users.push_back(row);
+	row["name"] = "Mary";
+	row["admin"] = "";
+	page.users.push_back(row);
+
+	output.clear();
+	page.render(output);
+	BOOST_CHECK_EQUAL(output, "<h1>Users</h1>\n\n<p>John (admin)</p><p>Mary</p>\nEnd\n");
+
+	// Same result of the template (PageTemplate.html) compiled at runtime
+	Builder builder;
+	builder.setContent("<h1><!-- title --></h1>\n"
+	                   "<!-- if not users -->No users<!-- end -->\n"
+	                   "<!-- for user in users --><p><!-- user.name -->"
+	                   "<!-- if user.admin --> (admin)<!-- end --></p><!-- end -->\n"
+	                   "<!-- footer -->\n");
+	builder["title"] = "Users";
+	builder.addRow("users")["name"] = "John";
+
+	Builder compiled;
+	compiled.setRenderer(templates::PageTemplate::renderFields);
+	compiled["title"] = "Users";
+	compiled.addRow("users")["name"] = "John";
+
+	BOOST_CHECK_EQUAL(compiled.build(), builder.build());
+	BOOST_CHECK(compiled.build().find("<h1>Users</h1>\n\n<p>John</p>\n<!-- footer -->\n") !=
+	            string::npos);
+
+	compiled.setContent("Hello <!-- title -->");
+	BOOST_CHECK(compiled.build().find("Hello Users") != string::npos);
+}
+
 BOOST_AUTO_TEST_CASE(mustFlushTemplateWhenTemplateFileWasNotFound)
 {
 	Builder builder;
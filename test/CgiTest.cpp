@@ -17,28 +17,55 @@
   along with CGIplus.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+extern "C" {
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
 #include <set>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
 
+#include <zlib.h>
+
+#include <cgiplus/Capture.hpp>
 #include <cgiplus/Cgi.hpp>
 #include <cgiplus/Charset.hpp>
 #include <cgiplus/HttpHeader.hpp>
 #include <cgiplus/Language.hpp>
 #include <cgiplus/MediaType.hpp>
+#include <cgiplus/MultipartParser.hpp>
+#include <cgiplus/ReadPipeline.hpp>
+#include <cgiplus/Replay.hpp>
 
+using cgiplus::Capture;
 using cgiplus::Cgi;
 using cgiplus::Charset;
+using cgiplus::Cleanup;
+using cgiplus::Digest;
 using cgiplus::HttpHeader;
 using cgiplus::Language;
 using cgiplus::MediaType;
+using cgiplus::Precondition;
+using cgiplus::Progress;
+using cgiplus::ReadPipeline;
+using cgiplus::Replay;
+using cgiplus::Settings;
+using cgiplus::Spool;
+using cgiplus::UploadedFile;
 
 // When you need to run only one test, compile only this file with the
 // STAND_ALONE flag.
@@ -51,6 +78,33 @@ using cgiplus::MediaType;
 
 BOOST_AUTO_TEST_SUITE(cgiplusTests)
 
+static string gzipCompress(const string &data)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+	             Z_DEFAULT_STRATEGY);
+
+	string compressed(deflateBound(&stream, data.size()) + 32, 0);
+	stream.next_in = (Bytef*) data.data();
+	stream.avail_in = data.size();
+	stream.next_out = (Bytef*) &compressed[0];
+	stream.avail_out = compressed.size();
+	deflate(&stream, Z_FINISH);
+	compressed.resize(stream.total_out);
+	deflateEnd(&stream);
+
+	return compressed;
+}
+
+static void putbackInput(const string &input)
+{
+	std::cin.clear();
+	for (auto it = input.rbegin(); it != input.rend(); it++) {
+		std::cin.putback(*it);
+	}
+}
+
 BOOST_AUTO_TEST_CASE(mustParseEmptyInput)
 {
 	Cgi cgi;
@@ -148,6 +202,84 @@ BOOST_AUTO_TEST_CASE(mustDecodeAnUrlCorrectly)
 	BOOST_CHECK_EQUAL(cgi["key1"], "value1 value2 +:");
 }
 
+BOOST_AUTO_TEST_CASE(mustKeepHtmlCharactersWhenInputStrippingIsOff)
+{
+	setenv("REQUEST_METHOD", "GET", 1);
+	setenv("QUERY_STRING", "key1=%3Cb%3E%22O%27Neil%22%3C%2Fb%3E", 1);
+
+	Cgi stripped;
+	BOOST_CHECK_EQUAL(stripped["key1"], "bONeil/b");
+
+	Settings settings;
+	settings.setInputStripping(false);
+
+	Cgi cgi(settings);
+	BOOST_CHECK_EQUAL(cgi["key1"], "<b>\"O'Neil\"</b>");
+}
+
+BOOST_AUTO_TEST_CASE(mustParseConditionalHeaders)
+{
+	using boost::posix_time::ptime;
+	using boost::posix_time::time_from_string;
+
+	ptime date = time_from_string("1994-11-06 08:49:37");
+	BOOST_CHECK_EQUAL(HttpHeader::formatDate(date), "Sun, 06 Nov 1994 08:49:37 GMT");
+	BOOST_CHECK_EQUAL(HttpHeader::parseDate("Sun, 06 Nov 1994 08:49:37 GMT"), date);
+	BOOST_CHECK_EQUAL(HttpHeader::parseDate("Sunday, 06-Nov-94 08:49:37 GMT"), date);
+	BOOST_CHECK_EQUAL(HttpHeader::parseDate("Sun Nov  6 08:49:37 1994"), date);
+	BOOST_CHECK(HttpHeader::parseDate("Sun, 31 Nov 1994 08:49:37 GMT").is_not_a_date_time());
+
+	setenv("REQUEST_METHOD", "GET", 1);
+	setenv("HTTP_IF_NONE_MATCH", "\"v1\", W/\"v2\"", 1);
+	setenv("HTTP_IF_MODIFIED_SINCE", "Sun, 06 Nov 1994 08:49:37 GMT", 1);
+	unsetenv("HTTP_IF_MATCH");
+
+	Cgi cgi;
+	Precondition precondition = cgi.getPrecondition();
+	BOOST_CHECK_EQUAL(precondition.getIfNoneMatch(), "\"v1\", W/\"v2\"");
+	BOOST_CHECK_EQUAL(precondition.getIfModifiedSince(), date);
+	BOOST_CHECK(precondition.getIfMatch().empty());
+
+	BOOST_CHECK_EQUAL(precondition.evaluate("\"v2\"", ptime()), HttpHeader::Status::NOT_MODIFIED);
+	BOOST_CHECK_EQUAL(precondition.evaluate("\"v3\"", date), HttpHeader::Status::UNDEFINED);
+
+	// Without entity tags the modification time is compared
+	precondition.setIfNoneMatch("");
+	BOOST_CHECK_EQUAL(precondition.evaluate("", date + boost::posix_time::millisec(500)),
+	                  HttpHeader::Status::NOT_MODIFIED);
+	BOOST_CHECK_EQUAL(precondition.evaluate("", date + boost::posix_time::seconds(1)),
+	                  HttpHeader::Status::UNDEFINED);
+
+	unsetenv("HTTP_IF_NONE_MATCH");
+	unsetenv("HTTP_IF_MODIFIED_SINCE");
+	setenv("HTTP_IF_MATCH", "\"v1\"", 1);
+
+	cgi.readInputs();
+	BOOST_CHECK_EQUAL(cgi.getPrecondition().evaluate("\"v1\"", ptime()),
+	                  HttpHeader::Status::UNDEFINED);
+	BOOST_CHECK_EQUAL(cgi.getPrecondition().evaluate("\"v2\"", ptime()),
+	                  HttpHeader::Status::PRECONDITION_FAILED);
+	BOOST_CHECK_EQUAL(cgi.getPrecondition().evaluate("W/\"v1\"", ptime()),
+	                  HttpHeader::Status::PRECONDITION_FAILED);
+
+	// Unsafe methods fail instead of using the client copy
+	precondition.clear();
+	precondition.setMethod(HttpHeader::Method::PUT).setIfNoneMatch("*");
+	BOOST_CHECK_EQUAL(precondition.evaluate("\"v1\"", ptime()),
+	                  HttpHeader::Status::PRECONDITION_FAILED);
+
+	// Without validators there's nothing to match "*", so it creates
+	BOOST_CHECK_EQUAL(precondition.evaluate("", ptime()), HttpHeader::Status::UNDEFINED);
+	precondition.setIfNoneMatch("").setIfMatch("*");
+	BOOST_CHECK_EQUAL(precondition.evaluate("", ptime()),
+	                  HttpHeader::Status::PRECONDITION_FAILED);
+	BOOST_CHECK_EQUAL(precondition.evaluate("", date), HttpHeader::Status::UNDEFINED);
+
+	unsetenv("HTTP_IF_MATCH");
+	cgi.readInputs();
+	BOOST_CHECK(cgi.getPrecondition().isEmpty());
+}
+
 BOOST_AUTO_TEST_CASE(mustParseCookies)
 {
 	setenv("REQUEST_METHOD", "GET", 1);
@@ -184,6 +316,47 @@ BOOST_AUTO_TEST_CASE(mustConvertInputData)
 	BOOST_CHECK_EQUAL(cgi.get<double>("key2"), 5.1);
 }
 
+BOOST_AUTO_TEST_CASE(mustRememberConvertedInputData)
+{
+	setenv("REQUEST_METHOD", "GET", 1);
+	setenv("QUERY_STRING", "key1=5", 1);
+
+	unsigned int conversions = 0;
+	static unsigned int statelessConversions = 0;
+	statelessConversions = 0;
+
+	Cgi cgi;
+	BOOST_CHECK_EQUAL(cgi.get<int>("key1"), 5);
+	BOOST_CHECK_EQUAL(cgi.get<int>("key1"), 5);
+	BOOST_CHECK_EQUAL(cgi.get<double>("key1"), 5.0);
+	BOOST_CHECK_EQUAL(cgi.get<int>("key2"), 0);
+
+	for (unsigned int i = 0; i < 3; i++) {
+		BOOST_CHECK_EQUAL(cgi.get<int>("key1", [] (const string &value) {
+					statelessConversions++;
+					return boost::lexical_cast<int>(value) * 2;
+				}), 10);
+
+		BOOST_CHECK_EQUAL(cgi.get<int>("key1", [&] (const string &value) {
+					conversions++;
+					return boost::lexical_cast<int>(value) * 3;
+				}), 15);
+	}
+
+	// Converters with state are always called
+	BOOST_CHECK_EQUAL(statelessConversions, 1);
+	BOOST_CHECK_EQUAL(conversions, 3);
+
+	setenv("QUERY_STRING", "key1=7", 1);
+	cgi.readInputs();
+	BOOST_CHECK_EQUAL(cgi.get<int>("key1"), 7);
+	BOOST_CHECK_EQUAL(cgi.get<double>("key1"), 7.0);
+
+	// Remembering the values must not change how Cgi is copied
+	BOOST_CHECK(std::is_copy_constructible<Cgi>::value);
+	BOOST_CHECK(std::is_move_assignable<Cgi>::value);
+}
+
 BOOST_AUTO_TEST_CASE(mustConvertInputDataIntoObject)
 {
 	setenv("REQUEST_METHOD", "GET", 1);
@@ -247,6 +420,691 @@ BOOST_AUTO_TEST_CASE(mustParseUploadedFile)
 	fileStream.close();
 }
 
+BOOST_AUTO_TEST_CASE(mustParseBinaryUploadedFileWithDigest)
+{
+	string content = "multipart/form-data; boundary=AaB03x";
+
+	string payload("\x89PNG\r\n\x1a\n\0\0--\r\n-", 16);
+	payload += string("\0\xff\r\n--AaB03", 10);
+
+	string file = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"file.png\"\r\n"
+		"Content-Type: image/png\r\n\r\n" + payload + "\r\n"
+		"--AaB03x--\r\n";
+	string fileSize = boost::lexical_cast<string>(file.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", fileSize.c_str(), 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	putbackInput(file);
+
+	Cgi cgi(Settings().setUploadDigest(Digest::Algorithm::SHA256));
+
+	UploadedFile uploadedFile = cgi.get<UploadedFile>("file", Cgi::Source::FILE);
+	BOOST_CHECK_EQUAL(uploadedFile.getSize(), payload.size());
+	BOOST_CHECK_EQUAL(uploadedFile.getDigest(),
+	                  Digest::calculate(Digest::Algorithm::SHA256, payload));
+
+	std::ifstream fileStream(cgi.get("file", Cgi::Source::FILE),
+	                         std::ios::in | std::ios::binary);
+	BOOST_CHECK_EQUAL(fileStream.good(), true);
+
+	string stored((std::istreambuf_iterator<char>(fileStream)),
+	              std::istreambuf_iterator<char>());
+	BOOST_CHECK(stored == payload);
+}
+
+BOOST_AUTO_TEST_CASE(mustParseAllPartsOfMultipart)
+{
+	string content = "multipart/form-data; boundary=AaB03x";
+
+	string body = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+		"My photos\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"photos\"; filename=\"a.txt\"\r\n"
+		"Content-Type: text/plain\r\n\r\n"
+		"first file\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"photos\"; filename=\"b.txt\"\r\n"
+		"Content-Type: text/plain\r\n\r\n"
+		"second file\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"description\"\r\n\r\n"
+		"Two files\r\n"
+		"--AaB03x--\r\n";
+	string bodySize = boost::lexical_cast<string>(body.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", bodySize.c_str(), 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+	unsetenv("QUERY_STRING");
+
+	putbackInput(body);
+
+	Cgi cgi;
+	BOOST_CHECK_EQUAL(cgi.getNumberOfInputs(), 2);
+	BOOST_CHECK_EQUAL(cgi["title"], "My photos");
+	BOOST_CHECK_EQUAL(cgi["description"], "Two files");
+
+	std::vector<UploadedFile> files = cgi.getFiles("photos");
+	BOOST_CHECK_EQUAL(cgi.getNumberOfFiles(), 2);
+	BOOST_REQUIRE_EQUAL(files.size(), 2);
+	BOOST_CHECK_EQUAL(files[0].getClientFilename(), "a.txt");
+	BOOST_CHECK_EQUAL(files[1].getClientFilename(), "b.txt");
+	BOOST_CHECK_EQUAL(files[1].getSize(), 11);
+	BOOST_CHECK(files[0].getFilename() != files[1].getFilename());
+}
+
+BOOST_AUTO_TEST_CASE(mustParseMultipartSplitInSmallChunks)
+{
+	string body = "preamble\r\n--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"field\"\r\n\r\n"
+		"value with \r\n--AaB03 inside\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"big\"\r\n\r\n" +
+		string(100, 'b') + "\r\n"
+		"--AaB03x--\r\nepilogue";
+
+	cgiplus::MultipartParser parser("AaB03x", Settings().setMaxFieldSize(50));
+	for (char symbol : body) {
+		parser.feed(&symbol, 1);
+	}
+	parser.finish();
+
+	BOOST_REQUIRE_EQUAL(parser.getFields().size(), 1);
+	BOOST_CHECK_EQUAL(parser.getFields()[0].second, "value with \r\n--AaB03 inside");
+
+	BOOST_REQUIRE_EQUAL(parser.getFiles().size(), 1);
+	BOOST_CHECK_EQUAL(parser.getFiles()[0].getControlName(), "big");
+	BOOST_CHECK_EQUAL(parser.getFiles()[0].getSize(), 100);
+
+	parser.discard();
+}
+
+BOOST_AUTO_TEST_CASE(mustKeepSmallUploadedFilesInMemory)
+{
+	string content = "multipart/form-data; boundary=AaB03x";
+
+	string body = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"small\"; filename=\"a.txt\"\r\n\r\n"
+		"small file\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"big\"; filename=\"b.txt\"\r\n\r\n" +
+		string(200, 'b') + "\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"removed\"; filename=\"c.txt\"\r\n\r\n"
+		"removed file\r\n"
+		"--AaB03x--\r\n";
+	string bodySize = boost::lexical_cast<string>(body.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", bodySize.c_str(), 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	putbackInput(body);
+
+	string smallFilename;
+
+	{
+		Cgi cgi(Settings().setUploadMemoryLimit(100));
+
+		UploadedFile small = cgi.get<UploadedFile>("small", Cgi::Source::FILE);
+		BOOST_CHECK_EQUAL(small.isInMemory(), true);
+		BOOST_CHECK_EQUAL(small.getContent(), "small file");
+
+		UploadedFile big = cgi.get<UploadedFile>("big", Cgi::Source::FILE);
+		BOOST_CHECK_EQUAL(big.isInMemory(), false);
+		BOOST_CHECK_EQUAL(big.getContent(), string(200, 'b'));
+
+		// Path is created only when requested
+		smallFilename = cgi.get("small", Cgi::Source::FILE);
+		BOOST_CHECK_EQUAL(small.isInMemory(), false);
+
+		std::ifstream fileStream(smallFilename.c_str());
+		BOOST_CHECK_EQUAL(fileStream.good(), true);
+
+		// A removed file isn't created again
+		UploadedFile removed = cgi.get<UploadedFile>("removed", Cgi::Source::FILE);
+		removed.remove();
+		BOOST_CHECK_EQUAL(removed.isInMemory(), false);
+		BOOST_CHECK_EQUAL(removed.getFilename(), "");
+		BOOST_CHECK_EQUAL(removed.getContent(), "");
+	}
+
+	std::ifstream fileStream(smallFilename.c_str());
+	BOOST_CHECK_EQUAL(fileStream.good(), false);
+}
+
+BOOST_AUTO_TEST_CASE(mustWriteUploadedFilesInTheSpoolDirectory)
+{
+	char directoryTemplate[] = "/tmp/cgiplus-spool-XXXXXX";
+	string directory = mkdtemp(directoryTemplate);
+
+	string content = "multipart/form-data; boundary=AaB03x";
+
+	string body = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\n"
+		"spool\r\n"
+		"--AaB03x--\r\n";
+	string bodySize = boost::lexical_cast<string>(body.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", bodySize.c_str(), 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+	setenv("CGIPLUS_SPOOL_DIRECTORY", directory.c_str(), 1);
+	setenv("CGIPLUS_SPOOL_SHARDING", "none", 1);
+
+	putbackInput(body);
+
+	Spool spool;
+	BOOST_CHECK_EQUAL(spool.getDirectory(), directory);
+	BOOST_CHECK_EQUAL(spool.getSharding(), Spool::Sharding::NONE);
+
+	unsetenv("CGIPLUS_SPOOL_DIRECTORY");
+	unsetenv("CGIPLUS_SPOOL_SHARDING");
+
+	spool.setSharding(Spool::Sharding::WORKER, 4);
+
+	string base = directory + "/cgiplus-" + boost::lexical_cast<string>(getuid());
+	string shard = base + "/worker-" + boost::lexical_cast<string>(getpid() % 4);
+
+	{
+		Cgi cgi(Settings().setSpool(spool));
+
+		// The file is still in memory, so the spool wasn't resolved
+		BOOST_CHECK_EQUAL(access(base.c_str(), F_OK), -1);
+
+		string filename = cgi.get("file", Cgi::Source::FILE);
+		BOOST_CHECK_EQUAL(filename.compare(0, directory.size(), directory), 0);
+		BOOST_CHECK(filename.find("/worker-") != string::npos);
+
+		std::ifstream fileStream(filename.c_str());
+		BOOST_CHECK_EQUAL(fileStream.good(), true);
+	}
+
+	// Nothing fits in a spool without space
+	BOOST_CHECK_EQUAL(spool.resolve(std::numeric_limits<size_t>::max()), "");
+
+	BOOST_CHECK_EQUAL(rmdir(shard.c_str()), 0);
+	BOOST_CHECK_EQUAL(rmdir(base.c_str()), 0);
+	BOOST_CHECK_EQUAL(rmdir(directory.c_str()), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mustRemoveUploadedFilesAccordingToCleanupPolicy)
+{
+	string content = "multipart/form-data; boundary=AaB03x";
+
+	string body = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\n"
+		"cleanup\r\n"
+		"--AaB03x--\r\n";
+	string bodySize = boost::lexical_cast<string>(body.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", bodySize.c_str(), 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	Cleanup::Policy::Value policies[] = {
+		Cleanup::Policy::AFTER_RESPONSE,
+		Cleanup::Policy::BACKGROUND,
+		Cleanup::Policy::ANONYMOUS
+	};
+
+	for (auto policy: policies) {
+		putbackInput(body);
+
+		string filename;
+
+		{
+			Cgi cgi(Settings().setUploadCleanup(policy));
+			filename = cgi.get("file", Cgi::Source::FILE);
+
+			UploadedFile file = cgi.get<UploadedFile>("file", Cgi::Source::FILE);
+			BOOST_CHECK_EQUAL(file.getContent(), "cleanup");
+		}
+
+		if (policy == Cleanup::Policy::AFTER_RESPONSE) {
+			std::ifstream fileStream(filename.c_str());
+			BOOST_CHECK_EQUAL(fileStream.good(), true);
+			BOOST_CHECK_EQUAL(Cleanup::getPending(), 1);
+			Cleanup::flush();
+
+		} else if (policy == Cleanup::Policy::BACKGROUND) {
+			Cleanup::wait();
+		}
+
+		BOOST_CHECK_EQUAL(Cleanup::getPending(), 0);
+
+		if (policy != Cleanup::Policy::ANONYMOUS) {
+			std::ifstream fileStream(filename.c_str());
+			BOOST_CHECK_EQUAL(fileStream.good(), false);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(mustStoreRepeatedUploadsOnlyOnce)
+{
+	char directoryTemplate[] = "/tmp/cgiplus-store-XXXXXX";
+	string directory = mkdtemp(directoryTemplate);
+
+	string content = "multipart/form-data; boundary=AaB03x";
+
+	string body = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"small\"; filename=\"a.txt\"\r\n\r\n"
+		"abc\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"big\"; filename=\"b.txt\"\r\n\r\n" +
+		string(200, 'b') + "\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"copy\"; filename=\"c.txt\"\r\n\r\n" +
+		string(200, 'b') + "\r\n"
+		"--AaB03x--\r\n";
+	string bodySize = boost::lexical_cast<string>(body.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", bodySize.c_str(), 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	putbackInput(body);
+
+	cgiplus::ContentStore contentStore;
+	contentStore.setDirectory(directory);
+
+	string smallPath, bigPath;
+
+	{
+		// Spool and store in the same file system, allowing hard links
+		Cgi cgi(Settings()
+		        .setContentStore(contentStore)
+		        .setSpool(Spool().setDirectory(directory).setSharding(Spool::Sharding::NONE, 1))
+		        .setUploadMemoryLimit(100));
+
+		UploadedFile small = cgi.get<UploadedFile>("small", Cgi::Source::FILE);
+		BOOST_CHECK_EQUAL(small.getDigestAlgorithm(), Digest::Algorithm::SHA256);
+		BOOST_CHECK_EQUAL(small.getCanonicalPath(), contentStore.getPath(
+			"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+		UploadedFile big = cgi.get<UploadedFile>("big", Cgi::Source::FILE);
+		UploadedFile copy = cgi.get<UploadedFile>("copy", Cgi::Source::FILE);
+		BOOST_CHECK_EQUAL(big.getCanonicalPath().empty(), false);
+		BOOST_CHECK_EQUAL(big.getCanonicalPath(), copy.getCanonicalPath());
+
+		// All names point to the same data
+		struct stat bigInfo, copyInfo;
+		BOOST_CHECK_EQUAL(stat(big.getFilename().c_str(), &bigInfo), 0);
+		BOOST_CHECK_EQUAL(stat(copy.getFilename().c_str(), &copyInfo), 0);
+		BOOST_CHECK_EQUAL(bigInfo.st_ino, copyInfo.st_ino);
+
+		// Shared blobs can't be changed through any of the names
+		BOOST_CHECK_EQUAL(bigInfo.st_mode & 0777, 0444);
+
+		struct stat smallInfo;
+		BOOST_CHECK_EQUAL(stat(small.getCanonicalPath().c_str(), &smallInfo), 0);
+		BOOST_CHECK_EQUAL(smallInfo.st_mode & 0777, 0444);
+		BOOST_CHECK_EQUAL(copy.getContent(), string(200, 'b'));
+
+		smallPath = small.getCanonicalPath();
+		bigPath = big.getCanonicalPath();
+	}
+
+	// Blobs survive the request
+	std::ifstream smallStream(smallPath.c_str());
+	BOOST_CHECK_EQUAL(smallStream.good(), true);
+	std::ifstream bigStream(bigPath.c_str());
+	BOOST_CHECK_EQUAL(bigStream.good(), true);
+
+	BOOST_CHECK_EQUAL(contentStore.getPath("../etc/passwd"), "");
+
+	for (auto path: {smallPath, bigPath}) {
+		std::remove(path.c_str());
+		rmdir(path.substr(0, path.rfind('/')).c_str());
+	}
+	rmdir((directory + "/sha256").c_str());
+	BOOST_CHECK_EQUAL(rmdir(directory.c_str()), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mustPublishUploadProgress)
+{
+	string token = "progress-" + boost::lexical_cast<string>(getpid());
+
+	Progress progress;
+	BOOST_CHECK_EQUAL(progress.start(token, 1000), true);
+	progress.update(250);
+
+	Progress current = Progress::query(token);
+	BOOST_CHECK_EQUAL(current.getState(), Progress::State::RECEIVING);
+	BOOST_CHECK_EQUAL(current.getReceived(), 250);
+	BOOST_CHECK_EQUAL(current.getExpected(), 1000);
+
+	string postInput = "key1=value1&key2=value2";
+	string postInputSize = boost::lexical_cast<string>(postInput.size());
+
+	setenv("CONTENT_LENGTH", postInputSize.c_str(), 1);
+	setenv("CONTENT_TYPE", "application/x-www-form-urlencoded", 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+	setenv("HTTP_X_PROGRESS_ID", token.c_str(), 1);
+
+	putbackInput(postInput);
+
+	Cgi cgi;
+	unsetenv("HTTP_X_PROGRESS_ID");
+
+	current = Progress::query(token);
+	BOOST_CHECK_EQUAL(current.getState(), Progress::State::FINISHED);
+	BOOST_CHECK_EQUAL(current.getReceived(), postInput.size());
+	BOOST_CHECK_EQUAL(current.getExpected(), postInput.size());
+
+	BOOST_CHECK_EQUAL(Progress::query("unknown-" + token).getState(),
+	                  Progress::State::UNKNOWN);
+}
+
+BOOST_AUTO_TEST_CASE(mustResumeChunkedUploads)
+{
+	char directoryTemplate[] = "/tmp/cgiplus-resumable-XXXXXX";
+	string directory = mkdtemp(directoryTemplate);
+
+	Settings settings;
+	settings.setResumableDirectory(directory);
+
+	setenv("REQUEST_METHOD", "PATCH", 1);
+	setenv("CONTENT_TYPE", "application/octet-stream", 1);
+	setenv("HTTP_X_UPLOAD_ID", "upload-1", 1);
+
+	string chunks[] = { "first chunk ", "second chunk" };
+	string ranges[] = { "bytes 0-11/24", "bytes 12-23/24" };
+
+	// The second chunk is sent twice, as a client that lost the answer
+	bool retry = false;
+	for (auto index: {0, 1, 1}) {
+		string size = boost::lexical_cast<string>(chunks[index].size());
+		setenv("CONTENT_LENGTH", size.c_str(), 1);
+		setenv("HTTP_CONTENT_RANGE", ranges[index].c_str(), 1);
+		putbackInput(chunks[index]);
+
+		Cgi cgi(settings);
+		BOOST_CHECK_EQUAL(cgi.getResumableUpload().getId(), "upload-1");
+		BOOST_CHECK_EQUAL(cgi.getResumableUpload().getTotalSize(), 24);
+		BOOST_CHECK_EQUAL(cgi.getContent(), "");
+
+		if (index == 0) {
+			BOOST_CHECK_EQUAL(cgi.getResumableUpload().getOffset(), 12);
+			BOOST_CHECK_EQUAL(cgi.getResumableUpload().isComplete(), false);
+		} else {
+			BOOST_CHECK_EQUAL(cgi.getResumableUpload().getOffset(), 24);
+			BOOST_CHECK_EQUAL(cgi.getResumableUpload().isComplete(), true);
+		}
+
+		// The rejected chunk is still in the input
+		if (retry) {
+			std::vector<char> rejected(chunks[index].size());
+			std::cin.read(rejected.data(), rejected.size());
+		}
+
+		retry = (index == 1);
+	}
+
+	unsetenv("HTTP_X_UPLOAD_ID");
+	unsetenv("HTTP_CONTENT_RANGE");
+
+	// State is kept in the directory, another process can finalize it
+	cgiplus::ResumableUpload upload(directory, "upload-1");
+	BOOST_CHECK_EQUAL(upload.isComplete(), true);
+
+	string destination = directory + "/file.txt";
+	BOOST_CHECK_EQUAL(upload.finalize(destination), true);
+
+	std::ifstream fileStream(destination.c_str());
+	string content((std::istreambuf_iterator<char>(fileStream)),
+	               std::istreambuf_iterator<char>());
+	BOOST_CHECK_EQUAL(content, "first chunk second chunk");
+
+	BOOST_CHECK_EQUAL(cgiplus::ResumableUpload(directory, "../upload").isValid(), false);
+
+	uint64_t first, last, totalSize;
+	BOOST_CHECK_EQUAL(cgiplus::ResumableUpload::parseContentRange("bytes 10-19/*",
+	                                                              first, last, totalSize), true);
+	BOOST_CHECK_EQUAL(totalSize, 0);
+	BOOST_CHECK_EQUAL(cgiplus::ResumableUpload::parseContentRange("bytes 10-5/20",
+	                                                              first, last, totalSize), false);
+
+	std::remove(destination.c_str());
+	BOOST_CHECK_EQUAL(rmdir(directory.c_str()), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mustProcessUploadedFilesInBackground)
+{
+	string content = "multipart/form-data; boundary=AaB03x";
+
+	string body = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\n"
+		"first\r\n"
+		"--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"file\"; filename=\"b.txt\"\r\n\r\n"
+		"second file\r\n"
+		"--AaB03x--\r\n";
+	string bodySize = boost::lexical_cast<string>(body.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", bodySize.c_str(), 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	putbackInput(body);
+
+	Settings settings;
+	settings.setUploadWorkers(2)
+		.addUploadProcessor("size", [](const UploadedFile &file) {
+				return boost::lexical_cast<string>(file.getContent().size());
+			})
+		.addUploadProcessor("name", [](const UploadedFile &file) {
+				return file.getClientFilename();
+			});
+
+	Cgi cgi(settings);
+
+	std::vector<UploadedFile> files = cgi.getFiles("file");
+	BOOST_CHECK_EQUAL(files.size(), 2);
+
+	BOOST_CHECK_EQUAL(files[0].getResult("size").get(), "5");
+	BOOST_CHECK_EQUAL(files[0].getResult("name").get(), "a.txt");
+	BOOST_CHECK_EQUAL(files[1].getResult("size").get(), "11");
+	BOOST_CHECK_EQUAL(files[1].getResult("name").get(), "b.txt");
+	BOOST_CHECK_EQUAL(files[1].getResult("unknown").valid(), false);
+
+	// The results must not keep the files (and the processors) alive
+	std::weak_ptr<int> released;
+	putbackInput(body);
+
+	{
+		std::shared_ptr<int> sentinel = std::make_shared<int>(0);
+		released = sentinel;
+
+		Cgi processed(Settings().addUploadProcessor("sentinel", [sentinel](const UploadedFile &) {
+					return boost::lexical_cast<string>(*sentinel);
+				}));
+		BOOST_CHECK_EQUAL(processed.getFiles("file")[0].getResult("sentinel").get(), "0");
+	}
+
+	BOOST_CHECK(released.expired());
+}
+
+BOOST_AUTO_TEST_CASE(mustReadBigContentWhileParsing)
+{
+	// Bigger than the ring buffers, so they are reused
+	string postInput = "{\"data\": \"";
+	for (unsigned int i = 0; postInput.size() < 5 * 1024 * 1024; i++) {
+		postInput += boost::lexical_cast<string>(i % 10);
+	}
+	postInput += "\"}";
+	string postInputSize = boost::lexical_cast<string>(postInput.size());
+
+	setenv("CONTENT_LENGTH", postInputSize.c_str(), 1);
+	setenv("CONTENT_TYPE", "application/json", 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	putbackInput(postInput);
+
+	Cgi cgi(Settings().setPipelineThreshold(1));
+	BOOST_CHECK(cgi.getContent() == postInput);
+
+	string content = "multipart/form-data; boundary=AaB03x";
+	string body = "--AaB03x\r\n"
+		"Content-Disposition: form-data; name=\"field\"\r\n\r\n"
+		"value\r\n"
+		"--AaB03x--\r\n";
+	string bodySize = boost::lexical_cast<string>(body.size());
+
+	setenv("CONTENT_TYPE", content.c_str(), 1);
+	setenv("CONTENT_LENGTH", bodySize.c_str(), 1);
+
+	putbackInput(body);
+
+	Cgi multipartCgi(Settings().setPipelineThreshold(1));
+	BOOST_CHECK_EQUAL(multipartCgi["field"], "value");
+
+	// The reader is stopped when the consumer throws
+	ReadPipeline pipeline(2, 16);
+	auto reader = [](char *buffer, const size_t size) {
+		memset(buffer, 'a', size);
+		return true;
+	};
+
+	BOOST_CHECK_THROW(pipeline.run(1024, reader, [](const char *, const size_t) -> bool {
+				throw std::runtime_error("consumer");
+			}), std::runtime_error);
+
+	size_t consumed = 0;
+	BOOST_CHECK(pipeline.run(1024, reader, [&consumed](const char *, const size_t size) {
+				consumed += size;
+				return true;
+			}));
+	BOOST_CHECK_EQUAL(consumed, 1024);
+}
+
+BOOST_AUTO_TEST_CASE(mustCaptureAndReplayRequests)
+{
+	string logFile = "/tmp/cgiplus-capture-" +
+		boost::lexical_cast<string>(getpid()) + ".log";
+	unlink(logFile.c_str());
+
+	string postInput = "name=Rafael";
+	string postInputSize = boost::lexical_cast<string>(postInput.size());
+
+	setenv("QUERY_STRING", "page=2", 1);
+	setenv("CONTENT_LENGTH", postInputSize.c_str(), 1);
+	setenv("CONTENT_TYPE", "application/x-www-form-urlencoded", 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+	setenv("HTTP_COOKIE", "session=secret", 1);
+	setenv("HTTP_AUTHORIZATION", "Basic c2VjcmV0", 1);
+
+	putbackInput(postInput);
+
+	Cgi cgi(Settings().setCapture(Capture().setFile(logFile)));
+	BOOST_CHECK_EQUAL(cgi["name"], "Rafael");
+	BOOST_CHECK_EQUAL(cgi["page"], "2");
+
+	std::vector<Capture::Request> requests;
+	BOOST_CHECK(Capture::load(logFile, requests));
+	BOOST_REQUIRE_EQUAL(requests.size(), 1);
+	BOOST_CHECK_EQUAL(requests[0].getBody(), postInput);
+
+	// Session cookies and credentials are not recorded
+	bool queryRecorded = false;
+	for (auto variable: requests[0].getEnvironment()) {
+		BOOST_CHECK(variable.first != "HTTP_COOKIE");
+		BOOST_CHECK(variable.first != "HTTP_AUTHORIZATION");
+		queryRecorded = queryRecorded || variable.first == "QUERY_STRING";
+	}
+	BOOST_CHECK(queryRecorded);
+
+	Replay replay;
+	BOOST_CHECK(replay.load(logFile));
+	BOOST_CHECK_EQUAL(replay.getNumberOfRequests(), 1);
+
+	setenv("QUERY_STRING", "page=9", 1);
+	setenv("CGIPLUS_CAPTURE_FILE", logFile.c_str(), 1);
+
+	unsigned int matches = 0;
+	Replay::Statistics statistics = replay.run([&] () {
+			Cgi replayed;
+			if (replayed["name"] == "Rafael" && replayed["page"] == "2") {
+				matches++;
+			}
+
+			std::cout << "discarded";
+		}, 3);
+
+	BOOST_CHECK_EQUAL(matches, 3);
+	BOOST_CHECK_EQUAL(statistics.getRequests(), 3);
+	BOOST_CHECK(statistics.getPercentile(100) >= statistics.getPercentile(50));
+	BOOST_CHECK_EQUAL(getenv("QUERY_STRING"), "page=9");
+
+	// The replayed requests were not captured again
+	std::vector<Capture::Request> captured;
+	BOOST_CHECK(Capture::load(logFile, captured));
+	BOOST_CHECK_EQUAL(captured.size(), 1);
+	BOOST_CHECK_EQUAL(getenv("CGIPLUS_CAPTURE_FILE"), logFile);
+
+	unsetenv("CGIPLUS_CAPTURE_FILE");
+	unsetenv("HTTP_COOKIE");
+	unsetenv("HTTP_AUTHORIZATION");
+	unlink(logFile.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(mustInflateCompressedContent)
+{
+	string postInput = gzipCompress("key2=value2&key3=value3");
+	string postInputSize = boost::lexical_cast<string>(postInput.size());
+
+	setenv("QUERY_STRING", "key1=value1", 1);
+	setenv("CONTENT_LENGTH", postInputSize.c_str(), 1);
+	setenv("CONTENT_TYPE", "application/x-www-form-urlencoded", 1);
+	setenv("HTTP_CONTENT_ENCODING", "gzip", 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	putbackInput(postInput);
+
+	Cgi cgi;
+	BOOST_CHECK_EQUAL(cgi->getContentEncoding(), cgiplus::Encoding::GZIP);
+	BOOST_CHECK_EQUAL(cgi.getNumberOfInputs(), 3);
+	BOOST_CHECK_EQUAL(cgi["key2"], "value2");
+	BOOST_CHECK_EQUAL(cgi["key3"], "value3");
+
+	string json = "{\"key\": \"" + string(1000, 'a') + "\"}";
+	postInput = gzipCompress(json);
+	postInputSize = boost::lexical_cast<string>(postInput.size());
+
+	setenv("CONTENT_LENGTH", postInputSize.c_str(), 1);
+	setenv("CONTENT_TYPE", "application/json", 1);
+
+	putbackInput(postInput);
+
+	Cgi cgi2;
+	BOOST_CHECK_EQUAL(cgi2.getContent(), json);
+
+	unsetenv("HTTP_CONTENT_ENCODING");
+	unsetenv("QUERY_STRING");
+}
+
+BOOST_AUTO_TEST_CASE(mustIgnoreContentThatInflatesBeyondTheLimit)
+{
+	string postInput = gzipCompress("key=" + string(100000, 'a'));
+	string postInputSize = boost::lexical_cast<string>(postInput.size());
+
+	setenv("CONTENT_LENGTH", postInputSize.c_str(), 1);
+	setenv("CONTENT_TYPE", "application/x-www-form-urlencoded", 1);
+	setenv("HTTP_CONTENT_ENCODING", "gzip", 1);
+	setenv("REQUEST_METHOD", "POST", 1);
+
+	putbackInput(postInput);
+
+	Cgi cgi(Settings().setMaxContentSize(1024));
+	BOOST_CHECK_EQUAL(cgi.getNumberOfInputs(), 0);
+
+	unsetenv("HTTP_CONTENT_ENCODING");
+}
+
 BOOST_AUTO_TEST_CASE(mustParseAcceptField)
 {
 	setenv("REQUEST_METHOD", "GET", 1);